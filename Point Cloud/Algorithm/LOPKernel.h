@@ -0,0 +1,266 @@
+#pragma once
+#include "WLOPKernel.h"
+#include <vcg/space/point3.h>
+#include <math.h>
+
+// the double precision LOP loops shared by WLOP and Skeletonization, written
+// once as templates. the choices that used to be ifs on every pair (the
+// weight of the average term, the neighbor weights, the rows to skip) are
+// template parameters, the instantiation is picked once per call and its
+// inner loop has no branch left but the one of the radius.
+//
+// WLOPKernel::SCALAR runs these, the SSE and AVX loops of WLOPKernelSimd.h
+// take the same Rows. the rows are split over the threads, every row only
+// writes its own sums so the results do not depend on the thread count.
+namespace LOPKernel
+{
+	enum Flags
+	{
+		NEIGHBOR_WEIGHT = 1 << 0,   // rows.neighbor_weight
+		NEIGHBOR_FACTOR = 1 << 1,   // rows.neighbor_factor
+		SKIP_ROWS       = 1 << 2    // rows.row_skip
+	};
+
+	// the float arrays of Rows as the points they hold
+	inline const vcg::Point3f* pointsOf(const float* xyz)
+	{
+		return reinterpret_cast<const vcg::Point3f*>(xyz);
+	}
+
+	inline int flagsOf(const WLOPKernel::Rows& rows)
+	{
+		return (rows.neighbor_weight ? NEIGHBOR_WEIGHT : 0)
+			| (rows.neighbor_factor ? NEIGHBOR_FACTOR : 0)
+			| (rows.row_skip ? SKIP_ROWS : 0);
+	}
+
+
+	// weights of the average term, theta(|p - q|) / |p - q|^(2 - power)
+
+	// power >= 2: the gaussian alone
+	struct GaussianWeight
+	{
+		static inline double weight(const vcg::Point3f& diff, double dist2, const vcg::Point3f& normal,
+			double radius, double iradius16, double average_power)
+		{
+			return exp(dist2 * iradius16);
+		}
+	};
+
+	struct PowerWeight
+	{
+		static inline double weight(const vcg::Point3f& diff, double dist2, const vcg::Point3f& normal,
+			double radius, double iradius16, double average_power)
+		{
+			double len = sqrt(dist2);
+			if(len <= 0.001 * radius) len = radius*0.001;
+			return exp(dist2 * iradius16) / pow(len, 2 - average_power);
+		}
+	};
+
+	// the gaussian of the distance along the normal of the row
+	struct AnisotropicWeight
+	{
+		static inline double weight(const vcg::Point3f& diff, double dist2, const vcg::Point3f& normal,
+			double radius, double iradius16, double average_power)
+		{
+			double len = sqrt(dist2);
+			if(len <= 0.001 * radius) len = radius*0.001;
+			double hn = diff * normal;
+			double phi = exp(hn * hn * iradius16);
+			return phi / pow(len, 2 - average_power);
+		}
+	};
+
+
+	template <class Weight, int FLAGS>
+	void averageRows(const WLOPKernel::Rows& rows, double average_power,
+		vcg::Point3f* average, double* average_weight_sum)
+	{
+		const vcg::Point3f zero_normal(0, 0, 0);
+		const vcg::Point3f* points = pointsOf(rows.points);
+		const vcg::Point3f* normals = pointsOf(rows.normals);
+		const vcg::Point3f* neighbors = pointsOf(rows.neighbors);
+
+#pragma omp parallel for schedule(dynamic, 64)
+		for (int i = 0; i < rows.row_num; i++)
+		{
+			if ((FLAGS & SKIP_ROWS) && rows.row_skip[i])
+			{
+				continue;
+			}
+			const vcg::Point3f& p = points[i];
+			const vcg::Point3f& normal = normals ? normals[i] : zero_normal;
+
+			for (int j = rows.offsets[i]; j < rows.offsets[i+1]; j++)
+			{
+				int t = rows.indices[j];
+				const vcg::Point3f& q = neighbors[t];
+
+				vcg::Point3f diff = p - q;
+				double dist2  = diff.SquaredNorm();
+
+				double w = Weight::weight(diff, dist2, normal, rows.radius, rows.iradius16, average_power);
+				if (FLAGS & NEIGHBOR_WEIGHT)
+				{
+					w *= rows.neighbor_weight[t];
+				}
+				if (FLAGS & NEIGHBOR_FACTOR)
+				{
+					w *= rows.neighbor_factor[t];
+				}
+
+				average[i] += q * w;
+				average_weight_sum[i] += w;
+			}
+		}
+	}
+
+	template <int FLAGS>
+	void repulsionRows(const WLOPKernel::Rows& rows, double repulsion_power,
+		vcg::Point3f* repulsion, double* repulsion_weight_sum)
+	{
+		double radius = rows.radius;
+		double iradius16 = rows.iradius16;
+		const vcg::Point3f* points = pointsOf(rows.points);
+		const vcg::Point3f* neighbors = pointsOf(rows.neighbors);
+
+#pragma omp parallel for schedule(dynamic, 64)
+		for (int i = 0; i < rows.row_num; i++)
+		{
+			if ((FLAGS & SKIP_ROWS) && rows.row_skip[i])
+			{
+				continue;
+			}
+			const vcg::Point3f& p = points[i];
+
+			for (int j = rows.offsets[i]; j < rows.offsets[i+1]; j++)
+			{
+				int t = rows.indices[j];
+				vcg::Point3f diff = p - neighbors[t];
+
+				double dist2  = diff.SquaredNorm();
+				double len = sqrt(dist2);
+				if(len <= 0.001 * radius) len = radius*0.001;
+
+				double w = exp(dist2*iradius16);
+				double rep = w * pow(1.0 / len, repulsion_power);
+				if (FLAGS & NEIGHBOR_WEIGHT)
+				{
+					rep *= rows.neighbor_weight[t];
+				}
+				if (FLAGS & NEIGHBOR_FACTOR)
+				{
+					rep *= rows.neighbor_factor[t];
+				}
+
+				repulsion[i] += diff * rep;
+				repulsion_weight_sum[i] += rep;
+			}
+		}
+	}
+
+	template <int FLAGS>
+	void densityRows(const WLOPKernel::Rows& rows, double* density)
+	{
+		const vcg::Point3f* points = pointsOf(rows.points);
+		const vcg::Point3f* neighbors = pointsOf(rows.neighbors);
+
+#pragma omp parallel for schedule(dynamic, 256)
+		for (int i = 0; i < rows.row_num; i++)
+		{
+			if ((FLAGS & SKIP_ROWS) && rows.row_skip[i])
+			{
+				continue;
+			}
+			const vcg::Point3f& p = points[i];
+			double sum = 1.;
+
+			for (int j = rows.offsets[i]; j < rows.offsets[i+1]; j++)
+			{
+				double dist2  = (p - neighbors[rows.indices[j]]).SquaredNorm();
+				sum += exp(dist2*rows.iradius16);
+			}
+			density[i] = sum;
+		}
+	}
+
+
+	// one instantiation per combination of flags
+
+	typedef void (*AverageFunction)(const WLOPKernel::Rows&, double, vcg::Point3f*, double*);
+	typedef void (*RepulsionFunction)(const WLOPKernel::Rows&, double, vcg::Point3f*, double*);
+
+	template <class Weight>
+	AverageFunction averageFunction(int flags)
+	{
+		switch (flags)
+		{
+		case 0: return &averageRows<Weight, 0>;
+		case 1: return &averageRows<Weight, 1>;
+		case 2: return &averageRows<Weight, 2>;
+		case 3: return &averageRows<Weight, 3>;
+		case 4: return &averageRows<Weight, 4>;
+		case 5: return &averageRows<Weight, 5>;
+		case 6: return &averageRows<Weight, 6>;
+		default: return &averageRows<Weight, 7>;
+		}
+	}
+
+	inline RepulsionFunction repulsionFunction(int flags)
+	{
+		switch (flags)
+		{
+		case 0: return &repulsionRows<0>;
+		case 1: return &repulsionRows<1>;
+		case 2: return &repulsionRows<2>;
+		case 3: return &repulsionRows<3>;
+		case 4: return &repulsionRows<4>;
+		case 5: return &repulsionRows<5>;
+		case 6: return &repulsionRows<6>;
+		default: return &repulsionRows<7>;
+		}
+	}
+
+
+	// average[i] += sum q * w, average_weight_sum[i] += sum w
+	inline void averageTerm(const WLOPKernel::Rows& rows, double average_power, bool anisotropic,
+		vcg::Point3f* average, double* average_weight_sum)
+	{
+		int flags = flagsOf(rows);
+		AverageFunction function;
+		if (anisotropic)
+		{
+			function = averageFunction<AnisotropicWeight>(flags);
+		}
+		else if (average_power < 2)
+		{
+			function = averageFunction<PowerWeight>(flags);
+		}
+		else
+		{
+			function = averageFunction<GaussianWeight>(flags);
+		}
+		function(rows, average_power, average, average_weight_sum);
+	}
+
+	// repulsion[i] += sum (p - q) * w, repulsion_weight_sum[i] += sum w
+	inline void repulsionTerm(const WLOPKernel::Rows& rows, double repulsion_power,
+		vcg::Point3f* repulsion, double* repulsion_weight_sum)
+	{
+		repulsionFunction(flagsOf(rows))(rows, repulsion_power, repulsion, repulsion_weight_sum);
+	}
+
+	// density[i] = 1 + sum exp(d^2 * iradius16), the neighbor weights are not used
+	inline void densityTerm(const WLOPKernel::Rows& rows, double* density)
+	{
+		if (rows.row_skip)
+		{
+			densityRows<SKIP_ROWS>(rows, density);
+		}
+		else
+		{
+			densityRows<0>(rows, density);
+		}
+	}
+}
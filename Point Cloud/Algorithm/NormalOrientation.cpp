@@ -0,0 +1,347 @@
+#include "NormalOrientation.h"
+
+
+void NormalOrientation::computeKnnGraph(vector<CVertex>& vert, int k, CNeighborGraph& graph)
+{
+	int vert_num = vert.size();
+	k = MyMin(k, vert_num - 1);
+	if (k <= 0)
+	{
+		graph.offsets.assign(vert_num + 1, 0);
+		graph.indices.clear();
+		return;
+	}
+
+	CKdTree kdTree;
+	kdTree.build(vert);
+
+	graph.offsets.resize(vert_num + 1);
+	for (int i = 0; i <= vert_num; i++)
+	{
+		graph.offsets[i] = i * k;
+	}
+	graph.indices.assign(vert_num * k, 0);
+
+#pragma omp parallel
+	{
+		vector<CKdTree::Candidate> result;
+		result.reserve(k + 1);
+
+#pragma omp for schedule(dynamic, 1024)
+		for (int i = 0; i < vert_num; i++)
+		{
+			int found = kdTree.knnSearch(vert[i].P(), k + 1, result);
+
+			// the point itself is usually first, but not always among duplicates
+			int* row = &graph.indices[i * k];
+			int n = 0;
+			for (int j = 0; j < found && n < k; j++)
+			{
+				if (result[j].second != i)
+				{
+					row[n++] = result[j].second;
+				}
+			}
+		}
+	}
+}
+
+void NormalOrientation::computePcaNormals(const vector<CVertex>& vert, const CNeighborGraph& graph, vector<Point3f>& normals)
+{
+	int vert_num = vert.size();
+	vector<double> covariances(vert_num * 6, 0.0);
+
+#pragma omp parallel for schedule(dynamic, 1024)
+	for (int i = 0; i < vert_num; i++)
+	{
+		CNeighborGraph::Row neighbors = graph[i];
+
+		// the plane goes through the centroid of the point and its neighbors
+		Point3f center = vert[i].P();
+		for (int j = 0; j < neighbors.size(); j++)
+		{
+			center += vert[neighbors[j]].P();
+		}
+		center /= float(neighbors.size() + 1);
+
+		double* covariance = &covariances[i * 6];
+		for (int j = -1; j < neighbors.size(); j++)
+		{
+			Point3f diff = (j < 0 ? vert[i].P() : vert[neighbors[j]].P()) - center;
+			covariance[0] += diff[0] * diff[0];
+			covariance[1] += diff[0] * diff[1];
+			covariance[2] += diff[0] * diff[2];
+			covariance[3] += diff[1] * diff[1];
+			covariance[4] += diff[1] * diff[2];
+			covariance[5] += diff[2] * diff[2];
+		}
+	}
+
+	vector<double> eigenvalues;
+	vector<Point3f> eigenvectors;
+	GlobalFun::solveEigenBatch(covariances, eigenvalues, eigenvectors);
+
+	normals.resize(vert_num);
+	for (int i = 0; i < vert_num; i++)
+	{
+		normals[i] = eigenvectors[i * 3 + 2];
+	}
+}
+
+
+// edge order of the forest: weight, then the smaller index, then the larger
+static inline bool isLighter(float weight0, int a0, int b0, float weight1, int a1, int b1)
+{
+	if (weight0 != weight1)
+	{
+		return weight0 < weight1;
+	}
+	if (MyMin(a0, b0) != MyMin(a1, b1))
+	{
+		return MyMin(a0, b0) < MyMin(a1, b1);
+	}
+	return MyMax(a0, b0) < MyMax(a1, b1);
+}
+
+static int findPart(vector<int>& parent, int i)
+{
+	int root = i;
+	while (parent[root] != root)
+	{
+		root = parent[root];
+	}
+	while (parent[i] != root)
+	{
+		int next = parent[i];
+		parent[i] = root;
+		i = next;
+	}
+	return root;
+}
+
+void NormalOrientation::computeSpanningForest(const CNeighborGraph& graph, const vector<Point3f>& normals, vector<pair<int, int> >& tree_edges)
+{
+	int vert_num = graph.rowNum();
+	tree_edges.clear();
+
+	// knn rows are not symmetric, the lightest edge of a part may only be in the row of the other end
+	CNeighborGraph edges;
+	edges.offsets.assign(vert_num + 1, 0);
+	for (int i = 0; i < vert_num; i++)
+	{
+		CNeighborGraph::Row row = graph[i];
+		edges.offsets[i + 1] += row.size();
+		for (int j = 0; j < row.size(); j++)
+		{
+			edges.offsets[row[j] + 1]++;
+		}
+	}
+	for (int i = 0; i < vert_num; i++)
+	{
+		edges.offsets[i + 1] += edges.offsets[i];
+	}
+	edges.indices.resize(edges.offsets[vert_num]);
+	vector<int> cursor(edges.offsets.begin(), edges.offsets.end() - 1);
+	for (int i = 0; i < vert_num; i++)
+	{
+		CNeighborGraph::Row row = graph[i];
+		for (int j = 0; j < row.size(); j++)
+		{
+			edges.indices[cursor[i]++] = row[j];
+			edges.indices[cursor[row[j]]++] = i;
+		}
+	}
+
+	vector<int> part(vert_num);     // root of the part of every point
+	vector<int> parent(vert_num);   // union find over the roots
+	vector<int> roots(vert_num);
+	for (int i = 0; i < vert_num; i++)
+	{
+		part[i] = parent[i] = roots[i] = i;
+	}
+
+	vector<int> best_to(vert_num);
+	vector<float> best_weight(vert_num);
+	vector<int> part_best(vert_num, -1); // point whose best edge is the best of the part
+
+	while (true)
+	{
+		// lightest edge leaving the part, per point
+#pragma omp parallel for schedule(dynamic, 1024)
+		for (int i = 0; i < vert_num; i++)
+		{
+			CNeighborGraph::Row row = edges[i];
+			int to = -1;
+			float weight = 0;
+			for (int j = 0; j < row.size(); j++)
+			{
+				int t = row[j];
+				if (part[t] == part[i])
+				{
+					continue;
+				}
+				float w = 1.0f - fabs(normals[i] * normals[t]);
+				if (to < 0 || isLighter(w, i, t, weight, i, to))
+				{
+					to = t;
+					weight = w;
+				}
+			}
+			best_to[i] = to;
+			best_weight[i] = weight;
+		}
+
+		// lightest edge leaving the part, per part
+		for (int r = 0; r < roots.size(); r++)
+		{
+			part_best[roots[r]] = -1;
+		}
+		for (int i = 0; i < vert_num; i++)
+		{
+			if (best_to[i] < 0)
+			{
+				continue;
+			}
+			int& best = part_best[part[i]];
+			if (best < 0 || isLighter(best_weight[i], i, best_to[i], best_weight[best], best, best_to[best]))
+			{
+				best = i;
+			}
+		}
+
+		int merged_num = 0;
+		for (int r = 0; r < roots.size(); r++)
+		{
+			int u = part_best[roots[r]];
+			if (u < 0)
+			{
+				continue;
+			}
+			int v = best_to[u];
+
+			// with a strict edge order the picked edges have no cycle, this only
+			// drops the second copy when two parts picked the same edge
+			int a = findPart(parent, roots[r]);
+			int b = findPart(parent, part[v]);
+			if (a != b)
+			{
+				parent[MyMax(a, b)] = MyMin(a, b);
+				tree_edges.push_back(make_pair(u, v));
+				merged_num++;
+			}
+		}
+
+		if (merged_num == 0)
+		{
+			break;
+		}
+
+		// every old root now points straight at its new root
+		int root_num = 0;
+		for (int r = 0; r < roots.size(); r++)
+		{
+			if (findPart(parent, roots[r]) == roots[r])
+			{
+				roots[root_num++] = roots[r];
+			}
+		}
+		roots.resize(root_num);
+
+#pragma omp parallel for
+		for (int i = 0; i < vert_num; i++)
+		{
+			part[i] = parent[part[i]];
+		}
+	}
+}
+
+void NormalOrientation::orientNormals(const CNeighborGraph& graph, vector<Point3f>& normals, int root_index, bool flip_root)
+{
+	int vert_num = normals.size();
+	if (vert_num == 0)
+	{
+		return;
+	}
+
+	vector<pair<int, int> > tree_edges;
+	computeSpanningForest(graph, normals, tree_edges);
+
+	CNeighborGraph tree;
+	tree.offsets.assign(vert_num + 1, 0);
+	for (int i = 0; i < tree_edges.size(); i++)
+	{
+		tree.offsets[tree_edges[i].first + 1]++;
+		tree.offsets[tree_edges[i].second + 1]++;
+	}
+	for (int i = 0; i < vert_num; i++)
+	{
+		tree.offsets[i + 1] += tree.offsets[i];
+	}
+	tree.indices.resize(tree.offsets[vert_num]);
+	vector<int> cursor(tree.offsets.begin(), tree.offsets.end() - 1);
+	for (int i = 0; i < tree_edges.size(); i++)
+	{
+		tree.indices[cursor[tree_edges[i].first]++] = tree_edges[i].second;
+		tree.indices[cursor[tree_edges[i].second]++] = tree_edges[i].first;
+	}
+
+	if (root_index < 0 || root_index >= vert_num)
+	{
+		root_index = 0;
+	}
+	if (flip_root)
+	{
+		normals[root_index] = -normals[root_index];
+	}
+
+	// breadth first from the root, then from the first point of every part not reached
+	vector<char> is_visited(vert_num, 0);
+	vector<int> border;
+	border.reserve(vert_num);
+	for (int s = -1; s < vert_num; s++)
+	{
+		int start = (s < 0) ? root_index : s;
+		if (is_visited[start])
+		{
+			continue;
+		}
+
+		border.clear();
+		border.push_back(start);
+		is_visited[start] = 1;
+		for (int b = 0; b < border.size(); b++)
+		{
+			int current = border[b];
+			CNeighborGraph::Row sons = tree[current];
+			for (int j = 0; j < sons.size(); j++)
+			{
+				int son = sons[j];
+				if (is_visited[son])
+				{
+					continue;
+				}
+				if (normals[current] * normals[son] < 0)
+				{
+					normals[son] = -normals[son];
+				}
+				is_visited[son] = 1;
+				border.push_back(son);
+			}
+		}
+	}
+}
+
+void NormalOrientation::extrapolateNormals(vector<CVertex>& vert, int k, int root_index, bool flip_root)
+{
+	CNeighborGraph graph;
+	computeKnnGraph(vert, k, graph);
+
+	vector<Point3f> normals;
+	computePcaNormals(vert, graph, normals);
+	orientNormals(graph, normals, root_index, flip_root);
+
+	for (int i = 0; i < vert.size(); i++)
+	{
+		vert[i].N() = normals[i];
+	}
+}
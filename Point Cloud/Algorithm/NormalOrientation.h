@@ -0,0 +1,40 @@
+#pragma once
+#include "GlobalFunction.h"
+#include "NeighborGraph.h"
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+// pca normals of a point cloud oriented along a minimum spanning tree of the
+// knn graph (Hoppe et al. 92), what vcg::NormalExtrapolation does without its
+// two octrees, the serial Kruskal over all the edges and the mesh copy:
+//
+//  - one knn graph from a kd-tree, used for the planes and for the tree
+//  - the minimum spanning forest by Boruvka rounds, every point looks for the
+//    lightest edge leaving its part in parallel, then the parts are merged
+//  - the orientation is propagated from one root in every connected part,
+//    so clouds made of separate pieces are oriented piece by piece
+//
+// edge weight is 1 - |ni . nj|, ties are broken by the point indices so the
+// forest is the same for any number of threads.
+class NormalOrientation
+{
+public:
+	// row i holds the k nearest points of vert[i], vert[i] itself excluded
+	static void computeKnnGraph(vector<CVertex>& vert, int k, CNeighborGraph& graph);
+
+	// normal of the plane fit to every point and its row of the graph, not oriented
+	static void computePcaNormals(const vector<CVertex>& vert, const CNeighborGraph& graph, vector<Point3f>& normals);
+
+	// flips normals to agree with their parent in the minimum spanning forest.
+	// root_index keeps its normal (flipped if flip_root), -1 for the first point,
+	// the other parts keep the normal of their first point
+	static void orientNormals(const CNeighborGraph& graph, vector<Point3f>& normals, int root_index = -1, bool flip_root = false);
+
+	// the three above in place on vert[i].N(), for vcg::NormalExtrapolation::ExtrapolateNormals
+	static void extrapolateNormals(vector<CVertex>& vert, int k, int root_index = -1, bool flip_root = false);
+
+private:
+	static void computeSpanningForest(const CNeighborGraph& graph, const vector<Point3f>& normals, vector<pair<int, int> >& tree_edges);
+};
@@ -5,6 +5,7 @@ NormalSmoother::NormalSmoother(RichParameterSet* _para)
 {
 	mesh = NULL;
 	para = _para;
+	neighbor_graph_radius = -1;
 }
 
 NormalSmoother::~NormalSmoother(void)
@@ -45,6 +46,10 @@ void NormalSmoother::run()
 	{
 		runAnisotropicPCA();
 	}
+	else if (para->getBool("Run Double Buffered Smoothing"))
+	{
+		runNormalSmoothDoubleBuffered();
+	}
 	else
 	{
 		//int num_iterate = para->getInt("Number Of Iterate");	
@@ -55,6 +60,11 @@ void NormalSmoother::run()
 	}
 }
 
+bool NormalSmoother::iteratesInRun()
+{
+	return !para->getBool("Run Anistropic PCA") && para->getBool("Run Double Buffered Smoothing");
+}
+
 void NormalSmoother::input(CMesh* _mesh)
 {
 	if(_mesh == NULL)
@@ -111,7 +121,7 @@ void NormalSmoother::runNormalSmooth()
 	double iradius16 = -4 / radius2;
 
 	CMesh* samples = mesh;
-	GlobalFun::computeBallNeighbors(samples, NULL, para->getDouble("CGrid Radius"), samples->bbox);
+	GlobalFun::computeBallNeighbors(samples, NULL, para->getDouble("CGrid Radius"), samples->bbox, false);
 
 	normal_sum.assign(samples->vert.size(), Point3f(0.,0.,0.));
 	normal_weight_sum.assign(samples->vert.size(), 0);
@@ -119,10 +129,11 @@ void NormalSmoother::runNormalSmooth()
 	for(int i = 0; i < samples->vert.size(); i++)
 	{
 		CVertex& v = samples->vert[i];
+		CNeighborGraph::Row neighbors = samples->neighbor_graph[i];
 
-		for (int j = 0; j < v.neighbors.size(); j++)
+		for (int j = 0; j < neighbors.size(); j++)
 		{
-			CVertex& t = samples->vert[v.neighbors[j]];
+			CVertex& t = samples->vert[neighbors[j]];
 
 			Point3f diff = v.P() - t.P();
 			double dist2  = diff.SquaredNorm();
@@ -149,12 +160,103 @@ void NormalSmoother::runNormalSmooth()
 }
 
 
+// every pass reads the normals of the previous pass only, so the result does
+// not depend on the vertex order and the points are smoothed in parallel
+void NormalSmoother::runNormalSmoothDoubleBuffered()
+{
+	double sigma = para->getDouble("Sharpe Feature Bandwidth Sigma");
+	double radius = para->getDouble("CGrid Radius"); 
+	int iterate_num = para->getInt("Number Of Iterate");
+	double converge_threshold = para->getDouble("Smooth Converge Threshold");
 
+	double radius2 = radius * radius;
+	double iradius16 = -4 / radius2;
+	double sigma_term = pow(max(1e-8,1-cos(sigma/180.0*3.1415926)), 2);
 
+	CMesh* samples = mesh;
+	updateNeighborGraph(radius);
 
+	int vert_num = samples->vert.size();
+	normals_read.resize(vert_num);
+	normals_write.resize(vert_num);
+	for (int i = 0; i < vert_num; i++)
+	{
+		normals_read[i] = samples->vert[i].N();
+	}
 
+	// stops early once the normals move less than the threshold on average
+	int iterate_time = 0;
+	double mean_change = 0;
+	while (iterate_time < iterate_num)
+	{
+		double change_sum = 0;
 
+#pragma omp parallel for schedule(dynamic, 256) reduction(+:change_sum)
+		for (int i = 0; i < vert_num; i++)
+		{
+			const Point3f& p = samples->vert[i].P();
+			const Point3f& vm = normals_read[i];
+			CNeighborGraph::Row neighbors = neighbor_graph[i];
+
+			Point3f sum(0, 0, 0);
+			double weight_sum = 0;
+			for (int j = 0; j < neighbors.size(); j++)
+			{
+				int t = neighbors[j];
+				const Point3f& tm = normals_read[t];
+
+				double dist2 = (p - samples->vert[t].P()).SquaredNorm();
+				double psi = exp(-pow(1-vm*tm, 2)/sigma_term);
+				double theta = exp(dist2*iradius16);
+				double rep = max(psi * theta, 1e-10);
+
+				weight_sum += rep;
+				sum += tm * rep;
+			}
+
+			normals_write[i] = (weight_sum > 1e-6) ? sum / weight_sum : vm;
+			change_sum += (normals_write[i] - vm).Norm();
+		}
 
+		normals_read.swap(normals_write);
+		iterate_time++;
 
+		mean_change = vert_num > 0 ? change_sum / vert_num : 0;
+		if (mean_change < converge_threshold)
+		{
+			break;
+		}
+	}
 
+	for (int i = 0; i < vert_num; i++)
+	{
+		samples->vert[i].N() = normals_read[i];
+	}
+	cout << "normal smoothing: " << iterate_time << " passes, mean change of the last " << mean_change << endl;
+}
 
+void NormalSmoother::updateNeighborGraph(double radius)
+{
+	CMesh* samples = mesh;
+	int vert_num = samples->vert.size();
+
+	bool is_moved = (radius != neighbor_graph_radius || vert_num != neighbor_graph_points.size());
+	for (int i = 0; i < vert_num && !is_moved; i++)
+	{
+		is_moved = (samples->vert[i].P() != neighbor_graph_points[i]);
+	}
+	if (!is_moved)
+	{
+		return;
+	}
+
+	GlobalFun::computeBallNeighbors(samples, NULL, radius, samples->bbox, false);
+	neighbor_graph = samples->neighbor_graph;
+
+	neighbor_graph_points.resize(vert_num);
+	for (int i = 0; i < vert_num; i++)
+	{
+		neighbor_graph_points[i] = samples->vert[i].P();
+	}
+	neighbor_graph_radius = radius;
+}
@@ -23,6 +23,10 @@ public:
 	void run();
 	void clear(){ mesh = NULL; }
 
+	// the double buffered smoothing does all "Number Of Iterate" passes in one
+	// run(), the callers run it once instead of once per pass
+	bool iteratesInRun();
+
 	
 protected:
 	NormalSmoother(){}
@@ -31,6 +35,8 @@ private:
 	void input(CMesh* _mesh);
 	void runAnisotropicPCA();
 	void runNormalSmooth(); 
+	void runNormalSmoothDoubleBuffered();
+	void updateNeighborGraph(double radius);
 	void initVertexes();
 	
 private:
@@ -42,4 +48,12 @@ private:
 
 	vector<vcg::Point3f> normal_sum;
 	vector<double>  normal_weight_sum;
+
+	// double buffered smoothing: the ball neighbors are kept as long as the
+	// points and the radius stay the same
+	vector<vcg::Point3f> normals_read;
+	vector<vcg::Point3f> normals_write;
+	CNeighborGraph neighbor_graph;
+	vector<vcg::Point3f> neighbor_graph_points;
+	double neighbor_graph_radius;
 };
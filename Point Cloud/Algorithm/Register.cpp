@@ -26,7 +26,14 @@ void Rigister::setInput(DataMgr * pData)
 }
 void Rigister::run()
 {
-	runSparseICP();
+	if (m_para->getInt("ICP Levels") > 0)
+	{
+		runMultiResolutionICP();
+	}
+	else
+	{
+		runSparseICP();
+	}
 	//cout<<"do nothing"<<endl;
 }
 void Rigister::runSparseICP()
@@ -71,3 +78,167 @@ void Rigister::runSparseICP()
 	//cout<<"after,first point "<<SrCloud.col(0)<<endl;
 
 }
+
+
+// the sparse icp on voxel subsamples of both clouds, coarsest level first.
+// the finest voxel is "ICP Voxel Ratio" of the target box diagonal and every
+// coarser level doubles it. each level starts from the motion found by the one
+// before, only the subsamples are moved while it runs, and the source vertices
+// are moved once at the end.
+//
+// the shrinkage of the sparse icp works in absolute distances, the subsamples
+// are solved in a frame where the target box diagonal is 1 so the parameters
+// mean the same for scans of any size.
+//
+// "ICP Mode" picks the solver, point to plane uses the normals of the target.
+// the closest points of an icp iteration are searched again only for the
+// source points that moved far enough to have a new one.
+void Rigister::runMultiResolutionICP()
+{
+	int levels = m_para->getInt("ICP Levels");
+	double voxel_ratio = m_para->getDouble("ICP Voxel Ratio");
+	int mode = m_para->getInt("ICP Mode");
+	bool point_to_plane = (mode == SPARSE_POINT_TO_PLANE || mode == REWEIGHTED_POINT_TO_PLANE);
+
+	Box3f target_box;
+	for (int i = 0; i < m_target->vert.size(); i++)
+	{
+		target_box.Add(m_target->vert[i].P());
+	}
+	double diag = target_box.Diag();
+	if (diag <= 0)
+	{
+		cout << "Rigister: the target has no extent" << endl;
+		return;
+	}
+	Point3f center = target_box.Center();
+	Eigen::Affine3d to_unit = Eigen::Scaling(1.0 / diag) * Eigen::Translation3d(-center[0], -center[1], -center[2]);
+
+	SparseICP::SICP::Parameters pa;
+	SparseICP::ICP::Parameters robust_pa;
+	robust_pa.f = (SparseICP::ICP::Function)m_para->getInt("ICP Robust Function");
+	robust_pa.p = m_para->getDouble("ICP Robust Parameter");
+
+	Eigen::Affine3d motion = Eigen::Affine3d::Identity();
+	Eigen::Matrix3Xd source_points;
+	Eigen::Matrix3Xd target_points;
+	Eigen::Matrix3Xd target_normals;
+
+	for (int level = levels - 1; level >= 0; level--)
+	{
+		double voxel = voxel_ratio * (1 << level);
+		std::stringstream level_name;
+		level_name << "ICP Level " << level;
+		m_time.start(level_name.str());
+
+		voxelSubsample(m_sourse->vert, voxel * diag, source_points, NULL);
+		voxelSubsample(m_target->vert, voxel * diag, target_points, point_to_plane ? &target_normals : NULL);
+		source_points = to_unit * source_points;
+		target_points = to_unit * target_points;
+		cout << "voxel " << voxel * diag << ": " << source_points.cols() << " source and "
+			<< target_points.cols() << " target points" << endl;
+
+		// the result of a level is as good as its voxels, a finer stop is wasted
+		SparseICP::SICP::Parameters level_pa = pa;
+		level_pa.stop = (std::max)(pa.stop, voxel * 1e-3);
+		SparseICP::ICP::Parameters level_robust_pa = robust_pa;
+		level_robust_pa.stop = level_pa.stop;
+		if (source_points.cols() > 3 && target_points.cols() > 3)
+		{
+			SparseICP::ClosestPoints closest(target_points);
+			switch (mode)
+			{
+			case SPARSE_POINT_TO_PLANE:
+				motion = SparseICP::SICP::point_to_plane_motion(source_points, target_points, target_normals, closest, motion, level_pa);
+				break;
+			case REWEIGHTED_POINT_TO_POINT:
+				motion = SparseICP::ICP::point_to_point_motion(source_points, target_points, closest, motion, level_robust_pa);
+				break;
+			case REWEIGHTED_POINT_TO_PLANE:
+				motion = SparseICP::ICP::point_to_plane_motion(source_points, target_points, target_normals, closest, motion, level_robust_pa);
+				break;
+			default:
+				motion = SparseICP::SICP::point_to_point_motion(source_points, target_points, closest, motion, level_pa);
+				break;
+			}
+			cout << "closest point searches: " << closest.search_num << " of " << closest.query_num << endl;
+		}
+		m_time.end();
+	}
+
+	// back to the frame of the scans, the normals turn with the points
+	motion = to_unit.inverse() * motion * to_unit;
+	Eigen::Matrix3d rotation = motion.linear();
+	Eigen::Vector3d translation = motion.translation();
+	int srVerNum = m_sourse->vert.size();
+#pragma omp parallel for
+	for (int i = 0; i < srVerNum; i++)
+	{
+		CVertex& v = m_sourse->vert[i];
+		Eigen::Vector3d p = rotation * Eigen::Vector3d(v.P()[0], v.P()[1], v.P()[2]) + translation;
+		Eigen::Vector3d n = rotation * Eigen::Vector3d(v.N()[0], v.N()[1], v.N()[2]);
+		v.P() = Point3f(p[0], p[1], p[2]);
+		v.N() = Point3f(n[0], n[1], n[2]);
+	}
+}
+
+void Rigister::voxelSubsample(vector<CVertex>& vert, double voxel_size, Eigen::Matrix3Xd& points, Eigen::Matrix3Xd* normals)
+{
+	Box3f box;
+	for (int i = 0; i < vert.size(); i++)
+	{
+		box.Add(vert[i].P());
+	}
+	// points on the upper faces of the box would be out of the grid
+	box.Offset(voxel_size * 0.5);
+
+	CGrid grid;
+	grid.init(vert, box, voxel_size);
+
+	int cell_num = grid.xside * grid.yside * grid.zside;
+	int point_num = 0;
+	for (int c = 0; c < cell_num; c++)
+	{
+		if (!grid.isEmpty(c))
+		{
+			point_num++;
+		}
+	}
+
+	points.resize(3, point_num);
+	if (normals)
+	{
+		normals->resize(3, point_num);
+	}
+	int column = 0;
+	for (int c = 0; c < cell_num; c++)
+	{
+		if (grid.isEmpty(c))
+		{
+			continue;
+		}
+		Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+		for (CGrid::iterator it = grid.startV(c); it != grid.endV(c); ++it)
+		{
+			const Point3f& p = (*it)->P();
+			sum += Eigen::Vector3d(p[0], p[1], p[2]);
+		}
+		points.col(column) = sum / double(grid.endV(c) - grid.startV(c));
+
+		// the normals may not be oriented, they are flipped to the first one of the voxel
+		if (normals)
+		{
+			const Point3f& first = (*grid.startV(c))->N();
+			Eigen::Vector3d normal_sum = Eigen::Vector3d::Zero();
+			for (CGrid::iterator it = grid.startV(c); it != grid.endV(c); ++it)
+			{
+				const Point3f& n = (*it)->N();
+				double sign = (n * first < 0) ? -1.0 : 1.0;
+				normal_sum += sign * Eigen::Vector3d(n[0], n[1], n[2]);
+			}
+			double length = normal_sum.norm();
+			normals->col(column) = (length > 0) ? Eigen::Vector3d(normal_sum / length) : normal_sum;
+		}
+		column++;
+	}
+}
@@ -7,6 +7,16 @@
 
 class Rigister : public PointCloudAlgorithm
 {
+public:
+	// "ICP Mode"
+	enum Mode
+	{
+		SPARSE_POINT_TO_POINT = 0,
+		SPARSE_POINT_TO_PLANE = 1,
+		REWEIGHTED_POINT_TO_POINT = 2,   // SparseICP::ICP with "ICP Robust Function" and "ICP Robust Parameter"
+		REWEIGHTED_POINT_TO_PLANE = 3
+	};
+
 public:
 	Rigister(RichParameterSet * para);
 	~Rigister();
@@ -21,6 +31,11 @@ public:
 private:
 	void input(CMesh * _samples,CMesh * _original);
 	void runSparseICP();
+	void runMultiResolutionICP();
+
+	// the centroid of the points in every voxel of side voxel_size, one column per voxel,
+	// and the mean normal of the voxel if normals is given
+	static void voxelSubsample(vector<CVertex>& vert, double voxel_size, Eigen::Matrix3Xd& points, Eigen::Matrix3Xd* normals);
 
 private:
 	RichParameterSet * m_para;
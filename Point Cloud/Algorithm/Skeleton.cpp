@@ -2,9 +2,9 @@
 
 
 
-void Branch::pushBackCVertex(CVertex& new_v)
+void Branch::pushBackNode(const SkeletonNode& new_node)
 {
-	curve.push_back(new_v);
+	curve.push_back(new_node);
 }
 
 int Branch::getSize()
@@ -226,18 +226,19 @@ void Branch::rememberVirtualTail()
 
 void Skeleton::generateBranchSampleMap()
 {
-	vector<Branch>::iterator iter;
-	for (iter = branches.begin(); iter != branches.end();)
+	int kept_num = 0;
+	for (int i = 0; i < branches.size(); i++)
 	{
-		if (iter->isEmpty())
+		if (!branches[i].isEmpty())
 		{
-			iter = branches.erase(iter);
-		}
-		else
-		{
-			++iter;
+			if (kept_num != i)
+			{
+				branches[kept_num].swap(branches[i]);
+			}
+			kept_num++;
 		}
 	}
+	branches.resize(kept_num);
 
 	branch_sample_map.clear();
 	int cnt = 0;
@@ -272,6 +273,15 @@ void Skeleton::generateBranchSampleMap()
 	chosen_branches.clear();
 }
 
+void Skeleton::eraseBranch(int branch_i)
+{
+	for (int i = branch_i; i + 1 < branches.size(); i++)
+	{
+		branches[i].swap(branches[i + 1]);
+	}
+	branches.pop_back();
+}
+
 
 
 
@@ -334,7 +344,7 @@ void Branch::inactiveAndKeepVirtualHead()
     return;
   }
 
-  CVertex& head = curve[0];
+  SkeletonNode& head = curve[0];
   head.is_skel_virtual = false;
 
 }
@@ -346,7 +356,7 @@ void Branch::inactiveAndDropVirtualHead()
     return;
   }
 
-  CVertex& head = curve[0];
+  SkeletonNode& head = curve[0];
   head.is_skel_virtual = false;
 
   if (back_up_head.X() > -5)
@@ -371,7 +381,7 @@ void Branch::inactiveAndKeepVirtualTail()
     return;
   }
 
-  CVertex& tail = curve[curve.size()-1];
+  SkeletonNode& tail = curve[curve.size()-1];
   tail.is_skel_virtual = false;
 }
 
@@ -382,7 +392,7 @@ void Branch::inactiveAndDropVirtualTail()
     return;
   }
 
-  CVertex& tail = curve[curve.size()-1];
+  SkeletonNode& tail = curve[curve.size()-1];
   tail.is_skel_virtual = false;
 
   if (back_up_tail.X() > -5)
@@ -426,4 +436,129 @@ bool Branch::moveTailToPt(Point3f p_target)
   curve[curve.size()-1].P() = p_target;
 
 	return true;
-}
\ No newline at end of file
+}
+void SkeletonPointGrid::clear(double _cell_size)
+{
+	cells.clear();
+	cell_size = _cell_size > 0 ? _cell_size : 1.0;
+}
+
+SkeletonPointGrid::Cell SkeletonPointGrid::getCell(Point3f p)
+{
+	// removed points are far away, keep their cells in the int range
+	Cell c;
+	int* coords[3] = {&c.x, &c.y, &c.z};
+	for (int i = 0; i < 3; i++)
+	{
+		double coord = floor(p[i] / cell_size);
+		*coords[i] = int(MyMax(-1e9, MyMin(1e9, coord)));
+	}
+	return c;
+}
+
+void SkeletonPointGrid::insert(int id, Point3f p)
+{
+	cells[getCell(p)].push_back(make_pair(id, p));
+}
+
+void SkeletonPointGrid::remove(int id, Point3f p)
+{
+	map<Cell, CellPoints>::iterator iter = cells.find(getCell(p));
+	if (iter == cells.end())
+	{
+		return;
+	}
+
+	CellPoints& points = iter->second;
+	for (int i = 0; i < points.size(); i++)
+	{
+		if (points[i].first == id)
+		{
+			points.erase(points.begin() + i);
+			break;
+		}
+	}
+	if (points.empty())
+	{
+		cells.erase(iter);
+	}
+}
+
+void SkeletonPointGrid::findNearPoints(Point3f p, double dist2, vector<int>& ids)
+{
+	ids.clear();
+	Cell c = getCell(p);
+	for (int x = c.x - 1; x <= c.x + 1; x++)
+	{
+		for (int y = c.y - 1; y <= c.y + 1; y++)
+		{
+			for (int z = c.z - 1; z <= c.z + 1; z++)
+			{
+				Cell neighbor = {x, y, z};
+				map<Cell, CellPoints>::iterator iter = cells.find(neighbor);
+				if (iter == cells.end())
+				{
+					continue;
+				}
+
+				CellPoints& points = iter->second;
+				for (int i = 0; i < points.size(); i++)
+				{
+					if (GlobalFun::computeEulerDistSquare(p, points[i].second) < dist2)
+					{
+						ids.push_back(points[i].first);
+					}
+				}
+			}
+		}
+	}
+	sort(ids.begin(), ids.end());
+}
+
+bool SkeletonPointGrid::hasNearPoint(Point3f p, double dist2)
+{
+	vector<int> ids;
+	findNearPoints(p, dist2, ids);
+	return !ids.empty();
+}
+
+
+void BranchEndIndex::build(vector<Branch>& branches, double cell_size)
+{
+	grid.clear(cell_size);
+	heads.resize(branches.size());
+	tails.resize(branches.size());
+	for (int i = 0; i < branches.size(); i++)
+	{
+		heads[i] = branches[i].getHead();
+		tails[i] = branches[i].getTail();
+		grid.insert(i * 2, heads[i]);
+		grid.insert(i * 2 + 1, tails[i]);
+	}
+}
+
+void BranchEndIndex::updateBranch(vector<Branch>& branches, int branch_i)
+{
+	grid.remove(branch_i * 2, heads[branch_i]);
+	grid.remove(branch_i * 2 + 1, tails[branch_i]);
+
+	heads[branch_i] = branches[branch_i].getHead();
+	tails[branch_i] = branches[branch_i].getTail();
+	grid.insert(branch_i * 2, heads[branch_i]);
+	grid.insert(branch_i * 2 + 1, tails[branch_i]);
+}
+
+void BranchEndIndex::findNearEnds(Point3f p, double dist2, vector<int>& end_ids)
+{
+	grid.findNearPoints(p, dist2, end_ids);
+}
+
+void BranchEndIndex::findNearBranches(Point3f p, double dist2, vector<int>& branch_ids)
+{
+	grid.findNearPoints(p, dist2, branch_ids);
+	for (int i = 0; i < branch_ids.size(); i++)
+	{
+		branch_ids[i] /= 2;
+	}
+	branch_ids.erase(unique(branch_ids.begin(), branch_ids.end()), branch_ids.end());
+}
@@ -1,8 +1,41 @@
 #pragma once
 #include "GlobalFunction.h"
 #include "ParameterMgr.h"
+#include <map>
 
-typedef vector<CVertex> Curve;
+// one node of a skeleton curve, what the skeleton keeps of the sample it was
+// made from. a CVertex also carries its neighbor lists, color and eigen frames,
+// and curves are copied, reversed and combined all the time
+class SkeletonNode
+{
+public:
+	SkeletonNode():m_index(0),is_skel_virtual(false),skel_radius(-1.0),p(0,0,0),n(0,0,0){}
+
+	// not explicit, samples are pushed into curves as they are
+	SkeletonNode(const CVertex& v)
+		:m_index(v.m_index),is_skel_virtual(v.is_skel_virtual),skel_radius(v.skel_radius),p(v.cP()),n(v.cN()){}
+
+	Point3f& P(){return p;}
+	const Point3f& cP() const{return p;}
+	Point3f& N(){return n;}
+	const Point3f& cN() const{return n;}
+
+	// like CVertex, so nodes go to the Point3f functions of GlobalFun as they are
+	operator Point3f&(){return p;}
+	operator const Point3f&() const{return p;}
+	float& operator[](unsigned int i){return p[i];}
+
+public:
+	int m_index; // the sample of the node
+	bool is_skel_virtual;
+	double skel_radius;
+
+private:
+	Point3f p;
+	Point3f n; // direction, the normal of the sample
+};
+
+typedef vector<SkeletonNode> Curve;
 
 class Branch
 {
@@ -18,7 +51,7 @@ public:
 		branch_id = b.branch_id;
 	}
 
-	Branch& Branch::operator = (const Branch& b)
+	Branch& operator = (const Branch& b)
 	{
 		if (&b != this)
 		{
@@ -31,9 +64,18 @@ public:
 	}
 
 
+	// exchanges the contents without copying the curves
+	void swap(Branch& b)
+	{
+		curve.swap(b.curve);
+		std::swap(back_up_head, b.back_up_head);
+		std::swap(back_up_tail, b.back_up_tail);
+		std::swap(branch_id, b.branch_id);
+	}
+
 public:
-	void pushBackCVertex(CVertex& new_v);
-	CVertex getCVertexOfIndex(int index){return curve[index];}
+	void pushBackNode(const SkeletonNode& new_node);
+	SkeletonNode& getNodeOfIndex(int index){return curve[index];}
 	int getSize();
 	bool isEmpty();
 	bool isHeadVirtual(){return curve[0].is_skel_virtual;}
@@ -94,6 +136,61 @@ public:
 
 
 
+// uniform grid over points tagged with an id, for the "which branch ends are
+// near this point" questions of merging and reconnecting, instead of a loop
+// over all the branches for every end
+class SkeletonPointGrid
+{
+public:
+	SkeletonPointGrid():cell_size(1.0){}
+
+	void clear(double _cell_size);
+	void insert(int id, Point3f p);
+	void remove(int id, Point3f p);
+
+	// ids of the points with a squared distance to p below dist2, in increasing order.
+	// sqrt(dist2) must not be larger than the cell size
+	void findNearPoints(Point3f p, double dist2, vector<int>& ids);
+	bool hasNearPoint(Point3f p, double dist2);
+
+private:
+	struct Cell
+	{
+		int x, y, z;
+		bool operator < (const Cell& c) const
+		{
+			if (x != c.x) return x < c.x;
+			if (y != c.y) return y < c.y;
+			return z < c.z;
+		}
+	};
+	typedef vector<pair<int, Point3f> > CellPoints;
+
+	Cell getCell(Point3f p);
+
+private:
+	map<Cell, CellPoints> cells;
+	double cell_size;
+};
+
+// the heads and tails of the branches in a SkeletonPointGrid, the end id is
+// branch_i * 2 for the head and branch_i * 2 + 1 for the tail. branch indices
+// shift when a branch is erased, then the index has to be built again
+class BranchEndIndex
+{
+public:
+	void build(vector<Branch>& branches, double cell_size);
+	void updateBranch(vector<Branch>& branches, int branch_i); // after its head or tail moved
+
+	void findNearEnds(Point3f p, double dist2, vector<int>& end_ids);
+	void findNearBranches(Point3f p, double dist2, vector<int>& branch_ids);
+
+private:
+	SkeletonPointGrid grid;
+	vector<Point3f> heads;
+	vector<Point3f> tails;
+};
+
 class Skeleton
 {
 public:
@@ -107,7 +204,7 @@ public:
 		branch_num = s.branch_num;
 	}
 
-	Skeleton & Skeleton::operator = (const Skeleton& s)
+	Skeleton & operator = (const Skeleton& s)
 	{
 		branches = s.branches;
 		size = s.size;
@@ -121,6 +218,9 @@ public:
 	bool isEmpty(){return branches.empty();}
 	void generateBranchSampleMap();
 
+	// the branches behind it move forward by swapping, their curves are not copied
+	void eraseBranch(int branch_i);
+
 
 public:
 
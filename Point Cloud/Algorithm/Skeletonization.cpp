@@ -13,6 +13,13 @@ void Skeletonization::run()
 	if (para->getBool("Step1 Detect Skeleton Feature"))
 	{
 		runStep1_DetectFeaturePoints();
+
+		// step 1 leaves its kd-tree to step 2, the samples may move before
+		// a step 2 of a later run
+		if (!para->getBool("Step2 Run Search New Branchs"))
+		{
+			stage_kdtree.clear();
+		}
 	}
 
 	if (para->getBool("Step2 Run Search New Branchs"))
@@ -273,6 +280,8 @@ void Skeletonization::initVertexes()
 
 
 
+// the terms run the double precision kernels of LOPKernel.h, what the
+// per pair loops here computed, with the fixed samples as skipped rows
 void Skeletonization::computeAverageTerm(CMesh* samples, CMesh* original)
 {
 	double average_power = para->getDouble("Average Power");
@@ -283,50 +292,43 @@ void Skeletonization::computeAverageTerm(CMesh* samples, CMesh* original)
 	double radius2 = radius * radius;
 	double iradius16 = -para->getDouble("H Gaussian Para")/radius2;
 
-	cout << "Original Size:" << samples->vert[0].original_neighbors.size() << endl;
-	for(int i = 0; i < samples->vert.size(); i++)
+	// no graph was built for a too small radius
+	if (samples->vn == 0 || samples->original_neighbor_graph.rowNum() != samples->vn)
 	{
-		CVertex& v = samples->vert[i];
-
-		if (v.is_fixed_sample) //Here is different from WLOP
-		{
-			average_weight_sum[i] = 0.;
-			continue;
-		}
-
-		for (int j = 0; j < v.original_neighbors.size(); j++)
-		{
-			CVertex& t = original->vert[v.original_neighbors[j]];
-
-			Point3f diff = v.P() - t.P();
-			double dist2  = diff.SquaredNorm();
-
-			double w = 1;
-			if (average_power < 2)
-			{
-				double len = sqrt(dist2);
-				if(len <= 0.001 * radius) len = radius*0.001;
-				w = exp(dist2 * iradius16) / pow(len, 2 - average_power);
-			}
-			else
-			{
-				w = exp(dist2 * iradius16);
-			}
+		cout << "ERROR: Skeletonization::computeAverageTerm: no neighbor graph!!" << endl;
+		return;
+	}
+	cout << "Original Size:" << samples->original_neighbor_graph[0].size() << endl;
 
-			if (need_density)
-			{
-				w *= original_density[t.m_index];
-			}
+	//Here is different from WLOP
+	row_skip.resize(samples->vn);
+	for (int i = 0; i < samples->vn; i++)
+	{
+		row_skip[i] = samples->vert[i].is_fixed_sample;
+	}
 
-      if (t.is_fixed_original)
-      {
-        w *= fix_original_weight;
-      }
+	bool has_fixed_original = false;
+	original_factor.resize(original->vn);
+	for (int i = 0; i < original->vn; i++)
+	{
+		bool is_fixed = original->vert[i].is_fixed_original;
+		original_factor[i] = is_fixed ? fix_original_weight : 1.;
+		has_fixed_original = has_fixed_original || is_fixed;
+	}
 
-			average[i] += t.P() * w;  
-			average_weight_sum[i] += w;  
-		}
+	WLOPKernel::Rows rows = WLOPKernel::rowsOf(samples, samples->original_neighbor_graph, original, radius, iradius16);
+	rows.row_skip = &row_skip[0];
+	if (need_density && !original_density.empty())
+	{
+		rows.neighbor_weight = &original_density[0];
 	}
+	if (has_fixed_original)
+	{
+		rows.neighbor_factor = &original_factor[0];
+	}
+
+	WLOPKernel::averageTerm(WLOPKernel::SCALAR, rows, average_power, false,
+		&average[0], &average_weight_sum[0]);
 }
 
 
@@ -338,92 +340,72 @@ void Skeletonization::computeRepulsionTerm(CMesh* samples)
 	double radius2 = radius * radius;
 	double iradius16 = -para->getDouble("H Gaussian Para")/radius2;
 
-	for(int i = 0; i < samples->vert.size(); i++)
+	if (samples->vn == 0 || samples->neighbor_graph.rowNum() != samples->vn)
 	{
-		CVertex& v = samples->vert[i];
-
-		if (v.is_fixed_sample || v.is_skel_ignore)//Here is different from WLOP
-		{
-			repulsion_weight_sum[i] = 0.;
-			continue;
-		}
-
-		for (int j = 0; j < v.neighbors.size(); j++)
-		{
-			CVertex& t = samples->vert[v.neighbors[j]];
-			Point3f diff = v.P() - t.P();
+		cout << "ERROR: Skeletonization::computeRepulsionTerm: no neighbor graph!!" << endl;
+		return;
+	}
 
-			double dist2  = diff.SquaredNorm();
-			double len = sqrt(dist2);
-			if(len <= 0.001 * radius) len = radius*0.001;
+	//Here is different from WLOP
+	row_skip.resize(samples->vn);
+	for (int i = 0; i < samples->vn; i++)
+	{
+		CVertex& v = samples->vert[i];
+		row_skip[i] = v.is_fixed_sample || v.is_skel_ignore;
+	}
 
-			double w = exp(dist2*iradius16);
-			double rep = w * pow(1.0 / len, repulsion_power);
+	WLOPKernel::Rows rows = WLOPKernel::rowsOf(samples, samples->neighbor_graph, samples, radius, iradius16);
+	rows.row_skip = &row_skip[0];
 
-			repulsion[i] += diff * rep;  
-			repulsion_weight_sum[i] += rep;
-		}
-	}
+	WLOPKernel::repulsionTerm(WLOPKernel::SCALAR, rows, repulsion_power,
+		&repulsion[0], &repulsion_weight_sum[0]);
 }
 
 
 void Skeletonization::computeDensity(bool isOriginal, double radius)
 {
 	CMesh* mesh;
+	vector<double>* density;
 	if (isOriginal)
 	{
 		mesh = original;
+		density = &original_density;
 	}
 	else
 	{
 		mesh = samples;
+		density = &samples_density;
 	}
 
 	double radius2 = radius * radius;
 	double iradius16 = -para->getDouble("H Gaussian Para") / radius2;
 
-	for(int i = 0; i < mesh->vert.size(); i++)
+	// without a graph every point is alone, the density of one point
+	if (mesh->neighbor_graph.rowNum() != (int)mesh->vert.size())
 	{
-		CVertex& v = mesh->vert[i];
-
-		if (isOriginal)
-		{
-			original_density[i] = 1.;
-		}
-		else
-		{
-			samples_density[i] = 1.;
-		}
-
-		vector<int>* neighbors = &v.neighbors;
-
-		for (int j = 0; j < neighbors->size(); j++)
-		{
-			CVertex& t = mesh->vert[(*neighbors)[j]];
-			double dist2  = (v.P() - t.P()).SquaredNorm();
-			double den = exp(dist2*iradius16);
-
-			if (isOriginal)
-			{
-				original_density[i] += den;
-			}
-			else
-			{
-				samples_density[i] += den;
-			}
-		}
+		cout << "ERROR: Skeletonization::computeDensity: no neighbor graph!!" << endl;
+		density->assign(mesh->vert.size(), 1.);
+		return;
+	}
+	if (mesh->vert.empty())
+	{
+		density->clear();
+		return;
 	}
 
+	density->resize(mesh->vert.size());
+	WLOPKernel::Rows rows = WLOPKernel::rowsOf(mesh, mesh->neighbor_graph, mesh, radius, iradius16);
+	WLOPKernel::densityTerm(WLOPKernel::SCALAR, rows, &(*density)[0]);
+
 	for(int i = 0; i < mesh->vert.size(); i++)
 	{
 		if (isOriginal)
 		{
-			CVertex& v = mesh->vert[i];
-			original_density[i] = 1. / original_density[i];
+			(*density)[i] = 1. / (*density)[i];
 		}
 		else
 		{
-			samples_density[i] = sqrt(samples_density[i]);
+			(*density)[i] = sqrt((*density)[i]);
 		}
 	}
 
@@ -436,31 +418,56 @@ double Skeletonization::wlopIterate()
 
 	initVertexes();
 
+	samples->arrays.load(samples->vert);
+	original->arrays.load(original->vert);
+
+	double neighbor_skin = para->getDouble("CGrid Radius") * para->getDouble("Neighbor Skin Ratio");
+
 	time.start("Samples Initial");
-	GlobalFun::computeBallNeighbors(samples, NULL, 
-		para->getDouble("CGrid Radius"), samples->bbox);
+	GlobalFun::updateBallNeighbors(samples, NULL, 
+		para->getDouble("CGrid Radius"), neighbor_skin, samples->bbox);
 	GlobalFun::computeEigenWithTheta(samples, para->getDouble("CGrid Radius") / sqrt(para->getDouble("H Gaussian Para")));
 	time.end();
 
 	if (nTimeIterated == 0) 
 	{
-		time.start("Original Initial");
-		GlobalFun::computeBallNeighbors(original, NULL, 
-			para->getDouble("CGrid Radius"), original->bbox);
+		// the density is the one of the scalar WLOP kernel, they share the cache files
+		bool need_density = para->getBool("Need Compute Density");
+		CDensityCache cache(need_density ? global_paraMgr.data.getString("Density Cache Directory").toStdString() : string(),
+			WLOPKernel::levelName(WLOPKernel::SCALAR), original->vert, para->getDouble("CGrid Radius"), para->getDouble("H Gaussian Para"));
+
+		if (!cache.load(original_density))
+		{
+			time.start("Original Initial");
+			GlobalFun::computeBallNeighbors(original, NULL, 
+				para->getDouble("CGrid Radius"), original->bbox, false);
 
-		original_density.assign(original->vn, 0);
-		if (para->getBool("Need Compute Density"))
+			original_density.assign(original->vn, 0);
+			if (need_density)
+			{
+				computeDensity(true, para->getDouble("CGrid Radius"));
+				cache.save(original_density);
+			}
+			time.end();
+		}
+		else
 		{
-			computeDensity(true, para->getDouble("CGrid Radius"));
+			cout << "original density from " << cache.fileName() << endl;
 		}
-		time.end();
 	}
 
 	time.start("Sample Original neighbor");
-	GlobalFun::computeBallNeighbors(samples, original, 
-		para->getDouble("CGrid Radius"), box);
+	GlobalFun::updateBallNeighbors(samples, original, 
+		para->getDouble("CGrid Radius"), neighbor_skin, box, false);
 	time.end();
 
+	if (neighbor_skin > 0)
+	{
+		cout << "neighbor searches: " << samples->neighbor_cache.build_num << " of " << samples->neighbor_cache.update_num
+			<< " iterations, original neighbor searches: " << samples->original_neighbor_cache.build_num
+			<< " of " << samples->original_neighbor_cache.update_num << " iterations" << endl;
+	}
+
 	time.start("computeAverageTerm");
 	computeAverageTerm(samples, original);
 	time.end();
@@ -535,6 +542,10 @@ void Skeletonization::removeTooClosePoints()
 	double near_threshold = para->getDouble("Combine Too Close Threshold");
 	double near_threshold2 = near_threshold * near_threshold;
 
+	// removed points jump far away, the neighbor lists are searched again
+	samples->neighbor_cache.clear();
+	samples->original_neighbor_cache.clear();
+
 	for (int i = 0; i < samples->vn; i++)
 	{
 		CVertex& v = samples->vert[i];
@@ -560,7 +571,8 @@ void Skeletonization::eigenThresholdIdentification()
 {
 	int sigma_KNN = para->getDouble("Sigma KNN");
 
-	GlobalFun::computeAnnNeigbhors(samples->vert, samples->vert, sigma_KNN, false, "void Skeletonization::eigenThresholdClassification()");
+	stage_kdtree.clear();
+	computeSamplesKnn(sigma_KNN, "void Skeletonization::eigenThresholdClassification()");
 
 	if (para->getBool("Use Compute Eigen Ignore Branch Strategy"))
 	{
@@ -573,6 +585,7 @@ void Skeletonization::eigenThresholdIdentification()
 
 	eigenConfidenceSmoothing();
 
+	double eigen_threshold = para->getDouble("Eigen Feature Identification Threshold");
 	for(int i = 0; i < samples->vert.size(); i++)
 	{
 		CVertex& v = samples->vert[i];
@@ -583,7 +596,6 @@ void Skeletonization::eigenThresholdIdentification()
 		}
 
 		double eigen_psi = v.eigen_confidence;
-		double eigen_threshold = para->getDouble("Eigen Feature Identification Threshold");
 
 		if (eigen_psi > eigen_threshold)
 		{
@@ -627,27 +639,53 @@ void Skeletonization::eigenConfidenceSmoothing()
 	}
 }
 
+// the knn of the samples, from the kd-tree of the stage if it is there
+void Skeletonization::computeSamplesKnn(int knn, QString purpose)
+{
+	if (samples->vert.size() <= knn + 3)
+	{
+		GlobalFun::computeAnnNeigbhors(samples->vert, samples->vert, knn, false, purpose);
+		return;
+	}
+
+	if (stage_kdtree.size() != samples->vert.size())
+	{
+		stage_kdtree.build(samples->vert);
+	}
+	cout << endl <<"Compute ANN for:	 " << purpose.toStdString() << endl;
+	GlobalFun::computeAnnNeigbhors(stage_kdtree, samples->vert, knn, purpose);
+}
+
 void Skeletonization::searchNewBranches()
 {
 	int branch_KNN = para->getDouble("Branch Search KNN");
-	GlobalFun::computeAnnNeigbhors(samples->vert, samples->vert, branch_KNN, false, "void Skeletonization::searchNewBranches()");
+	computeSamplesKnn(branch_KNN, "void Skeletonization::searchNewBranches()");
+	stage_kdtree.clear();
+
+	// seeds by decreasing eigen_confidence, the lower index first among equals.
+	// tracing a branch only takes points out of the JustFixed state, so the
+	// entries of those points are dropped when they come to the top
+	priority_queue<pair<double, int> > seeds;
+	for (int i = 0; i < samples->vert.size(); i++)
+	{
+		CVertex& v = samples->vert[i];
+		if (v.isSample_JustFixed() && v.eigen_confidence > 0)
+		{
+			seeds.push(make_pair(v.eigen_confidence, -i));
+		}
+	}
 
 	while(1)
 	{
 		int max_confidence_id = -1;
-		double max_eigen_confidence = 0;
-		for (int i = 0; i <samples->vert.size(); i++)
+		while (!seeds.empty())
 		{
-			CVertex& v = samples->vert[i];
-			if (!v.isSample_JustFixed())
-			{
-				continue;
-			}
-
-			if (v.eigen_confidence > max_eigen_confidence)
+			int i = -seeds.top().second;
+			seeds.pop();
+			if (samples->vert[i].isSample_JustFixed())
 			{
 				max_confidence_id = i;
-				max_eigen_confidence = v.eigen_confidence;
+				break;
 			}
 		}
 
@@ -731,7 +769,7 @@ void Skeletonization::searchNewBranches()
 Branch Skeletonization::searchOneBranchFromIndex(int begin_idx)
 {
 	Branch new_branch;
-	CVertex begin_v = samples->vert[begin_idx];
+	const CVertex& begin_v = samples->vert[begin_idx];
 	if (begin_v.is_skel_branch)
 	{
 		cout << "why start from branched points ?!" << endl;
@@ -766,20 +804,14 @@ Branch Skeletonization::searchOneBranchFromIndex(int begin_idx)
 	Branch branch0 = searchOneBranchFromDirection(begin_idx, head_direction);
 	Branch branch1 = searchOneBranchFromDirection(begin_idx, -head_direction);
 
-	Curve curve0 = branch0.curve;
-	Curve curve1 = branch1.curve;
+	Curve& curve0 = branch0.curve;
+	Curve& curve1 = branch1.curve;
 
-	Curve::reverse_iterator riter = curve1.rbegin();
-	for(int i = 0; i < curve1.size()-1; i++)
-	{
-		new_branch.pushBackCVertex(*riter);
-		riter++;
-	}
-
-	for (int i = 0; i < curve0.size(); i++)
-	{
-		new_branch.pushBackCVertex(curve0[i]);
-	}
+	// curve1 backwards without the begin point it shares with curve0
+	Curve& new_curve = new_branch.curve;
+	new_curve.reserve(curve0.size() + curve1.size() - 1);
+	new_curve.insert(new_curve.end(), curve1.rbegin(), curve1.rend() - 1);
+	new_curve.insert(new_curve.end(), curve0.begin(), curve0.end());
 
 	return new_branch;
 }
@@ -790,6 +822,7 @@ Branch Skeletonization::searchOneBranchFromDirection(int begin_idx, Point3f head
 	double MAX_Euler_dist = para->getDouble("Snake Search Max Dist Blue");
 	double MAX_Perpendicular_dist = para->getDouble("Branch Search Max Dist Yellow");
 	double MAX_Too_Close_dist = para->getDouble("Combine Too Close Threshold");
+	double MAX_Search_Angle = para->getDouble("Branches Search Angle");
 
 	double MAX_Euler_dist2 = MAX_Euler_dist * MAX_Euler_dist;
 	double MAX_Perpendicular_dist2 = MAX_Perpendicular_dist * MAX_Perpendicular_dist;
@@ -799,8 +832,13 @@ Branch Skeletonization::searchOneBranchFromDirection(int begin_idx, Point3f head
 	int curr_idx = begin_idx;
 	do 
 	{
-		CVertex curr_v = samples->vert[curr_idx];
-		new_branch.pushBackCVertex(curr_v);
+		const CVertex& curr_v = samples->vert[curr_idx];
+		new_branch.pushBackNode(curr_v);
+		Point3f curr_p = curr_v.P();
+
+		// coinciding points can have curr_v among its own neighbors, it is
+		// removed after its neighbors are searched
+		bool remove_curr = false;
 
 		int next_idx = -1;
 		double min_dist = GlobalFun::getDoubleMAXIMUM();
@@ -812,7 +850,7 @@ Branch Skeletonization::searchOneBranchFromDirection(int begin_idx, Point3f head
 				continue;
 			}
 
-			double euler_dist2 = GlobalFun::computeEulerDistSquare(curr_v.P(), t.P());
+			double euler_dist2 = GlobalFun::computeEulerDistSquare(curr_p, t.P());
 			if (euler_dist2 > MAX_Euler_dist2)
 			{
 				continue;
@@ -820,11 +858,18 @@ Branch Skeletonization::searchOneBranchFromDirection(int begin_idx, Point3f head
 
 			if (euler_dist2 < MAX_Too_Close_dist2)
 			{
-				t.remove();
+				if (&t == &curr_v)
+				{
+					remove_curr = true;
+				}
+				else
+				{
+					t.remove();
+				}
 				continue;
 			}
 
-			double proj_dist = GlobalFun::computeProjDist(curr_v.P(), t.P(), head_direction);
+			double proj_dist = GlobalFun::computeProjDist(curr_p, t.P(), head_direction);
 			if (proj_dist < 0)
 			{
 				continue;
@@ -834,20 +879,25 @@ Branch Skeletonization::searchOneBranchFromDirection(int begin_idx, Point3f head
 			break;
 		}
 
+		if (remove_curr)
+		{
+			samples->vert[curr_idx].remove();
+		}
+
 		if (next_idx < 0) // No virtual head/tail
 		{
 			break;
 		}
 
-		CVertex next_v = samples->vert[next_idx]; //2013-7-12
-		Point3f new_direction = (next_v.P() - curr_v.P()).Normalize();
+		CVertex& next_v = samples->vert[next_idx]; //2013-7-12
+		Point3f new_direction = (next_v.P() - curr_p).Normalize();
 		
 		double angle = GlobalFun::computeRealAngleOfTwoVertor(head_direction, new_direction);
-		if (angle > para->getDouble("Branches Search Angle") || !next_v.is_fixed_sample || next_v.is_skel_branch || next_v.is_skel_virtual)
+		if (angle > MAX_Search_Angle || !next_v.is_fixed_sample || next_v.is_skel_branch || next_v.is_skel_virtual)
 		{
-
-			next_v.is_skel_virtual = true; // the corresponding sample point is not virtual
-			new_branch.pushBackCVertex(next_v);
+			SkeletonNode virtual_node(next_v);
+			virtual_node.is_skel_virtual = true; // the corresponding sample point is not virtual
+			new_branch.pushBackNode(virtual_node);
 			break;
 		}
 
@@ -883,7 +933,7 @@ void Skeletonization::growVirtualTailUntilStop(Branch& branch)
 			return;
 		}
 
-		CVertex tail = curve[curve.size()-1];
+		SkeletonNode tail = curve[curve.size()-1];
 		//find nearest red points
 		//if (tail.m_index < 0 || tail.m_index >= samples->vert.size() || 
 		//	GlobalFun::computeEulerDistSquare(tail.P(), samples->vert[tail.m_index].P()) > 1e-6)
@@ -949,8 +999,8 @@ void Skeletonization::growVirtualTailUntilStop(Branch& branch)
 		{
 			CVertex& near_v = samples->vert[min_idx];
 
-			CVertex& real_tail = curve[curve.size()-2];
-			CVertex& real_tail_last = curve[curve.size()-3];
+			SkeletonNode& real_tail = curve[curve.size()-2];
+			SkeletonNode& real_tail_last = curve[curve.size()-3];
 
 			Point3f v0 = (real_tail.P() - real_tail_last.P()).Normalize();
 			Point3f v1 = (tail.P() - real_tail.P()).Normalize();
@@ -969,10 +1019,10 @@ void Skeletonization::growVirtualTailUntilStop(Branch& branch)
 				else
 				{
 					v.setSample_FixedAndBranched();
-					curve[curve.size()-1].setSample_FixedAndBranched();
+					curve[curve.size()-1].is_skel_virtual = false;
 
 					near_v.setSample_MovingAndVirtual();
-					branch.pushBackCVertex(near_v);
+					branch.pushBackNode(near_v);
 					is_tail_growing = true;
 
 					branch.rememberVirtualTail();
@@ -1018,7 +1068,15 @@ void Skeletonization::growAllBranches()
 
 void Skeletonization::mergeNearEndsGroup()
 {
-	vector<Point3f> visited_pts;
+	double merge_dist = para->getDouble("Branches Merge Max Dist");
+	merge_dist *= 1.1;
+	double merge_dist2 = merge_dist * merge_dist;
+
+	BranchEndIndex end_index;
+	end_index.build(skeleton->branches, para->getDouble("Branches Merge Max Dist"));
+
+	SkeletonPointGrid visited_pts;
+	visited_pts.clear(merge_dist);
 
 	for (int i = 0; i < skeleton->branches.size(); i++)
 	{
@@ -1026,22 +1084,19 @@ void Skeletonization::mergeNearEndsGroup()
 		Point3f tail = skeleton->branches[i].getTail();
 
 		double dist_between_head_tail_2 = GlobalFun::computeEulerDistSquare(head, tail);
-		double merge_dist = para->getDouble("Branches Merge Max Dist");
-		merge_dist *= 1.1;
-		double merge_dist2 = merge_dist * merge_dist;
 
 		if (dist_between_head_tail_2 > merge_dist2)
 		{
-			if (!isPosVisited(visited_pts, head, merge_dist2 * 0.6))
+			if (!visited_pts.hasNearPoint(head, merge_dist2 * 0.6))
 			{
-				mergeNearEndsGroupFromP(head);
-				visited_pts.push_back(head);
+				mergeNearEndsGroupFromP(head, &end_index);
+				visited_pts.insert(0, head);
 			}
 
-			if (!isPosVisited(visited_pts, tail, merge_dist2 * 0.6))
+			if (!visited_pts.hasNearPoint(tail, merge_dist2 * 0.6))
 			{
-				mergeNearEndsGroupFromP(tail);
-				visited_pts.push_back(tail);
+				mergeNearEndsGroupFromP(tail, &end_index);
+				visited_pts.insert(0, tail);
 			}
 		}
 		else
@@ -1054,21 +1109,8 @@ void Skeletonization::mergeNearEndsGroup()
 
 }
 
-bool Skeletonization::isPosVisited(vector<Point3f>& visited_pts, Point3f p, double dist_threshold)
-{
-	for (int i = 0; i < visited_pts.size(); i++)
-	{
-		double dist2 = GlobalFun::computeEulerDistSquare(p, visited_pts[i]);
-		if (dist2 < dist_threshold)
-		{
-			return true;
-		}
-	}
-	return false;
-}
-
 
-bool Skeletonization::mergeNearEndsGroupFromP(Point3f p0)
+bool Skeletonization::mergeNearEndsGroupFromP(Point3f p0, BranchEndIndex* end_index)
 {
 	double MAX_Merge_Dist = para->getDouble("Branches Merge Max Dist");
 	double MAX_Merge_Dist2 = MAX_Merge_Dist * MAX_Merge_Dist;
@@ -1080,8 +1122,24 @@ bool Skeletonization::mergeNearEndsGroupFromP(Point3f p0)
 	Point3f average_P = Point3f(0, 0, 0);
 	vector<Point3f> dangerous_Pts;
 	vector<Point3f> nearby_Pts;
-	for (int i = 0; i < skeleton->branches.size(); i++)
+
+	vector<int> branch_ids;
+	if (end_index != NULL)
 	{
+		end_index->findNearBranches(p0, MAX_Merge_Dist2, branch_ids);
+	}
+	else
+	{
+		branch_ids.resize(skeleton->branches.size());
+		for (int i = 0; i < branch_ids.size(); i++)
+		{
+			branch_ids[i] = i;
+		}
+	}
+
+	for (int k = 0; k < branch_ids.size(); k++)
+	{
+		int i = branch_ids[k];
 		Curve& curve = skeleton->branches[i].curve;
 
 		double dist_head = GlobalFun::computeEulerDistSquare(curve[0], p0);
@@ -1184,6 +1242,11 @@ bool Skeletonization::mergeNearEndsGroupFromP(Point3f p0)
 				//cout << "inactive tail because of:	" << "Group Merge" << endl;
 				branch.moveTailToPt(average_P);
 			}	
+
+			if (end_index != NULL)
+			{
+				end_index->updateBranch(skeleton->branches, item.branch_i);
+			}
 		}
 		return true;
 	}
@@ -1232,9 +1295,14 @@ bool Skeletonization::mergeNearEndsGroupFromP(Point3f p0)
     if (best_angle > angle_threshold)
     {
       Branch new_branch = mergeTowBranches(branch0, branch1, best_c_type);
-      branch0 = new_branch;
-      skeleton->branches.erase(skeleton->branches.begin() + branch1.branch_id);
+      branch0.swap(new_branch);
+      skeleton->eraseBranch(branch1.branch_id);
       skeleton->generateBranchSampleMap();
+
+      if (end_index != NULL)
+      {
+        end_index->build(skeleton->branches, MAX_Merge_Dist);
+      }
     }
     else if (end_dist2 < 1e-4)
     {
@@ -1517,6 +1585,7 @@ double Skeletonization::getMaxAngleOfTwoPair(vector<Point3f>& dir0, vector<Point
 
    Branch new_branch;
    Curve& new_curve = new_branch.curve;
+   Curve reversed_c0, reversed_c1;
 
    switch (C_Type)
    {
@@ -1529,7 +1598,8 @@ double Skeletonization::getMaxAngleOfTwoPair(vector<Point3f>& dir0, vector<Point
      {
        branch1.inactiveAndKeepVirtualHead();
      }
-     new_curve = combineTwoCurvesInOrder(reverseOneCurve(c0), c1);
+     reverseOneCurve(c0).swap(reversed_c0);
+     combineTwoCurvesInOrder(reversed_c0, c1).swap(new_curve);
      new_branch.back_up_head = branch0.back_up_tail;
      new_branch.back_up_tail = branch1.back_up_tail;
      
@@ -1547,7 +1617,9 @@ double Skeletonization::getMaxAngleOfTwoPair(vector<Point3f>& dir0, vector<Point
        branch1.inactiveAndKeepVirtualTail();
      }
 
-     new_curve = combineTwoCurvesInOrder(reverseOneCurve(c0), reverseOneCurve(c1));
+     reverseOneCurve(c0).swap(reversed_c0);
+     reverseOneCurve(c1).swap(reversed_c1);
+     combineTwoCurvesInOrder(reversed_c0, reversed_c1).swap(new_curve);
      new_branch.back_up_head = branch0.back_up_tail;
      new_branch.back_up_tail = branch1.back_up_head;
 
@@ -1564,7 +1636,7 @@ double Skeletonization::getMaxAngleOfTwoPair(vector<Point3f>& dir0, vector<Point
      {
        branch1.inactiveAndKeepVirtualHead();
      }
-     new_curve = combineTwoCurvesInOrder(c0, c1);
+     combineTwoCurvesInOrder(c0, c1).swap(new_curve);
      new_branch.back_up_head = branch0.back_up_head;
      new_branch.back_up_tail = branch1.back_up_tail;
 
@@ -1581,7 +1653,8 @@ double Skeletonization::getMaxAngleOfTwoPair(vector<Point3f>& dir0, vector<Point
      {
        branch1.inactiveAndKeepVirtualTail();
      }
-     new_curve = combineTwoCurvesInOrder(c0, reverseOneCurve(c1));
+     reverseOneCurve(c1).swap(reversed_c1);
+     combineTwoCurvesInOrder(c0, reversed_c1).swap(new_curve);
      new_branch.back_up_head = branch0.back_up_head;
      new_branch.back_up_tail = branch1.back_up_head;
 
@@ -1601,6 +1674,7 @@ double Skeletonization::getMaxAngleOfTwoPair(vector<Point3f>& dir0, vector<Point
    }
 
    Curve c;
+   c.reserve(c0.size() + c1.size());
 
    for (int i = 0; i < c0.size(); i++)
    {
@@ -1621,17 +1695,9 @@ double Skeletonization::getMaxAngleOfTwoPair(vector<Point3f>& dir0, vector<Point
    return c;
  }
 
- Curve Skeletonization::reverseOneCurve(Curve c0)
+ Curve Skeletonization::reverseOneCurve(const Curve& c0)
  {
-   Curve c;
-
-   Curve::reverse_iterator riter = c0.rbegin();
-   for (; riter != c0.rend(); ++riter)
-   {
-     c.push_back(*riter);
-   }
-
-   return c;
+   return Curve(c0.rbegin(), c0.rend());
  }
 
 
@@ -1679,7 +1745,7 @@ void Skeletonization::labelFixOriginal()
   {
   case 1:
     GlobalFun::computeBallNeighbors(samples, original, 
-      para->getDouble("CGrid Radius") / sqrt(para->getDouble("H Gaussian Para")) * pca_para, original->bbox);
+      para->getDouble("CGrid Radius") / sqrt(para->getDouble("H Gaussian Para")) * pca_para, original->bbox, false);
 
     for (int i = 0; i < original->vert.size(); i++)
     {
@@ -1693,7 +1759,7 @@ void Skeletonization::labelFixOriginal()
 
       if (!v.is_fixed_sample)
       {
-        vector<int>& ori_neighbors = v.original_neighbors;
+        CNeighborGraph::Row ori_neighbors = samples->original_neighbor_graph[i];
 
         for(int j = 0; j < ori_neighbors.size(); j++)
         {
@@ -1704,7 +1770,7 @@ void Skeletonization::labelFixOriginal()
 
       if (v.is_fixed_sample)
       {
-        vector<int>& ori_neighbors = v.original_neighbors;
+        CNeighborGraph::Row ori_neighbors = samples->original_neighbor_graph[i];
 
         for(int j = 0; j < ori_neighbors.size(); j++)
         {
@@ -1718,7 +1784,7 @@ void Skeletonization::labelFixOriginal()
   case 2:
 
     GlobalFun::computeBallNeighbors(samples, original, 
-      para->getDouble("CGrid Radius") / sqrt(para->getDouble("H Gaussian Para")) * pca_para, original->bbox);
+      para->getDouble("CGrid Radius") / sqrt(para->getDouble("H Gaussian Para")) * pca_para, original->bbox, false);
 
     for (int i = 0; i < original->vert.size(); i++)
     {
@@ -1732,7 +1798,7 @@ void Skeletonization::labelFixOriginal()
 
       if (!v.is_fixed_sample)
       {
-        vector<int>& ori_neighbors = v.original_neighbors;
+        CNeighborGraph::Row ori_neighbors = samples->original_neighbor_graph[i];
 
         for(int j = 0; j < ori_neighbors.size(); j++)
         {
@@ -1744,7 +1810,7 @@ void Skeletonization::labelFixOriginal()
     }
 
     GlobalFun::computeBallNeighbors(samples, original, 
-      para->getDouble("Local Density Radius") / sqrt(para->getDouble("H Gaussian Para")) * pca_para, original->bbox);
+      para->getDouble("Local Density Radius") / sqrt(para->getDouble("H Gaussian Para")) * pca_para, original->bbox, false);
 
     for (int i = 0; i < samples->vert.size(); i++)
     {
@@ -1752,7 +1818,7 @@ void Skeletonization::labelFixOriginal()
 
       if (v.is_fixed_sample)
       {
-        vector<int>& ori_neighbors = v.original_neighbors;
+        CNeighborGraph::Row ori_neighbors = samples->original_neighbor_graph[i];
 
         for(int j = 0; j < ori_neighbors.size(); j++)
         {
@@ -1766,7 +1832,7 @@ void Skeletonization::labelFixOriginal()
     break;
   case 3:
     GlobalFun::computeBallNeighbors(samples, original, 
-      para->getDouble("CGrid Radius") / sqrt(para->getDouble("H Gaussian Para")) * pca_para, original->bbox);
+      para->getDouble("CGrid Radius") / sqrt(para->getDouble("H Gaussian Para")) * pca_para, original->bbox, false);
 
     for (int i = 0; i < original->vert.size(); i++)
     {
@@ -1780,7 +1846,7 @@ void Skeletonization::labelFixOriginal()
 
       if (!v.is_fixed_sample)
       {
-        vector<int>& ori_neighbors = v.original_neighbors;
+        CNeighborGraph::Row ori_neighbors = samples->original_neighbor_graph[i];
 
         for(int j = 0; j < ori_neighbors.size(); j++)
         {
@@ -1794,7 +1860,7 @@ void Skeletonization::labelFixOriginal()
 
   case 4:
     GlobalFun::computeBallNeighbors(samples, original, 
-      para->getDouble("CGrid Radius") / sqrt(para->getDouble("H Gaussian Para")) * pca_para, original->bbox);
+      para->getDouble("CGrid Radius") / sqrt(para->getDouble("H Gaussian Para")) * pca_para, original->bbox, false);
 
     for (int i = 0; i < original->vert.size(); i++)
     {
@@ -1808,7 +1874,7 @@ void Skeletonization::labelFixOriginal()
 
       if (v.is_fixed_sample)
       {
-        vector<int>& ori_neighbors = v.original_neighbors;
+        CNeighborGraph::Row ori_neighbors = samples->original_neighbor_graph[i];
 
         for(int j = 0; j < ori_neighbors.size(); j++)
         {
@@ -1857,6 +1923,9 @@ void Skeletonization::increaseRadius()
   current_radius *= (1 + speed);
   para->setValue("CGrid Radius", DoubleValue(current_radius));
 
+  samples->neighbor_cache.clear();
+  samples->original_neighbor_cache.clear();
+
 
   // for KangXue: maybe you want to save the skel_radius for virtual points here
   // but the best way is to save it whenever the virtual point is inactive
@@ -1923,7 +1992,7 @@ void Skeletonization::updateVirtualHeadFollowSamples(Branch& branch)
   bool use_kill_too_close_strategy = para->getBool("Use Kill Too Close Strategy");
 
   Curve& curve = branch.curve;
-  CVertex& head = curve[0];
+  SkeletonNode& head = curve[0];
 
   CVertex& v = samples->vert[head.m_index];
   v.setSample_MovingAndVirtual();
@@ -2128,7 +2197,9 @@ void Skeletonization::dealWithVirtualsForTail(Branch& branch)
   // deal with head eat tail problem
   if (branch.isHeadVirtual())
   {
-    double head_tail_dist2 = GlobalFun::computeEulerDistSquare(branch.getHead(), branch.getTail());
+    Point3f head = branch.getHead();
+    Point3f tail = branch.getTail();
+    double head_tail_dist2 = GlobalFun::computeEulerDistSquare(head, tail);
     if (head_tail_dist2 < MAX_Merge_Dist)
     {
       double head_angle = branch.getHeadAngle();
@@ -2231,7 +2302,7 @@ void Skeletonization::dealWithVirtualsForTail(Branch& branch)
 
       for (int j = 0; j < curve1.size(); j++)
       {
-        CVertex& t = curve1[j];
+        SkeletonNode& t = curve1[j];
 
         Point3f tail_direction = curve0[curve0.size()-2].P() - curve0[curve0.size()-3].P();
         Point3f near_direction = t.P() - curve0[curve0.size()-2].P(); 
@@ -2289,7 +2360,7 @@ void Skeletonization::dealWithVirtualsForTail(Branch& branch)
       double too_close_threshold = para->getDouble("Combine Too Close Threshold");
       double too_close_threshold2 = too_close_threshold * too_close_threshold;
 
-      CVertex tail = curve0[curve0.size()-1];
+      SkeletonNode tail = curve0[curve0.size()-1];
 
       CVertex& v = samples->vert[tail.m_index];
       if (!v.neighbors.empty())
@@ -2520,7 +2591,7 @@ void Skeletonization::segmentOneCurve(Curve& c)
   //}
   //new_curve.push_back(c[c.size()-1]);
 
-  c = new_curve;
+  c.swap(new_curve);
 
 }
 
@@ -2597,7 +2668,8 @@ void Skeletonization::subdivisionCurveOnce(Curve& c)
   }
 
   Curve new_curve;
-  CVertex new_v;
+  new_curve.reserve(c.size() * 2);
+  SkeletonNode new_v;
   for (int i = 0; i < c.size()-1; i++)
   {
     new_curve.push_back(c[i]);
@@ -2621,7 +2693,7 @@ void Skeletonization::subdivisionCurveOnce(Curve& c)
   }
   new_curve.push_back(c[c.size()-1]);
 
-  c = new_curve;
+  c.swap(new_curve);
 }
 
 void Skeletonization::subdivisionCurve(Curve& c, double stop_segment_length)
@@ -2661,12 +2733,14 @@ void Skeletonization::reconnectSkeleton()
     for (int i = 0; i < branches.size(); i++)
     {
       Branch& branch = branches[i];
-      double head_tail_dist2 = GlobalFun::computeEulerDistSquare(branch.getHead(), branch.getTail());
+      Point3f head = branch.getHead();
+      Point3f tail = branch.getTail();
+      double head_tail_dist2 = GlobalFun::computeEulerDistSquare(head, tail);
       if (head_tail_dist2 < nearby_dist2)
       {
         if (branch.getSize() < 8)
         {
-          branches.erase(branches.begin()+i);
+          skeleton->eraseBranch(i);
           skeleton->generateBranchSampleMap();
           have_erase = true;
           break;
@@ -2685,40 +2759,51 @@ void Skeletonization::reconnectSkeleton()
   }
 
   //break joint nodes
+  double nearby_dist = sqrt(nearby_dist2);
   while(1)
   {
     int break_branch_id = -1;
     int break_node_id = -1;
 
+    // inner nodes of all the branches, the id is the position in node_branch_ids and node_ids
+    SkeletonPointGrid inner_nodes;
+    inner_nodes.clear(nearby_dist);
+    vector<int> node_branch_ids;
+    vector<int> node_ids;
+    for (int j = 0; j < branches.size(); j++)
+    {
+      Curve& curve1 = branches[j].curve;
+      for (int k = 1; k < int(curve1.size())-1; k++)
+      {
+        inner_nodes.insert(node_ids.size(), curve1[k].P());
+        node_branch_ids.push_back(j);
+        node_ids.push_back(k);
+      }
+    }
+
+    // the first branch with an end on an inner node of another branch, the last
+    // such other branch and its first such node, as the loop over all the nodes did
+    vector<int> near_ids;
     for (int i = 0; i < branches.size(); i++)
     {
       Branch& branch = branches[i];
 
-      Point3f& head_P = branch.getHead();
-      Point3f& tail_P = branch.getTail();
-
-      break_branch_id = -1;
-      break_node_id = -1;
-
-      for (int j = 0; j < branches.size(); j++)
+      Point3f ends[2] = {branch.getHead(), branch.getTail()};
+      for (int e = 0; e < 2; e++)
       {
-        Curve& curve1 = branches[j].curve;
-        if (j == i || curve1.size() < 2)
+        inner_nodes.findNearPoints(ends[e], nearby_dist2, near_ids);
+        for (int n = 0; n < near_ids.size(); n++)
         {
-          continue;
-        }
-
-        for (int k = 1; k < curve1.size()-1; k++)
-        {
-          Point3f p = curve1[k].P();
-          double dist_head2 = GlobalFun::computeEulerDistSquare(p, head_P);
-          double dist_tail2 = GlobalFun::computeEulerDistSquare(p, tail_P);
-
-          if (dist_tail2 < nearby_dist2 || dist_head2 < nearby_dist2)
+          int j = node_branch_ids[near_ids[n]];
+          int k = node_ids[near_ids[n]];
+          if (j == i)
+          {
+            continue;
+          }
+          if (j > break_branch_id || (j == break_branch_id && k < break_node_id))
           {
             break_branch_id = j;
             break_node_id = k;
-            break;
           }
         }
       }
@@ -2755,54 +2840,42 @@ void Skeletonization::reconnectSkeleton()
 
 
   //combine connected branches
+  BranchEndIndex end_index;
   while(1)
   {
     int combine_curve_id0 = -1;
     int combine_curve_id1 = -1;
     bool have_new_combine = false;
 
+    end_index.build(branches, nearby_dist);
+
+    vector<int> near_end_ids;
     for (int i = 0; i < branches.size(); i++)
     {
       Branch& branch0 = branches[i];
 
-      Point3f& head0_P = branch0.getHead();
-      Point3f& tail0_P = branch0.getTail();
+      Point3f head0_P = branch0.getHead();
+      Point3f tail0_P = branch0.getTail();
 
       combine_curve_id0 = i;
       combine_curve_id1 = -1;
       vector<int> head_connect_curves_ids;
       vector<int> tail_connect_curves_ids;
 
-      for (int j = 0; j < branches.size(); j++)
+      end_index.findNearEnds(head0_P, nearby_dist2, near_end_ids);
+      for (int k = 0; k < near_end_ids.size(); k++)
       {
-        if (j == i)
-          continue;
-
-        Branch& branch1 = branches[j];
-        Point3f& head1_P = branch1.getHead();
-        Point3f& tail1_P = branch1.getTail();
-
-        vector<double> dists_head;
-        vector<double> dists_tail;
-
-        dists_head.push_back(GlobalFun::computeEulerDistSquare(head0_P, head1_P));
-        dists_head.push_back(GlobalFun::computeEulerDistSquare(head0_P, tail1_P));
-        dists_tail.push_back(GlobalFun::computeEulerDistSquare(tail0_P, head1_P));
-        dists_tail.push_back(GlobalFun::computeEulerDistSquare(tail0_P, tail1_P));
-
-        for (int k = 0; k < 2; k++)
+        if (near_end_ids[k] / 2 != i)
         {
-          if (dists_head[k] < nearby_dist2)
-          {
-            head_connect_curves_ids.push_back(j);
-          }
+          head_connect_curves_ids.push_back(near_end_ids[k] / 2);
         }
-        for (int k = 0; k < 2; k++)
+      }
+      end_index.findNearEnds(tail0_P, nearby_dist2, near_end_ids);
+      for (int k = 0; k < near_end_ids.size(); k++)
+      {
+        if (near_end_ids[k] / 2 != i)
         {
-          if (dists_tail[k] < nearby_dist2)
-          {
-            tail_connect_curves_ids.push_back(j);
-          }
+          tail_connect_curves_ids.push_back(near_end_ids[k] / 2);
         }
       }
 
@@ -2826,8 +2899,8 @@ void Skeletonization::reconnectSkeleton()
       Branch& branch1 = skeleton->branches[combine_curve_id1];
 
       Branch new_branch = mergeTowBranches(branch0, branch1, UNKNOWN);
-      branch0 = new_branch;
-      skeleton->branches.erase(skeleton->branches.begin() + branch1.branch_id);
+      branch0.swap(new_branch);
+      skeleton->eraseBranch(branch1.branch_id);
 
       skeleton->generateBranchSampleMap();
     }
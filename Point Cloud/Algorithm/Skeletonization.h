@@ -2,6 +2,9 @@
 #include "GlobalFunction.h"
 #include "PointCloudAlgorithm.h"
 #include "Skeleton.h"
+#include "WLOPKernel.h"
+#include "DensityCache.h"
+#include <queue>
 
 
 class Skeletonization : public PointCloudAlgorithm
@@ -45,6 +48,7 @@ private:
 	void removeTooClosePoints();
 	void eigenThresholdIdentification();
 	void eigenConfidenceSmoothing();
+	void computeSamplesKnn(int knn, QString purpose);
 
 	/* for step 2 */
 	void searchNewBranches();
@@ -57,9 +61,9 @@ private:
 
   /* for step 3 */
 	//Merge branches
-	bool mergeNearEndsGroupFromP(Point3f p0);
+	// with end_index only the branches ending near p0 are checked, and the index is kept up to date
+	bool mergeNearEndsGroupFromP(Point3f p0, BranchEndIndex* end_index = NULL);
 	void mergeNearEndsGroup();
-	bool isPosVisited(vector<Point3f>& visited_pts, Point3f p, double dist_threshold);
 
   // connect two branch with similar angle
   enum CONNECT_TYPE{H0_H1, H0_T1, T0_H1, T0_T1, UNKNOWN};
@@ -70,7 +74,7 @@ private:
 
   Branch mergeTowBranches(Branch& branch0, Branch& branch1, CONNECT_TYPE C_Type = UNKNOWN);
   Curve combineTwoCurvesInOrder(Curve& c0, Curve& c1);
-  Curve reverseOneCurve(Curve c0);
+  Curve reverseOneCurve(const Curve& c0);
 
   // do some clean up before increase radius
   void cleanPointsNearBranches();
@@ -135,8 +139,16 @@ private:
 	vector<Point3f> average;
 	vector<double>  average_weight_sum;
 
+	vector<unsigned char> row_skip;       // rows the kernels leave alone
+	vector<double> original_factor;       // "Fix Original Weight" of the fixed original points
+
   bool is_skeleton_locked;
 
+  // kd-tree of the samples for the knn queries of step 1 and step 2.
+  // only kept while step 2 follows step 1 in the same run, the samples
+  // don't move between them
+  CKdTree stage_kdtree;
+
 private:
 	double iterate_error;
 	int iterate_time_in_one_stage;
@@ -1,5 +1,6 @@
 #include "Algorithm/Upsampler.h"
 #include <cassert>
+#include <omp.h>
 
 vector<double> Upsampler::proj_dist;
 vector<double> Upsampler::proj_weight;
@@ -7,6 +8,7 @@ vector<double> Upsampler::proj_weight;
 vector<Point3f> Upsampler::sum_N;
 vector<Point3f> Upsampler::sum_Gw;
 vector<Point3f> Upsampler::sum_Gf;
+double Upsampler::psi_denominator = 1.;
 
 
 Upsampler::Upsampler(RichParameterSet* _para)
@@ -81,7 +83,18 @@ void Upsampler::doUpsampling()
 			old_radius = current_radius;	
 		}
 		clearAllThresholdFlag();
-		insertPointsByThreshold();
+		if (para->getBool("Use Parallel Insertion"))
+		{
+			insertPointsInParallel();
+		}
+		else if (para->getBool("Use Priority Queue"))
+		{
+			insertPointsByPriority();
+		}
+		else
+		{
+			insertPointsByThreshold();
+		}
 		return;
 	}
 	else
@@ -204,18 +217,28 @@ void Upsampler::computeEigenVerctorForRendering()
 // find the max dist of minimum dist between midpoint and their neighbors,return its index using para
 double Upsampler::findMaxMidpoint(CVertex & v, int & neighbor_index)
 {	
-	double G_value = para->getDouble("Edge Parameter");
 	int nb_size = v.neighbors.size();
 	double bestDist = -1; //
 
+	// a neighbor_index passed in is tried first, the sooner bestDist is
+	// high the more midpoints are skipped below
+	int first = 0;
+	if (neighbor_index >= 0)
+	{
+		first = find(v.neighbors.begin(), v.neighbors.end(), neighbor_index) - v.neighbors.begin();
+		first = first < nb_size ? first : 0;
+	}
+	neighbor_index = -1;
+
 	Point3f midPoint = Point3f(0.0,0.0,0.0);
 	Point3f diff = Point3f(0.0,0.0,0.0);
 	double proj_s = 0.0;
 	double dist2 = 0.0;
 	double minDist; // minimum dist of the current midpoint
 
-	for (int i = 0; i < nb_size; ++i)
+	for (int n = 0; n < nb_size; ++n)
 	{
+		int i = (first + n) % nb_size;
 		CVertex & t = samples->vert[v.neighbors[i]];
 		midPoint = (v.P() + t.P()) / 2.0;
 
@@ -228,6 +251,14 @@ double Upsampler::findMaxMidpoint(CVertex & v, int & neighbor_index)
 
 		minDist = diff_md_t.SquaredNorm() - proj * proj;
 
+		// minDist only gets smaller, once it can not beat bestDist this
+		// midpoint is out, the result is the same as the full loop
+		double bestMinDist = dot_produce > 0 ? bestDist / dot_produce : -1;
+		if (minDist <= bestMinDist)
+		{
+			continue;
+		}
+
 		for (int j = 0; j < nb_size; ++j)
 		{
 			CVertex & s = samples->vert[v.neighbors[j]];
@@ -240,6 +271,10 @@ double Upsampler::findMaxMidpoint(CVertex & v, int & neighbor_index)
 			if(proj_min < minDist)
 			{
 				minDist = proj_min;
+				if (minDist <= bestMinDist)
+				{
+					break;
+				}
 			}
 		}
 		minDist *= dot_produce;
@@ -432,7 +467,453 @@ void Upsampler::insertPointsByThreshold()
 }
 
 
+// squared distance of m to the normal line of s, what findMaxMidpoint() measures
+static inline double projectedDist2(const Point3f& m, const CVertex& s)
+{
+	Point3f diff = m - s.cP();
+	double proj = diff * s.cN();
+	return diff.SquaredNorm() - proj * proj;
+}
+
+// with s as a new neighbor, the best midpoint of the sample changes only if
+// s lowers its score, or if the midpoint to s could score higher. its score
+// is at most its distance to s itself. otherwise the cached result holds.
+bool Upsampler::isBestMidpointChanged(int index, CVertex& s)
+{
+	CVertex& v = samples->vert[index];
+	CVertex& t = samples->vert[best_midpoint_neighbor[index]];
+	double bestDist = best_midpoint_score[index];
+
+	Point3f midPoint = (v.P() + t.P()) / 2.0;
+	double dot_produce = pow((2.0 - v.N() * t.N()), G_value);
+	if (projectedDist2(midPoint, s) * dot_produce < bestDist)
+	{
+		return true;
+	}
 
+	midPoint = (v.P() + s.P()) / 2.0;
+	dot_produce = pow((2.0 - v.N() * s.N()), G_value);
+	return projectedDist2(midPoint, s) * dot_produce > bestDist;
+}
+
+// insertPointsByThreshold() rescans all samples on every pass, this keeps the
+// best midpoint of each sample in a max heap. after an insertion only the
+// samples whose best midpoint the new point changes are dirty, their
+// findMaxMidpoint() is redone when they reach the top, with the old score as
+// the key. stale heap entries are skipped when the key no longer matches.
+void Upsampler::insertPointsByPriority()
+{
+	double dist_threshold = para->getDouble("Dist Threshold");
+	int max_add_number = para->getInt("Number of Add Point");
+	cout << "threshold: " << dist_threshold << endl;
+
+	clock_t start = clock();
+	int oldSize = samples->vert.size();
+
+	// the vertexes are not moved while points are added
+	samples->vert.reserve(oldSize + max_add_number + 1);
+	is_abandon_by_threshold.reserve(oldSize + max_add_number + 1);
+
+	best_midpoint_score.assign(oldSize, DBL_MAX);
+	best_midpoint_neighbor.assign(oldSize, -1);
+	is_midpoint_dirty.assign(oldSize, true);
+
+	priority_queue< pair<double, int> > midpoints;
+	for (int i = 0; i < oldSize; i++)
+	{
+		if (!is_abandon_by_threshold[i])
+		{
+			midpoints.push(make_pair(DBL_MAX, i));
+		}
+	}
+
+	double tolerance = 0.5;
+	int addCounter = 0;
+	int updateCounter = 0;
+	while (!midpoints.empty() && addCounter <= max_add_number)
+	{
+		pair<double, int> top = midpoints.top();
+		midpoints.pop();
+
+		int firstVertInex = top.second;
+		if (is_abandon_by_threshold[firstVertInex] || top.first != best_midpoint_score[firstVertInex])
+		{
+			continue;
+		}
+
+		if (is_midpoint_dirty[firstVertInex])
+		{
+			// the last best neighbor is tried first
+			int secondVertIndx = best_midpoint_neighbor[firstVertInex];
+			double bestDist = findMaxMidpoint(samples->vert[firstVertInex], secondVertIndx);
+			updateCounter++;
+
+			is_midpoint_dirty[firstVertInex] = false;
+			best_midpoint_score[firstVertInex] = bestDist;
+			best_midpoint_neighbor[firstVertInex] = secondVertIndx;
+
+			if (secondVertIndx < 0)
+			{
+				continue;
+			}
+			if (bestDist < dist_threshold)
+			{
+				is_abandon_by_threshold[firstVertInex] = true;
+				continue;
+			}
+			// a dirty sample usually drops below the next ones and all would
+			// be updated again and again. within the tolerance of the best
+			// score left it is inserted right away.
+			if (!midpoints.empty() && bestDist < midpoints.top().first * tolerance)
+			{
+				midpoints.push(make_pair(bestDist, firstVertInex));
+				continue;
+			}
+		}
+		int secondVertIndx = best_midpoint_neighbor[firstVertInex];
+		double lineDist = best_midpoint_score[firstVertInex];
+
+		CVertex newv;
+		newv.P() = (samples->vert[firstVertInex].P() + samples->vert[secondVertIndx].P()) / 2.0;
+		newv.m_index = samples->vert.size();
+
+		samples->vert.push_back(newv);
+		is_abandon_by_threshold.push_back(false);
+		addCounter++;
+
+		set<int> setNewVertexNeighors;
+		getLineVertNeighorsIndex(setNewVertexNeighors, firstVertInex, secondVertIndx);
+		CVertex& pv = samples->vert.back();
+
+		getNewPointNeighbors(pv, setNewVertexNeighors, false);
+		computeNewVertexProjDist_Sigma(pv, firstVertInex, secondVertIndx);
+
+		if(wd != 0.0)
+			pv.P() = pv.P() + pv.N() * (d / wd);
+
+		pv.neighbors.clear();
+		getNewPointNeighbors(pv, setNewVertexNeighors, true);
+
+		// the new point starts with the score of the line it splits
+		best_midpoint_score.push_back(lineDist);
+		best_midpoint_neighbor.push_back(-1);
+		is_midpoint_dirty.push_back(true);
+		midpoints.push(make_pair(lineDist, pv.m_index));
+
+		// the popped sample needs a new heap entry. if the projected point
+		// left its radius it can not lower its best midpoint, which would
+		// be inserted again and again, so it is given up.
+		if (find(pv.neighbors.begin(), pv.neighbors.end(), firstVertInex) == pv.neighbors.end())
+		{
+			is_abandon_by_threshold[firstVertInex] = true;
+		}
+		else
+		{
+			is_midpoint_dirty[firstVertInex] = true;
+			midpoints.push(make_pair(best_midpoint_score[firstVertInex], firstVertInex));
+		}
+
+		for (int i = 0; i < pv.neighbors.size(); i++)
+		{
+			int index = pv.neighbors[i];
+			if (is_abandon_by_threshold[index] || is_midpoint_dirty[index])
+			{
+				continue;
+			}
+
+			// no neighbors before, so no heap entry either
+			if (best_midpoint_neighbor[index] < 0)
+			{
+				is_midpoint_dirty[index] = true;
+				best_midpoint_score[index] = lineDist;
+				midpoints.push(make_pair(lineDist, index));
+			}
+			else if (isBestMidpointChanged(index, pv))
+			{
+				is_midpoint_dirty[index] = true;
+			}
+		}
+	}
+
+	samples->vn = samples->vert.size();
+
+	double time = double(clock() - start) / CLOCKS_PER_SEC;
+	cout << "add point: " << addCounter << " in " << time << " seconds, "
+		<< addCounter / max(time, 1e-6) << " points per second, " << updateCounter << " midpoint updates" << endl;
+	cout << "current size: " << samples->vert.size() << endl;
+
+	if (addCounter > max_add_number)
+	{
+		cout << "exeed max add number" << endl;
+	}
+	para->setValue("Dist Threshold", DoubleValue(getPredictThreshold()));
+	cout << "getPredictThreshold" << getPredictThreshold() << endl;
+
+	computeEigenVerctorForRendering();
+}
+
+
+
+
+
+
+// locks the line's vertexes and their neighbors for this round, unless
+// another line of the round already uses one of them
+bool Upsampler::lockLine(int firstV, int secV, vector<int>& locked, int round)
+{
+	vector<int>& first_neighbors = samples->vert[firstV].neighbors;
+	vector<int>& sec_neighbors = samples->vert[secV].neighbors;
+
+	if (locked[firstV] == round || locked[secV] == round)
+	{
+		return false;
+	}
+	for (int i = 0; i < first_neighbors.size(); i++)
+	{
+		if (locked[first_neighbors[i]] == round)
+		{
+			return false;
+		}
+	}
+	for (int i = 0; i < sec_neighbors.size(); i++)
+	{
+		if (locked[sec_neighbors[i]] == round)
+		{
+			return false;
+		}
+	}
+
+	locked[firstV] = round;
+	locked[secV] = round;
+	for (int i = 0; i < first_neighbors.size(); i++)
+	{
+		locked[first_neighbors[i]] = round;
+	}
+	for (int i = 0; i < sec_neighbors.size(); i++)
+	{
+		locked[sec_neighbors[i]] = round;
+	}
+	return true;
+}
+
+// a new point only reads and changes the neighbor lists of its line's
+// vertexes and their neighbors. each round takes the best midpoints whose
+// neighborhoods are disjoint, computes the new points on all cores and then
+// appends them and patches the neighbor lists. only the samples whose best
+// midpoint changed are scored again in the next round.
+void Upsampler::insertPointsInParallel()
+{
+	double dist_threshold = para->getDouble("Dist Threshold");
+	int max_add_number = para->getInt("Number of Add Point");
+	cout << "threshold: " << dist_threshold << endl;
+
+	double start = omp_get_wtime();
+	int oldSize = samples->vert.size();
+
+	// the vertexes are not moved while points are added
+	samples->vert.reserve(oldSize + max_add_number + 1);
+	is_abandon_by_threshold.reserve(oldSize + max_add_number + 1);
+
+	best_midpoint_score.assign(oldSize, DBL_MAX);
+	best_midpoint_neighbor.assign(oldSize, -1);
+	is_midpoint_dirty.assign(oldSize, true);
+	vector<int> locked(oldSize, -1);
+
+	// samples scored per round. a fixed number, so the result does not
+	// depend on the number of threads.
+	int window_size = 1024;
+	double tolerance = 0.5;
+	int addCounter = 0;
+	int roundCounter = 0;
+	int updateCounter = 0;
+	vector<int> dirty;
+	vector< pair<double, int> > candidates;
+	vector<int> lines;
+	vector<CVertex> new_points;
+
+	while (addCounter <= max_add_number)
+	{
+		int sample_num = samples->vert.size();
+
+		// the samples that may still have a midpoint over the threshold, by
+		// their last score. dirty ones keep it until they are scored again.
+		candidates.clear();
+		for (int i = 0; i < sample_num; i++)
+		{
+			if (!is_abandon_by_threshold[i] && (is_midpoint_dirty[i] || best_midpoint_neighbor[i] >= 0))
+			{
+				candidates.push_back(make_pair(best_midpoint_score[i], i));
+			}
+		}
+		if (candidates.empty())
+		{
+			break;
+		}
+
+		// only the best ones are looked at in this round, the one after
+		// them bounds the rest
+		int window_num = min((int)candidates.size(), window_size);
+		int sorted_num = min((int)candidates.size(), window_num + 1);
+		partial_sort(candidates.begin(), candidates.begin() + sorted_num, candidates.end(), greater< pair<double, int> >());
+		double next_score = sorted_num > window_num ? candidates[window_num].first : -1;
+
+		dirty.clear();
+		for (int i = 0; i < window_num; i++)
+		{
+			if (is_midpoint_dirty[candidates[i].second])
+			{
+				dirty.push_back(candidates[i].second);
+			}
+		}
+
+		int dirty_num = dirty.size();
+#pragma omp parallel for schedule(dynamic, 16)
+		for (int i = 0; i < dirty_num; i++)
+		{
+			// the last best neighbor is tried first
+			int secondVertIndx = best_midpoint_neighbor[dirty[i]];
+			best_midpoint_score[dirty[i]] = findMaxMidpoint(samples->vert[dirty[i]], secondVertIndx);
+			best_midpoint_neighbor[dirty[i]] = secondVertIndx;
+		}
+		updateCounter += dirty_num;
+
+		for (int i = 0; i < dirty_num; i++)
+		{
+			is_midpoint_dirty[dirty[i]] = false;
+			if (best_midpoint_neighbor[dirty[i]] >= 0 && best_midpoint_score[dirty[i]] < dist_threshold)
+			{
+				is_abandon_by_threshold[dirty[i]] = true;
+			}
+		}
+
+		for (int i = 0; i < window_num; i++)
+		{
+			candidates[i].first = best_midpoint_score[candidates[i].second];
+		}
+		sort(candidates.begin(), candidates.begin() + window_num, greater< pair<double, int> >());
+
+		// the best midpoints with disjoint neighborhoods. like in
+		// insertPointsByPriority(), ones that dropped under the tolerance
+		// of the rest wait for the next round.
+		int add_limit = max_add_number + 1 - addCounter;
+		lines.clear();
+		for (int i = 0; i < window_num && lines.size() < add_limit; i++)
+		{
+			int firstVertInex = candidates[i].second;
+			if (is_abandon_by_threshold[firstVertInex] || best_midpoint_neighbor[firstVertInex] < 0
+				|| candidates[i].first < next_score * tolerance)
+			{
+				continue;
+			}
+			if (lockLine(firstVertInex, best_midpoint_neighbor[firstVertInex], locked, roundCounter))
+			{
+				lines.push_back(firstVertInex);
+			}
+		}
+		roundCounter++;
+
+		int line_num = lines.size();
+		new_points.assign(line_num, CVertex());
+
+#pragma omp parallel for schedule(dynamic, 16)
+		for (int i = 0; i < line_num; i++)
+		{
+			int firstVertInex = lines[i];
+			int secondVertIndx = best_midpoint_neighbor[firstVertInex];
+
+			CVertex& newv = new_points[i];
+			newv.P() = (samples->vert[firstVertInex].P() + samples->vert[secondVertIndx].P()) / 2.0;
+			newv.m_index = sample_num + i;
+
+			set<int> setNewVertexNeighors;
+			getLineVertNeighorsIndex(setNewVertexNeighors, firstVertInex, secondVertIndx);
+			getNewPointNeighbors(newv, setNewVertexNeighors, false);
+
+			double proj_dist = 0.0;
+			computeNewVertexProjDist_Sigma(newv, firstVertInex, secondVertIndx, proj_dist);
+			newv.P() = newv.P() + newv.N() * proj_dist;
+
+			newv.neighbors.clear();
+			getNewPointNeighbors(newv, setNewVertexNeighors, false);
+		}
+
+		// the new points start with the score of the line they split
+		for (int i = 0; i < line_num; i++)
+		{
+			double lineDist = best_midpoint_score[lines[i]];
+			samples->vert.push_back(new_points[i]);
+			is_abandon_by_threshold.push_back(false);
+			best_midpoint_score.push_back(lineDist);
+			best_midpoint_neighbor.push_back(-1);
+			is_midpoint_dirty.push_back(true);
+			locked.push_back(-1);
+		}
+
+		// the neighborhoods are disjoint, so are the lists patched here
+#pragma omp parallel for
+		for (int i = 0; i < line_num; i++)
+		{
+			CVertex& pv = samples->vert[sample_num + i];
+			for (int j = 0; j < pv.neighbors.size(); j++)
+			{
+				samples->vert[pv.neighbors[j]].neighbors.push_back(pv.m_index);
+			}
+		}
+
+		// as in insertPointsByPriority()
+		for (int i = 0; i < line_num; i++)
+		{
+			CVertex& pv = samples->vert[sample_num + i];
+			int firstVertInex = lines[i];
+
+			if (find(pv.neighbors.begin(), pv.neighbors.end(), firstVertInex) == pv.neighbors.end())
+			{
+				is_abandon_by_threshold[firstVertInex] = true;
+			}
+			else
+			{
+				is_midpoint_dirty[firstVertInex] = true;
+			}
+
+			for (int j = 0; j < pv.neighbors.size(); j++)
+			{
+				int index = pv.neighbors[j];
+				if (is_abandon_by_threshold[index] || is_midpoint_dirty[index])
+				{
+					continue;
+				}
+				if (best_midpoint_neighbor[index] < 0)
+				{
+					is_midpoint_dirty[index] = true;
+					best_midpoint_score[index] = best_midpoint_score[pv.m_index];
+				}
+				else if (isBestMidpointChanged(index, pv))
+				{
+					is_midpoint_dirty[index] = true;
+				}
+			}
+		}
+
+		addCounter += line_num;
+	}
+
+	samples->vn = samples->vert.size();
+
+	double time = omp_get_wtime() - start;
+	cout << "add point: " << addCounter << " in " << roundCounter << " rounds, " << time << " seconds, "
+		<< addCounter / max(time, 1e-6) << " points per second, " << updateCounter << " midpoint updates, "
+		<< omp_get_max_threads() << " threads" << endl;
+	cout << "current size: " << samples->vert.size() << endl;
+
+	if (addCounter > max_add_number)
+	{
+		cout << "exeed max add number" << endl;
+	}
+	para->setValue("Dist Threshold", DoubleValue(getPredictThreshold()));
+	cout << "getPredictThreshold" << getPredictThreshold() << endl;
+
+	computeEigenVerctorForRendering();
+}
 
 
 
@@ -485,6 +966,16 @@ void Upsampler::computeNewVertexNormAvgMethod(CVertex & v, int firstV, int secV)
 
 //our new sigma
 void Upsampler::computeNewVertexProjDist_Sigma(CVertex & v, int firstV, int secV)
+{
+	double proj_dist = 0.0;
+	computeNewVertexProjDist_Sigma(v, firstV, secV, proj_dist);
+
+	d = proj_dist;
+	wd = 1.0;
+}
+
+// does not touch the members, so new vertexes can be computed in parallel
+void Upsampler::computeNewVertexProjDist_Sigma(CVertex & v, int firstV, int secV, double & proj_dist)
 {
 	const int NORMAL_NUM = 2;
 	double radius2 = radius * radius;
@@ -536,8 +1027,7 @@ void Upsampler::computeNewVertexProjDist_Sigma(CVertex & v, int firstV, int secV
 		}
 	}
 
-	d = -projDist[min_index] / sumW[min_index];
-	wd = 1.0;
+	proj_dist = -projDist[min_index] / sumW[min_index];
 
 	v.N() = (grad_f[min_index] / sumW[min_index]).Normalize();
 }
@@ -555,9 +1045,14 @@ void Upsampler::optimizeProjection()
 	sum_Gw.assign(samples->vn, Point3f(0, 0, 0));
 	sum_Gf.assign(samples->vn, Point3f(0, 0, 0));
 
+	// the grid callbacks are static, they get the feature sigma term from here
+	double sigma = para->getDouble("Feature Sigma");
+	psi_denominator = pow(max(1e-18,1-cos(sigma/180.0*3.1415926)), 2);
+
 	double radius = para->getDouble("CGrid Radius");
 	CGrid mesh_grid;
 	CGrid original_grid;
+	mesh_grid.parallel = true;
 	mesh_grid.init(samples->vert, samples->bbox, radius);
 
 	/* updateNormal Before projection */
@@ -582,7 +1077,6 @@ void Upsampler::self_optimize_upsamples_global(CGrid::iterator start, CGrid::ite
 	double iradius16 = -4/radius2;  
 	const double PI = 3.1415926;
 	double delta = 2.0;
-	double sigma = global_paraMgr.upsampling.getDouble("Feature Sigma");
 
 	for(CGrid::iterator dest = start; dest != end; dest++) {
 		CVertex &v = *(*dest);
@@ -599,7 +1093,7 @@ void Upsampler::self_optimize_upsamples_global(CGrid::iterator start, CGrid::ite
 				Point3f tm(t.N());
 
 				double theta_1 = exp(dist2 * iradius16); 
-				double psi = exp(-pow(1-vm*tm, 2)/pow(max(1e-18,1-cos(sigma/180.0*3.1415926)), 2));
+				double psi = exp(-pow(1-vm*tm, 2)/psi_denominator);
 
 				double weight = theta_1 * psi;
 				updateVT_proj(v, t, weight);
@@ -616,7 +1110,6 @@ void Upsampler::other_optimize_upsamples_global(CGrid::iterator starta, CGrid::i
 	double iradius16 = -4/radius2;  
 	const double PI = 3.1415926;
 	double delta = 2.0;
-	double sigma = global_paraMgr.upsampling.getDouble("Feature Sigma");
 
 	for(CGrid::iterator dest = starta; dest != enda; dest++) {
 		CVertex &v = *(*dest);
@@ -632,7 +1125,7 @@ void Upsampler::other_optimize_upsamples_global(CGrid::iterator starta, CGrid::i
 				Point3f tm(t.N());
 
 				double theta_1 = exp(dist2 * iradius16); 
-				double psi = exp(-pow(1-vm*tm, 2)/pow(max(1e-18,1-cos(sigma/180.0*3.1415926)), 2));
+				double psi = exp(-pow(1-vm*tm, 2)/psi_denominator);
 
 				double weight = theta_1 * psi;
 				updateVT_proj(v, t, weight);
@@ -656,7 +1149,6 @@ void Upsampler::self_optimize_normals(CGrid::iterator start, CGrid::iterator end
 	double iradius16 = -4/radius2;  
 	const double PI = 3.1415926;
 	double delta = 2.0;
-	double sigma = global_paraMgr.upsampling.getDouble("Feature Sigma");
 
 	for(CGrid::iterator dest = start; dest != end; dest++) {
 		CVertex &v = *(*dest);
@@ -674,7 +1166,7 @@ void Upsampler::self_optimize_normals(CGrid::iterator start, CGrid::iterator end
 				Point3f tm(t.N());
 
 				double theta_1 = exp(dist2 * iradius16); 
-				double psi = exp(-pow(1-vm*tm, 2)/pow(max(1e-18,1-cos(sigma/180.0*3.1415926)), 2));
+				double psi = exp(-pow(1-vm*tm, 2)/psi_denominator);
 
 				double weight = theta_1 * psi;
 				updateVT_proj_normal(v, t, weight, radius / 2.);
@@ -690,7 +1182,6 @@ void Upsampler::other_optimize_normals(CGrid::iterator starta, CGrid::iterator e
 	double iradius16 = -4/radius2;  
 	const double PI = 3.1415926;
 	double delta = 2.0;
-	double sigma = global_paraMgr.upsampling.getDouble("Feature Sigma");
 
 	for(CGrid::iterator dest = starta; dest != enda; dest++) {
 		CVertex &v = *(*dest);
@@ -707,7 +1198,7 @@ void Upsampler::other_optimize_normals(CGrid::iterator starta, CGrid::iterator e
 				Point3f tm(t.N());
 
 				double theta_1 = exp(dist2 * iradius16); 
-				double psi = exp(-pow(1-vm*tm, 2)/pow(max(1e-18,1-cos(sigma/180.0*3.1415926)), 2));
+				double psi = exp(-pow(1-vm*tm, 2)/psi_denominator);
 
 				double weight = theta_1 * psi;
 				updateVT_proj_normal(v, t, weight, radius / 2.);
@@ -7,6 +7,7 @@
 #include <iostream>
 #include <algorithm>
 #include <set>
+#include <queue>
 
 using namespace vcg;
 using namespace std;
@@ -39,11 +40,20 @@ private:
 	void clearAllThresholdFlag();
 	void insertPointsByThreshold();
 
+	// same insertion, the largest midpoint score of all samples first
+	void insertPointsByPriority();
+	bool isBestMidpointChanged(int index, CVertex& s);
+
+	// rounds of insertions whose neighborhoods do not overlap, on all cores
+	void insertPointsInParallel();
+	bool lockLine(int firstV, int secV, vector<int>& locked, int round);
+
 	double getPredictThreshold();
 	double getPredictThresholdFirstTime(); 
 
 	void computeNewVertexNormAvgMethod(CVertex & v, int firstV, int secV);
 	void computeNewVertexProjDist_Sigma(CVertex & v, int firstV, int secV);
+	void computeNewVertexProjDist_Sigma(CVertex & v, int firstV, int secV, double & proj_dist);
 	void computeEigenVerctorForRendering();
 
 
@@ -67,6 +77,12 @@ private:
 	double d;
 	double wd;
 	vector<bool> is_abandon_by_threshold;
+
+	// per sample, the findMaxMidpoint() result, dirty once a point added
+	// to its neighbors changes it
+	vector<double> best_midpoint_score;
+	vector<int> best_midpoint_neighbor;
+	vector<bool> is_midpoint_dirty;
 	//vector<double> best_dist_set;
 
 	/******    Projection:   *******/
@@ -91,4 +107,6 @@ private:
 	static vector<Point3f> sum_Gw;
 	static vector<Point3f> sum_Gf;
 
+	static double psi_denominator;  // pow(1 - cos(sigma), 2) of "Feature Sigma", set before the grid runs
+
 };
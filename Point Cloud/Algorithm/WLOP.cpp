@@ -1,5 +1,21 @@
 #include "WLOP.h"
 
+WLOPParameters::WLOPParameters(RichParameterSet* para)
+{
+	radius = para->getDouble("CGrid Radius");
+	h_gaussian = para->getDouble("H Gaussian Para");
+	average_power = para->getDouble("Average Power");
+	repulsion_power = para->getDouble("Repulsion Power");
+	mu = para->getDouble("Repulsion Mu");
+	need_density = para->getBool("Need Compute Density");
+	need_pca = para->getBool("Need Compute PCA");
+	anisotropic = para->getBool("Run Anisotropic LOP");
+	use_simd = para->getBool("Use SIMD Kernels");
+	fused = para->getBool("Run Fused WLOP");
+	neighbor_skin = radius * para->getDouble("Neighbor Skin Ratio");
+	density_cache = global_paraMgr.data.getString("Density Cache Directory").toStdString();
+}
+
 
 WLOP::WLOP(RichParameterSet* _para)
 {
@@ -9,6 +25,8 @@ WLOP::WLOP(RichParameterSet* _para)
 	original = NULL;
 	nTimeIterated = 0;
 	error_x = 0.0;
+	original_grid_base = NULL;
+	original_arrays_base = NULL;
 }
 
 WLOP::~WLOP(void)
@@ -22,9 +40,12 @@ void WLOP::clear()
 	original = NULL;
 }
 
+// new data was loaded, the original grid and arrays are rebuilt on the next iteration
 void WLOP::setFirstIterate()
 {
 	nTimeIterated = 0;
+	original_grid_base = NULL;
+	original_arrays_base = NULL;
 }
 
 void WLOP::setInput(DataMgr* pData)
@@ -91,25 +112,40 @@ void WLOP::initVertexes()
 
 	repulsion_weight_sum.assign(samples->vn, 0);
 	average_weight_sum.assign(samples->vn, 0);
-
-	if (para->getBool("Need Compute PCA"))
-	{
-		CVertex v;
-		mesh_temp.assign(samples->vn, v);
-	}
 }
 
 
 void WLOP::run()
 {
-	if (para->getBool("Run Anisotropic LOP"))
+	paras = WLOPParameters(para);
+
+	if (paras.anisotropic)
 	{
 		cout << "Run Anisotropic LOP" << endl;
 	}
 	//int nTimes = para->getDouble("Num Of Iterate Time");
 	for(int i = 0; i < 1; i++)
 	{ 
-		iterate();
+		clock_t start = clock();
+		if (paras.fused)
+		{
+			iterateFused();
+		}
+		else
+		{
+			iterate();
+		}
+
+		double memory_mb, peak_memory_mb;
+		GlobalFun::getMemoryUsage(memory_mb, peak_memory_mb);
+		cout << "WLOP iteration time: " << double(clock() - start) / CLOCKS_PER_SEC << " seconds, memory: "
+			<< memory_mb << " MB, peak memory: " << peak_memory_mb << " MB" << endl;
+		if (paras.neighbor_skin > 0 && !paras.fused)
+		{
+			cout << "neighbor searches: " << samples->neighbor_cache.build_num << " of " << samples->neighbor_cache.update_num
+				<< " iterations, original neighbor searches: " << samples->original_neighbor_cache.build_num
+				<< " of " << samples->original_neighbor_cache.update_num << " iterations" << endl;
+		}
 		
 		nTimeIterated ++;
 		cout << "Iterated: " << nTimeIterated << endl;
@@ -117,157 +153,107 @@ void WLOP::run()
 	cout << "**************iterate Number: " << nTimeIterated << endl;
 }
 
-void WLOP::computeAverageTerm(CMesh* samples, CMesh* original)
+WLOPKernel::Level WLOP::kernelLevel()
 {
-	double average_power = para->getDouble("Average Power");
-	bool need_density = para->getBool("Need Compute Density");
-	double radius = para->getDouble("CGrid Radius"); 
+	if (paras.use_simd)
+	{
+		return WLOPKernel::bestLevel();
+	}
+	return WLOPKernel::SCALAR;
+}
 
+void WLOP::computeAverageTerm(CMesh* samples, CMesh* original)
+{
+	double radius = paras.radius;
 	double radius2 = radius * radius;
-	double iradius16 = -para->getDouble("H Gaussian Para")/radius2;
+	double iradius16 = -paras.h_gaussian/radius2;
 
-	cout << "Original Size:" << samples->vert[0].original_neighbors.size() << endl;
-	for(int i = 0; i < samples->vert.size(); i++)
+	// no graph was built for a too small radius
+	if (samples->vn == 0 || samples->original_neighbor_graph.rowNum() != samples->vn)
 	{
-		CVertex& v = samples->vert[i];
-
-		for (int j = 0; j < v.original_neighbors.size(); j++)
-		{
-			CVertex& t = original->vert[v.original_neighbors[j]];
-			
-			Point3f diff = v.P() - t.P();
-			double dist2  = diff.SquaredNorm();
-
-			double w = 1;
-			if (para->getBool("Run Anisotropic LOP"))
-			{
-				double len = sqrt(dist2);
-				if(len <= 0.001 * radius) len = radius*0.001;
-				double hn = diff * v.N();
-				double phi = exp(hn * hn * iradius16);
-				w = phi / pow(len, 2 - average_power);
-			}
-			else if (average_power < 2)
-			{
-				double len = sqrt(dist2);
-				if(len <= 0.001 * radius) len = radius*0.001;
-				w = exp(dist2 * iradius16) / pow(len, 2 - average_power);
-			}
-			else
-			{
-				w = exp(dist2 * iradius16);
-			}
-
-			if (need_density)
-			{
-				w *= original_density[t.m_index];
-			}
-
-			average[i] += t.P() * w;  
-			average_weight_sum[i] += w;  
+		cout << "ERROR: WLOP::computeAverageTerm: no neighbor graph!!" << endl;
+		return;
+	}
+	cout << "Original Size:" << samples->original_neighbor_graph[0].size() << endl;
 
-		}
+	WLOPKernel::Rows rows = WLOPKernel::rowsOf(samples, samples->original_neighbor_graph, original, radius, iradius16);
+	if (paras.need_density && !original_density.empty())
+	{
+		rows.neighbor_weight = &original_density[0];
 	}
+
+	WLOPKernel::averageTerm(kernelLevel(), rows, paras.average_power, paras.anisotropic,
+		&average[0], &average_weight_sum[0]);
 }
 
 
 void WLOP::computeRepulsionTerm(CMesh* samples)
 {
-	double repulsion_power = para->getDouble("Repulsion Power");
-	bool need_density = para->getBool("Need Compute Density");
-	double radius = para->getDouble("CGrid Radius"); 
-
+	double radius = paras.radius;
 	double radius2 = radius * radius;
-	double iradius16 = -para->getDouble("H Gaussian Para")/radius2;
+	double iradius16 = -paras.h_gaussian/radius2;
 
-	cout << endl<< endl<< "Sample Neighbor Size:" << samples->vert[0].neighbors.size() << endl<< endl;
-	for(int i = 0; i < samples->vert.size(); i++)
+	if (samples->vn == 0 || samples->neighbor_graph.rowNum() != samples->vn)
 	{
-		CVertex& v = samples->vert[i];
-		for (int j = 0; j < v.neighbors.size(); j++)
-		{
-			CVertex& t = samples->vert[v.neighbors[j]];
-			Point3f diff = v.P() - t.P();
-
-			double dist2  = diff.SquaredNorm();
-			double len = sqrt(dist2);
-			if(len <= 0.001 * radius) len = radius*0.001;
-
-			double w = exp(dist2*iradius16);
-			double rep = w * pow(1.0 / len, repulsion_power);
-
-			if (need_density)
-			{
-				rep *= samples_density[t.m_index];
-			}
+		cout << "ERROR: WLOP::computeRepulsionTerm: no neighbor graph!!" << endl;
+		return;
+	}
+	cout << endl<< endl<< "Sample Neighbor Size:" << samples->neighbor_graph[0].size() << endl<< endl;
 
-			repulsion[i] += diff * rep;  
-			repulsion_weight_sum[i] += rep;
-		}
+	WLOPKernel::Rows rows = WLOPKernel::rowsOf(samples, samples->neighbor_graph, samples, radius, iradius16);
+	if (paras.need_density && !samples_density.empty())
+	{
+		rows.neighbor_weight = &samples_density[0];
 	}
+
+	WLOPKernel::repulsionTerm(kernelLevel(), rows, paras.repulsion_power, &repulsion[0], &repulsion_weight_sum[0]);
 }
 
 
 void WLOP::computeDensity(bool isOriginal, double radius)
 {
 	CMesh* mesh;
+	vector<double>* density;
 	if (isOriginal)
 	{
 		mesh = original;
+		density = &original_density;
 	}
 	else
 	{
 		mesh = samples;
+		density = &samples_density;
 	}
 
 	double radius2 = radius * radius;
-	double iradius16 = -para->getDouble("H Gaussian Para") / radius2;
+	double iradius16 = -paras.h_gaussian / radius2;
 
-	for(int i = 0; i < mesh->vert.size(); i++)
+	// without a graph every point is alone, the density of one point
+	if (mesh->neighbor_graph.rowNum() != mesh->arrays.size())
 	{
-		CVertex& v = mesh->vert[i];
-
-		if (isOriginal)
-		{
-			original_density[i] = 1.;
-		}
-		else
-		{
-			samples_density[i] = 1.;
-		}
-
-		vector<int>* neighbors = &v.neighbors;
-
-		for (int j = 0; j < neighbors->size(); j++)
-		{
-			CVertex& t = mesh->vert[(*neighbors)[j]];
-			double dist2  = (v.P() - t.P()).SquaredNorm();
-			double den = exp(dist2*iradius16);
-
-			if (isOriginal)
-			{
-				original_density[i] += den;
-			}
-			else
-			{
-				samples_density[i] += den;
-			}
-		}
+		cout << "ERROR: WLOP::computeDensity: no neighbor graph!!" << endl;
+		density->assign(mesh->arrays.size(), 1.);
+		return;
+	}
+	if (mesh->arrays.size() == 0)
+	{
+		return;
 	}
 
-	for(int i = 0; i < mesh->vert.size(); i++)
+	WLOPKernel::Rows rows = WLOPKernel::rowsOf(mesh, mesh->neighbor_graph, mesh, radius, iradius16);
+	WLOPKernel::densityTerm(kernelLevel(), rows, &(*density)[0]);
+
+	for(int i = 0; i < mesh->arrays.size(); i++)
 	{
 		if (isOriginal)
 		{
-			CVertex& v = mesh->vert[i];
-			original_density[i] = 1. / original_density[i];
+			(*density)[i] = 1. / (*density)[i];
 		}
 		else
 		{
-			samples_density[i] = sqrt(samples_density[i]);
+			(*density)[i] = sqrt((*density)[i]);
 		}
 	}
-
 }
 
 
@@ -277,47 +263,57 @@ double WLOP::iterate()
 
 	initVertexes();
 
+	samples->arrays.load(samples->vert);
+	updateOriginalArrays();
+
 	time.start("Sample Original Neighbor Tree!!!");
-	GlobalFun::computeBallNeighbors(samples, original, 
-		para->getDouble("CGrid Radius"), box);
+	GlobalFun::updateBallNeighbors(samples, original, 
+		paras.radius, paras.neighbor_skin, box, false);
 	time.end();
 
 	time.start("Sample Sample Neighbor Tree");
-	GlobalFun::computeBallNeighbors(samples, NULL, 
-		para->getDouble("CGrid Radius"), samples->bbox);
+	GlobalFun::updateBallNeighbors(samples, NULL, 
+		paras.radius, paras.neighbor_skin, samples->bbox, false);
 	time.end();
 	
 	if (nTimeIterated == 0) 
 	{
-		if (para->getBool("Need Compute Density"))
+		if (paras.need_density)
 		{
 			double local_density_para = 0.95;
-			time.start("Original Original Neighbor Tree");
-			GlobalFun::computeBallNeighbors(original, NULL, 
-				para->getDouble("CGrid Radius") * local_density_para, original->bbox);
-			time.end();
+			CDensityCache cache(paras.density_cache, WLOPKernel::levelName(kernelLevel()), original->vert,
+				paras.radius * local_density_para, paras.h_gaussian);
 
-			time.start("Compute Original Density");
-			original_density.assign(original->vn, 0);
+			if (!cache.load(original_density))
+			{
+				time.start("Original Original Neighbor Tree");
+				GlobalFun::computeBallNeighbors(original, NULL, 
+					paras.radius * local_density_para, original->bbox, false);
+				time.end();
 
-			computeDensity(true, para->getDouble("CGrid Radius") * local_density_para);
-			time.end();
+				time.start("Compute Original Density");
+				original_density.assign(original->vn, 0);
+
+				computeDensity(true, paras.radius * local_density_para);
+				time.end();
+
+				cache.save(original_density);
+			}
+			else
+			{
+				cout << "original density from " << cache.fileName() << endl;
+			}
 		}
 		
 	}
 
-	if (para->getBool("Need Compute Density"))
+	if (paras.need_density)
 	{
 		time.start("Compute Density For Sample");
-		computeDensity(false, para->getDouble("CGrid Radius"));
+		computeDensity(false, paras.radius);
 		time.end();
 	}
 
-	time.start("Sample Original Neighbor Tree!!!");
-	GlobalFun::computeBallNeighbors(samples, original, 
-		para->getDouble("CGrid Radius"), box);
-	time.end();
-
 	time.start("Compute Average Term");
 	computeAverageTerm(samples, original);
 	time.end();
@@ -326,7 +322,15 @@ double WLOP::iterate()
 	computeRepulsionTerm(samples);
 	time.end();
 
-	double mu = para->getDouble("Repulsion Mu");
+	return moveSamples();
+}
+
+
+// move the samples by the average and repulsion terms, then the normals
+double WLOP::moveSamples()
+{
+	Timer time;
+	double mu = paras.mu;
 	Point3f c;
 
 	for(int i = 0; i < samples->vert.size(); i++)
@@ -357,7 +361,7 @@ double WLOP::iterate()
 	para->setValue("Current Movement Error", DoubleValue(error_x));
 	cout << "****finished compute WLOP error:	" << error_x << endl;
 
-	if (para->getBool("Need Compute PCA"))
+	if (paras.need_pca)
 	{
 		time.start("Recompute PCA");
 		recomputePCA_Normal();
@@ -367,19 +371,316 @@ double WLOP::iterate()
 }
 
 
-void WLOP::recomputePCA_Normal()
+// the fused mode computes the terms inside the grid callbacks, no neighbor
+// list is stored. the state of the running pass is their grid context.
+struct FusedPass
 {
-	for(int i = 0; i < samples->vn; i++)
+	const WLOPParameters* paras;
+	double radius;
+	double iradius16;
+	const double* weight;   // density of the neighbor side, NULL for none
+	Point3f* sum;
+	double* weight_sum;
+};
+
+// the weights of the scalar kernels in LOPKernel.h, for one pair
+static inline double fusedAverageWeight(const FusedPass& pass, const Point3f& diff, double dist2, const Point3f& normal)
+{
+	const WLOPParameters& p = *pass.paras;
+
+	if (p.anisotropic)
+	{
+		double len = sqrt(dist2);
+		if(len <= 0.001 * pass.radius) len = pass.radius*0.001;
+		double hn = diff * normal;
+		return exp(hn * hn * pass.iradius16) / pow(len, 2 - p.average_power);
+	}
+	if (p.average_power < 2)
 	{
-		mesh_temp[i].P() = samples->vert[i].P();
+		double len = sqrt(dist2);
+		if(len <= 0.001 * pass.radius) len = pass.radius*0.001;
+		return exp(dist2 * pass.iradius16) / pow(len, 2 - p.average_power);
 	}
+	return exp(dist2 * pass.iradius16);
+}
+
+static inline double fusedRepulsionWeight(const FusedPass& pass, double dist2)
+{
+	double len = sqrt(dist2);
+	if(len <= 0.001 * pass.radius) len = pass.radius*0.001;
 
+	double power = pass.paras->repulsion_power;
+	double inv_pow = (power == 1.0) ? 1.0 / len : pow(1.0 / len, power);
+	return exp(dist2 * pass.iradius16) * inv_pow;
+}
+
+// a: samples, b: original
+static void __cdecl fusedAverage(CGrid::iterator starta, CGrid::iterator enda,
+	CGrid::iterator startb, CGrid::iterator endb, double radius, void* context)
+{
+	FusedPass& pass = *(FusedPass*)context;
+	double radius2 = pass.radius * pass.radius;
+
+	for(CGrid::iterator dest = starta; dest != enda; dest++)
+	{
+		CVertex& v = *(*dest);
+		Point3f& p = v.P();
+		Point3f sum(0, 0, 0);
+		double weight_sum = 0;
+
+		for(CGrid::iterator origin = startb; origin != endb; origin++)
+		{
+			CVertex& t = *(*origin);
+			Point3f diff = p - t.P();
+			double dist2 = diff.SquaredNorm();
+			if (dist2 >= radius2)
+			{
+				continue;
+			}
+
+			double w = fusedAverageWeight(pass, diff, dist2, v.N());
+			if (pass.weight)
+			{
+				w *= pass.weight[t.m_index];
+			}
+			sum += t.P() * w;
+			weight_sum += w;
+		}
+
+		pass.sum[v.m_index] += sum;
+		pass.weight_sum[v.m_index] += weight_sum;
+	}
+}
+
+static inline void fusedRepulsionPair(const FusedPass& pass, CVertex& v, CVertex& t, double radius2)
+{
+	Point3f diff = v.P() - t.P();
+	double dist2 = diff.SquaredNorm();
+	if (dist2 >= radius2)
+	{
+		return;
+	}
+
+	double rep = fusedRepulsionWeight(pass, dist2);
+	double rep_v = pass.weight ? rep * pass.weight[t.m_index] : rep;
+	double rep_t = pass.weight ? rep * pass.weight[v.m_index] : rep;
+
+	pass.sum[v.m_index] += diff * rep_v;
+	pass.weight_sum[v.m_index] += rep_v;
+	pass.sum[t.m_index] -= diff * rep_t;
+	pass.weight_sum[t.m_index] += rep_t;
+}
+
+static void __cdecl fusedRepulsionSelf(CGrid::iterator start, CGrid::iterator end, double radius, void* context)
+{
+	const FusedPass& pass = *(const FusedPass*)context;
+	double radius2 = pass.radius * pass.radius;
+	for(CGrid::iterator dest = start; dest != end; dest++)
+	{
+		for(CGrid::iterator origin = dest+1; origin != end; origin++)
+		{
+			fusedRepulsionPair(pass, **dest, **origin, radius2);
+		}
+	}
+}
+
+static void __cdecl fusedRepulsionOther(CGrid::iterator starta, CGrid::iterator enda,
+	CGrid::iterator startb, CGrid::iterator endb, double radius, void* context)
+{
+	const FusedPass& pass = *(const FusedPass*)context;
+	double radius2 = pass.radius * pass.radius;
+	for(CGrid::iterator dest = starta; dest != enda; dest++)
+	{
+		for(CGrid::iterator origin = startb; origin != endb; origin++)
+		{
+			fusedRepulsionPair(pass, **dest, **origin, radius2);
+		}
+	}
+}
+
+// pass.weight_sum gets the gaussian sum of the neighbors of each point
+static inline void fusedDensityPair(const FusedPass& pass, CVertex& v, CVertex& t, double radius2)
+{
+	double dist2 = (v.P() - t.P()).SquaredNorm();
+	if (dist2 < radius2)
+	{
+		double w = exp(dist2 * pass.iradius16);
+		pass.weight_sum[v.m_index] += w;
+		pass.weight_sum[t.m_index] += w;
+	}
+}
+
+static void __cdecl fusedDensitySelf(CGrid::iterator start, CGrid::iterator end, double radius, void* context)
+{
+	const FusedPass& pass = *(const FusedPass*)context;
+	double radius2 = pass.radius * pass.radius;
+	for(CGrid::iterator dest = start; dest != end; dest++)
+	{
+		for(CGrid::iterator origin = dest+1; origin != end; origin++)
+		{
+			fusedDensityPair(pass, **dest, **origin, radius2);
+		}
+	}
+}
+
+static void __cdecl fusedDensityOther(CGrid::iterator starta, CGrid::iterator enda,
+	CGrid::iterator startb, CGrid::iterator endb, double radius, void* context)
+{
+	const FusedPass& pass = *(const FusedPass*)context;
+	double radius2 = pass.radius * pass.radius;
+	for(CGrid::iterator dest = starta; dest != enda; dest++)
+	{
+		for(CGrid::iterator origin = startb; origin != endb; origin++)
+		{
+			fusedDensityPair(pass, **dest, **origin, radius2);
+		}
+	}
+}
+
+
+// the grid box has a margin of one radius around the points, the grid is
+// kept as long as the samples stay inside it
+void WLOP::updateOriginalGrid()
+{
+	bool valid = original_grid_base != NULL
+		&& original_grid_base == &original->vert[0]
+		&& original_grid_size == (int)original->vert.size()
+		&& original_grid_radius == paras.radius
+		&& original_grid_box.IsIn(box.min) && original_grid_box.IsIn(box.max);
+	if (valid)
+	{
+		return;
+	}
+
+	original_grid_box = box;
+	original_grid_box.Offset(paras.radius);
+	original_grid_radius = paras.radius;
+	original_grid_base = &original->vert[0];
+	original_grid_size = original->vert.size();
+
+	original_grid.parallel = true;
+	original_grid.init(original->vert, original_grid_box, paras.radius);
+}
+
+void WLOP::updateOriginalArrays()
+{
+	bool valid = original_arrays_base != NULL
+		&& original_arrays_base == &original->vert[0]
+		&& original->arrays.size() == (int)original->vert.size();
+	if (valid)
+	{
+		return;
+	}
+
+	original->arrays.load(original->vert);
+	original_arrays_base = &original->vert[0];
+}
+
+// the same iteration as iterate(), without neighbor lists: the original
+// grid is kept between iterations, the samples grid is built once and the
+// density, average and repulsion terms are summed while walking the cells
+double WLOP::iterateFused()
+{
+	Timer time;
+
+	initVertexes();
+	if (original->vert.empty() || samples->vert.empty() || paras.radius < 0.0001)
+	{
+		cout << "ERROR: WLOP::iterateFused: empty samples or original, or too small radius!!" << endl;
+		return error_x;
+	}
+
+	time.start("Original Grid");
+	updateOriginalGrid();
+	time.end();
+
+	time.start("Sample Grid");
+	CGrid samples_grid;
+	samples_grid.parallel = true;
+	samples_grid.init(samples->vert, original_grid_box, paras.radius);
+	time.end();
+
+	FusedPass pass;
+	pass.paras = &paras;
+	pass.weight = NULL;
+	pass.sum = NULL;
+	pass.weight_sum = NULL;
+
+	if (nTimeIterated == 0 && paras.need_density)
+	{
+		// the original grid cells are larger than this radius, that is fine
+		double local_density_para = 0.95;
+		pass.radius = paras.radius * local_density_para;
+		pass.iradius16 = -paras.h_gaussian / (pass.radius * pass.radius);
+
+		CDensityCache cache(paras.density_cache, "Fused", original->vert, pass.radius, paras.h_gaussian);
+		if (!cache.load(original_density))
+		{
+			time.start("Compute Original Density");
+			original_density.assign(original->vn, 1.);
+			pass.weight_sum = &original_density[0];
+			original_grid.iterate(fusedDensitySelf, fusedDensityOther, &pass);
+			for (int i = 0; i < original->vn; i++)
+			{
+				original_density[i] = 1. / original_density[i];
+			}
+			time.end();
+
+			cache.save(original_density);
+		}
+		else
+		{
+			cout << "original density from " << cache.fileName() << endl;
+		}
+	}
+
+	pass.radius = paras.radius;
+	pass.iradius16 = -paras.h_gaussian / (paras.radius * paras.radius);
+
+	if (paras.need_density)
+	{
+		time.start("Compute Density For Sample");
+		samples_density.assign(samples->vn, 1.);
+		pass.weight_sum = &samples_density[0];
+		samples_grid.iterate(fusedDensitySelf, fusedDensityOther, &pass);
+		for (int i = 0; i < samples->vn; i++)
+		{
+			samples_density[i] = sqrt(samples_density[i]);
+		}
+		time.end();
+	}
+
+	time.start("Compute Average Term");
+	pass.weight = paras.need_density ? &original_density[0] : NULL;
+	pass.sum = &average[0];
+	pass.weight_sum = &average_weight_sum[0];
+	samples_grid.sample(original_grid, fusedAverage, &pass);
+	time.end();
+
+	time.start("Compute Repulsion Term");
+	pass.weight = paras.need_density ? &samples_density[0] : NULL;
+	pass.sum = &repulsion[0];
+	pass.weight_sum = &repulsion_weight_sum[0];
+	samples_grid.iterate(fusedRepulsionSelf, fusedRepulsionOther, &pass);
+	time.end();
+
+	return moveSamples();
+}
+
+
+void WLOP::recomputePCA_Normal()
+{
 	int knn = global_paraMgr.norSmooth.getInt("PCA KNN");
-	vcg::NormalExtrapolation<vector<CVertex> >::ExtrapolateNormals(mesh_temp.begin(), mesh_temp.end(), knn, -1);
+
+	CNeighborGraph knn_graph;
+	vector<Point3f> normals;
+	NormalOrientation::computeKnnGraph(samples->vert, knn, knn_graph);
+	NormalOrientation::computePcaNormals(samples->vert, knn_graph, normals);
+	NormalOrientation::orientNormals(knn_graph, normals);
 
 	for(int i = 0; i < samples->vn; i++)
 	{
-		Point3f& new_normal = mesh_temp[i].N();
+		Point3f& new_normal = normals[i];
 		CVertex& v = samples->vert[i];
 		if (v.N() * new_normal > 0)
 		{
@@ -1,12 +1,35 @@
 #pragma once
 #include "GlobalFunction.h"
 #include "PointCloudAlgorithm.h"
-#include "normal_extrapolation.h"
+#include "NormalOrientation.h"
+#include "WLOPKernel.h"
+#include "DensityCache.h"
 #include <iostream>
 
 using namespace std;
 using namespace vcg;
 
+// the WLOP parameters, read from the RichParameterSet once at the start
+// of run(). the iteration and the kernels only see this copy.
+struct WLOPParameters
+{
+	WLOPParameters() {}
+	explicit WLOPParameters(RichParameterSet* para);
+
+	double radius;
+	double h_gaussian;
+	double average_power;
+	double repulsion_power;
+	double mu;
+	bool need_density;
+	bool need_pca;
+	bool anisotropic;
+	bool use_simd;
+	bool fused;
+	double neighbor_skin;   // radius * "Neighbor Skin Ratio", 0 searches the neighbors every iteration
+	string density_cache;   // data "Density Cache Directory", empty computes the original density every run
+};
+
 // better code is going to be in CGAL 
 class WLOP : public PointCloudAlgorithm
 {
@@ -34,15 +57,21 @@ private:
 	void initVertexes();
 
 	double iterate();
+	double iterateFused();
+	void updateOriginalGrid();
+	void updateOriginalArrays();
+	double moveSamples();
 	void computeAverageTerm(CMesh* samples, CMesh* original);
 	void computeRepulsionTerm(CMesh* samples);
 
 	void computeDensity(bool isOriginal, double radius);
+	WLOPKernel::Level kernelLevel();
 	void recomputePCA_Normal();
 
 
 private:
 	RichParameterSet* para;
+	WLOPParameters paras;
 
 private:
 	CMesh* samples;
@@ -61,5 +90,15 @@ private:
 	vector<Point3f> average;
 	vector<double>  average_weight_sum;
 
-	vector<CVertex> mesh_temp;
+	// fused mode: grid of the original points, only rebuilt when the radius,
+	// the original cloud or the box the samples need changes
+	CGrid original_grid;
+	Box3f original_grid_box;
+	double original_grid_radius;
+	CVertex* original_grid_base;
+	int original_grid_size;
+
+	// the original points don't move while WLOP iterates, their arrays
+	// are loaded once per input
+	CVertex* original_arrays_base;
 };
@@ -0,0 +1,172 @@
+#include "WLOPKernel.h"
+#include "LOPKernel.h"
+#include "CMesh.h"
+#include <math.h>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+
+static void cpuid(int info[4], int leaf)
+{
+#ifdef _MSC_VER
+	__cpuid(info, leaf);
+#else
+	unsigned int a, b, c, d;
+	__cpuid(leaf, a, b, c, d);
+	info[0] = a; info[1] = b; info[2] = c; info[3] = d;
+#endif
+}
+
+// which register state the os saves on a context switch
+static unsigned long long xgetbv0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int lo, hi;
+	__asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+static WLOPKernel::Level detectLevel()
+{
+	int info[4];
+	cpuid(info, 0);
+	if (info[0] < 1)
+	{
+		return WLOPKernel::SCALAR;
+	}
+
+	cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	// xmm and ymm state both enabled by the os
+	if (avx && osxsave && (xgetbv0() & 6) == 6)
+	{
+		return WLOPKernel::AVX;
+	}
+	if (sse2)
+	{
+		return WLOPKernel::SSE;
+	}
+	return WLOPKernel::SCALAR;
+}
+
+WLOPKernel::Rows WLOPKernel::rowsOf(const CMesh* mesh, const CNeighborGraph& graph, const CMesh* neighbor_mesh,
+	double radius, double iradius16)
+{
+	Rows rows;
+	rows.points = mesh->arrays.positions.empty() ? NULL : mesh->arrays.positions[0].V();
+	rows.normals = mesh->arrays.normals.empty() ? NULL : mesh->arrays.normals[0].V();
+	rows.neighbors = neighbor_mesh->arrays.positions.empty() ? NULL : neighbor_mesh->arrays.positions[0].V();
+	rows.neighbor_weight = NULL;
+	rows.neighbor_factor = NULL;
+	rows.row_skip = NULL;
+	rows.offsets = graph.isEmpty() ? NULL : &graph.offsets[0];
+	rows.indices = graph.indices.empty() ? NULL : &graph.indices[0];
+	rows.row_num = graph.rowNum();
+	rows.radius = radius;
+	rows.iradius16 = iradius16;
+	return rows;
+}
+
+
+WLOPKernel::Level WLOPKernel::bestLevel()
+{
+	static Level level = detectLevel();
+	return level;
+}
+
+const char* WLOPKernel::levelName(Level level)
+{
+	switch (level)
+	{
+	case AVX: return "AVX";
+	case SSE: return "SSE";
+	default:  return "Scalar";
+	}
+}
+
+
+// the row sums of the vector units onto the points
+static void addRowSums(const std::vector<float>& sums, int row_num, vcg::Point3f* target)
+{
+	for (int i = 0; i < row_num; i++)
+	{
+		target[i] += vcg::Point3f(sums[3 * i], sums[3 * i + 1], sums[3 * i + 2]);
+	}
+}
+
+void WLOPKernel::averageTerm(Level level, const Rows& rows, double average_power, bool anisotropic,
+	vcg::Point3f* average, double* average_weight_sum)
+{
+	if (level == SCALAR)
+	{
+		LOPKernel::averageTerm(rows, average_power, anisotropic, average, average_weight_sum);
+		return;
+	}
+	if (rows.row_num == 0)
+	{
+		return;
+	}
+
+	std::vector<float> sums(3 * rows.row_num, 0.f);
+	if (level == AVX)
+	{
+		averageTermAVX(rows, average_power, anisotropic, &sums[0], average_weight_sum);
+	}
+	else
+	{
+		averageTermSSE(rows, average_power, anisotropic, &sums[0], average_weight_sum);
+	}
+	addRowSums(sums, rows.row_num, average);
+}
+
+void WLOPKernel::repulsionTerm(Level level, const Rows& rows, double repulsion_power,
+	vcg::Point3f* repulsion, double* repulsion_weight_sum)
+{
+	if (level == SCALAR)
+	{
+		LOPKernel::repulsionTerm(rows, repulsion_power, repulsion, repulsion_weight_sum);
+		return;
+	}
+	if (rows.row_num == 0)
+	{
+		return;
+	}
+
+	std::vector<float> sums(3 * rows.row_num, 0.f);
+	if (level == AVX)
+	{
+		repulsionTermAVX(rows, repulsion_power, &sums[0], repulsion_weight_sum);
+	}
+	else
+	{
+		repulsionTermSSE(rows, repulsion_power, &sums[0], repulsion_weight_sum);
+	}
+	addRowSums(sums, rows.row_num, repulsion);
+}
+
+void WLOPKernel::densityTerm(Level level, const Rows& rows, double* density)
+{
+	switch (level)
+	{
+	case AVX:
+		densityTermAVX(rows, density);
+		break;
+	case SSE:
+		densityTermSSE(rows, density);
+		break;
+	default:
+		LOPKernel::densityTerm(rows, density);
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+// no vcg header here: WLOPKernelAVX.cpp includes this file and is built
+// with /arch:AVX. an inline vcg function it instantiated could be the copy
+// the linker keeps for the whole program, and fault on cpus without AVX.
+namespace vcg
+{
+	template <class P3ScalarType> class Point3;
+	typedef Point3<float> Point3f;
+}
+class CMesh;
+class CNeighborGraph;
+
+// the per-pair loops of WLOP (average, repulsion and density terms) in
+// three flavours: the reference scalar double code (LOPKernel.h, also run
+// by Skeletonization), SSE (4 floats) and AVX (8 floats). the vector
+// versions gather the neighbor positions, use a polynomial exp/log and
+// skip pow for the common powers 0, 1, 2.
+//
+// tolerance against the scalar code: the vector versions work in single
+// precision, the weight sums and the summed positions stay within a
+// relative error of 1e-5 (measured below 1e-6 on scans).
+//
+// the neighbors of row i are indices[offsets[i]] ... indices[offsets[i+1]-1],
+// the same layout as CNeighborGraph. the points are x y z floats, the
+// layout of a vcg::Point3f array.
+class WLOPKernel
+{
+public:
+	enum Level
+	{
+		SCALAR = 0,
+		SSE    = 1,
+		AVX    = 2
+	};
+
+	struct Rows
+	{
+		const float* points;            // x y z per row
+		const float* normals;           // x y z per row, only read by the anisotropic average term
+		const float* neighbors;         // x y z of the points the indices point into
+		const double* neighbor_weight;  // per neighbor density factor, NULL for none
+		const double* neighbor_factor;  // second per neighbor factor, applied after it, NULL for none
+		const unsigned char* row_skip;  // rows whose sums are left alone where non zero, NULL for none
+		const int* offsets;
+		const int* indices;
+		int row_num;
+
+		double radius;
+		double iradius16;               // -h / radius^2
+	};
+
+	// rows of graph over the point arrays of mesh, the neighbors are the
+	// arrays of neighbor_mesh. no weights, factors or skipped rows yet
+	static Rows rowsOf(const CMesh* mesh, const CNeighborGraph& graph, const CMesh* neighbor_mesh,
+		double radius, double iradius16);
+
+	// the best level this cpu and os support, detected once
+	static Level bestLevel();
+	static const char* levelName(Level level);
+
+	// average[i] += sum q * w, average_weight_sum[i] += sum w
+	static void averageTerm(Level level, const Rows& rows, double average_power, bool anisotropic,
+		vcg::Point3f* average, double* average_weight_sum);
+
+	// repulsion[i] += sum (p - q) * w, repulsion_weight_sum[i] += sum w
+	static void repulsionTerm(Level level, const Rows& rows, double repulsion_power,
+		vcg::Point3f* repulsion, double* repulsion_weight_sum);
+
+	// density[i] = 1 + sum exp(d^2 * iradius16)
+	static void densityTerm(Level level, const Rows& rows, double* density);
+
+
+	// entry points of the vector translation units, use the functions above.
+	// sums gets the summed vector of each row (x y z per row, it comes in
+	// zeroed and skipped rows are not written), the weight sums are added
+	// to. WLOPKernel.cpp adds sums to the Point3f arrays.
+	static void averageTermSSE(const Rows& rows, double average_power, bool anisotropic, float* sums, double* average_weight_sum);
+	static void repulsionTermSSE(const Rows& rows, double repulsion_power, float* sums, double* repulsion_weight_sum);
+	static void densityTermSSE(const Rows& rows, double* density);
+
+	static void averageTermAVX(const Rows& rows, double average_power, bool anisotropic, float* sums, double* average_weight_sum);
+	static void repulsionTermAVX(const Rows& rows, double repulsion_power, float* sums, double* repulsion_weight_sum);
+	static void densityTermAVX(const Rows& rows, double* density);
+};
@@ -0,0 +1,103 @@
+#include "WLOPKernelSimd.h"
+#include <immintrin.h>
+
+// 8 floats per register. this file is built with /arch:AVX and only
+// entered after WLOPKernel::bestLevel() saw AVX enabled by cpu and os.
+// AVX has no 256 bit integer ops (that is AVX2), the few exponent bit
+// tricks of exp/log run on the two 128 bit halves instead.
+namespace
+{
+	struct AVXVector
+	{
+		typedef __m256 F;
+		enum { W = 8 };
+
+		static F set1(float a) { return _mm256_set1_ps(a); }
+		static F zero() { return _mm256_setzero_ps(); }
+		static F laneIndex() { return _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f); }
+
+		static F add(F a, F b) { return _mm256_add_ps(a, b); }
+		static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+		static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+		static F div(F a, F b) { return _mm256_div_ps(a, b); }
+		static F min(F a, F b) { return _mm256_min_ps(a, b); }
+		static F max(F a, F b) { return _mm256_max_ps(a, b); }
+		static F sqrt(F a) { return _mm256_sqrt_ps(a); }
+
+		static F lessThan(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+		static F andMask(F a, F mask) { return _mm256_and_ps(a, mask); }
+
+		static F floor(F x) { return _mm256_floor_ps(x); }
+
+		// 2^n for integral n
+		static F pow2(F n)
+		{
+			__m256i ni = _mm256_cvttps_epi32(n);
+			__m128i bias = _mm_set1_epi32(127);
+			__m128i lo = _mm_slli_epi32(_mm_add_epi32(_mm256_castsi256_si128(ni), bias), 23);
+			__m128i hi = _mm_slli_epi32(_mm_add_epi32(_mm256_extractf128_si256(ni, 1), bias), 23);
+			return _mm256_castsi256_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1));
+		}
+
+		// mantissa in [0.5, 1) and exponent of a positive x
+		static F frexp(F x, F& e)
+		{
+			__m256i xi = _mm256_castps_si256(x);
+			__m128i bias = _mm_set1_epi32(126);
+			__m128i lo = _mm_sub_epi32(_mm_srli_epi32(_mm256_castsi256_si128(xi), 23), bias);
+			__m128i hi = _mm_sub_epi32(_mm_srli_epi32(_mm256_extractf128_si256(xi, 1), 23), bias);
+			e = _mm256_cvtepi32_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1));
+
+			F mantissa = _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x007fffff)));
+			return _mm256_or_ps(mantissa, _mm256_castsi256_ps(_mm256_set1_epi32(0x3f000000)));
+		}
+
+		static float hsum(F a)
+		{
+			__m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+			float t[4];
+			_mm_storeu_ps(t, s);
+			return (t[0] + t[1]) + (t[2] + t[3]);
+		}
+
+		static void gather3(const float* p, const int* i, F& x, F& y, F& z)
+		{
+			const float* p0 = p + 3 * i[0];
+			const float* p1 = p + 3 * i[1];
+			const float* p2 = p + 3 * i[2];
+			const float* p3 = p + 3 * i[3];
+			const float* p4 = p + 3 * i[4];
+			const float* p5 = p + 3 * i[5];
+			const float* p6 = p + 3 * i[6];
+			const float* p7 = p + 3 * i[7];
+			x = _mm256_setr_ps(p0[0], p1[0], p2[0], p3[0], p4[0], p5[0], p6[0], p7[0]);
+			y = _mm256_setr_ps(p0[1], p1[1], p2[1], p3[1], p4[1], p5[1], p6[1], p7[1]);
+			z = _mm256_setr_ps(p0[2], p1[2], p2[2], p3[2], p4[2], p5[2], p6[2], p7[2]);
+		}
+
+		static F gather(const double* d, const int* i)
+		{
+			return _mm256_setr_ps((float)d[i[0]], (float)d[i[1]], (float)d[i[2]], (float)d[i[3]],
+				(float)d[i[4]], (float)d[i[5]], (float)d[i[6]], (float)d[i[7]]);
+		}
+
+		// leave no dirty upper halves behind for the sse code of the caller
+		static void finish() { _mm256_zeroupper(); }
+	};
+}
+
+
+void WLOPKernel::averageTermAVX(const Rows& rows, double average_power, bool anisotropic, float* sums, double* average_weight_sum)
+{
+	averageRows<AVXVector>(rows, average_power, anisotropic, sums, average_weight_sum);
+}
+
+void WLOPKernel::repulsionTermAVX(const Rows& rows, double repulsion_power, float* sums, double* repulsion_weight_sum)
+{
+	repulsionRows<AVXVector>(rows, repulsion_power, sums, repulsion_weight_sum);
+}
+
+void WLOPKernel::densityTermAVX(const Rows& rows, double* density)
+{
+	densityRows<AVXVector>(rows, density);
+}
@@ -0,0 +1,90 @@
+#include "WLOPKernelSimd.h"
+#include <emmintrin.h>
+
+// 4 floats per register, SSE2 only (every x64 cpu has it)
+namespace
+{
+	struct SSEVector
+	{
+		typedef __m128 F;
+		enum { W = 4 };
+
+		static F set1(float a) { return _mm_set1_ps(a); }
+		static F zero() { return _mm_setzero_ps(); }
+		static F laneIndex() { return _mm_setr_ps(0.f, 1.f, 2.f, 3.f); }
+
+		static F add(F a, F b) { return _mm_add_ps(a, b); }
+		static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+		static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+		static F div(F a, F b) { return _mm_div_ps(a, b); }
+		static F min(F a, F b) { return _mm_min_ps(a, b); }
+		static F max(F a, F b) { return _mm_max_ps(a, b); }
+		static F sqrt(F a) { return _mm_sqrt_ps(a); }
+
+		static F lessThan(F a, F b) { return _mm_cmplt_ps(a, b); }
+		static F andMask(F a, F mask) { return _mm_and_ps(a, mask); }
+
+		static F floor(F x)
+		{
+			F t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+			return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.f)));
+		}
+
+		// 2^n for integral n
+		static F pow2(F n)
+		{
+			__m128i e = _mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127));
+			return _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+		}
+
+		// mantissa in [0.5, 1) and exponent of a positive x
+		static F frexp(F x, F& e)
+		{
+			__m128i xi = _mm_castps_si128(x);
+			e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(xi, 23), _mm_set1_epi32(126)));
+			xi = _mm_or_si128(_mm_and_si128(xi, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f000000));
+			return _mm_castsi128_ps(xi);
+		}
+
+		static float hsum(F a)
+		{
+			float t[4];
+			_mm_storeu_ps(t, a);
+			return (t[0] + t[1]) + (t[2] + t[3]);
+		}
+
+		static void gather3(const float* p, const int* i, F& x, F& y, F& z)
+		{
+			const float* p0 = p + 3 * i[0];
+			const float* p1 = p + 3 * i[1];
+			const float* p2 = p + 3 * i[2];
+			const float* p3 = p + 3 * i[3];
+			x = _mm_setr_ps(p0[0], p1[0], p2[0], p3[0]);
+			y = _mm_setr_ps(p0[1], p1[1], p2[1], p3[1]);
+			z = _mm_setr_ps(p0[2], p1[2], p2[2], p3[2]);
+		}
+
+		static F gather(const double* d, const int* i)
+		{
+			return _mm_setr_ps((float)d[i[0]], (float)d[i[1]], (float)d[i[2]], (float)d[i[3]]);
+		}
+
+		static void finish() {}
+	};
+}
+
+
+void WLOPKernel::averageTermSSE(const Rows& rows, double average_power, bool anisotropic, float* sums, double* average_weight_sum)
+{
+	averageRows<SSEVector>(rows, average_power, anisotropic, sums, average_weight_sum);
+}
+
+void WLOPKernel::repulsionTermSSE(const Rows& rows, double repulsion_power, float* sums, double* repulsion_weight_sum)
+{
+	repulsionRows<SSEVector>(rows, repulsion_power, sums, repulsion_weight_sum);
+}
+
+void WLOPKernel::densityTermSSE(const Rows& rows, double* density)
+{
+	densityRows<SSEVector>(rows, density);
+}
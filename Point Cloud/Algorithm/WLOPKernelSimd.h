@@ -0,0 +1,321 @@
+#pragma once
+#include "WLOPKernel.h"
+
+// the vector loops of WLOPKernel written once over a register type V.
+// only included by WLOPKernelSSE.cpp and WLOPKernelAVX.cpp, each of them
+// provides its V (register type, width, load/arith/compare primitives)
+// and is compiled with the matching instruction set. nothing here may
+// use an inline function shared with other units (vcg, std), the points
+// and sums are plain float and double arrays. like the scalar loops of
+// LOPKernel.h the rows are split over the threads and every row only
+// writes its own sums.
+
+namespace
+{
+	enum PowerCase
+	{
+		POWER_0,     // len^0 = 1, no work at all
+		POWER_1,     // 1 / len
+		POWER_2,     // 1 / len^2
+		POWER_ANY    // exp(-e * log(len))
+	};
+
+	PowerCase powerCase(double e)
+	{
+		if (e == 0) return POWER_0;
+		if (e == 1) return POWER_1;
+		if (e == 2) return POWER_2;
+		return POWER_ANY;
+	}
+
+	// cephes expf, good to ~2 ulp over the range we use (x <= 0)
+	template <class V>
+	inline typename V::F vecExp(typename V::F x)
+	{
+		typedef typename V::F F;
+		x = V::min(V::max(x, V::set1(-87.33654f)), V::set1(88.72283f));
+
+		F fx = V::floor(V::add(V::mul(x, V::set1(1.44269504088896341f)), V::set1(0.5f)));
+		x = V::sub(x, V::mul(fx, V::set1(0.693359375f)));
+		x = V::sub(x, V::mul(fx, V::set1(-2.12194440e-4f)));
+
+		F z = V::mul(x, x);
+		F y = V::set1(1.9875691500E-4f);
+		y = V::add(V::mul(y, x), V::set1(1.3981999507E-3f));
+		y = V::add(V::mul(y, x), V::set1(8.3334519073E-3f));
+		y = V::add(V::mul(y, x), V::set1(4.1665795894E-2f));
+		y = V::add(V::mul(y, x), V::set1(1.6666665459E-1f));
+		y = V::add(V::mul(y, x), V::set1(5.0000001201E-1f));
+		y = V::add(V::add(V::mul(y, z), x), V::set1(1.f));
+
+		return V::mul(y, V::pow2(fx));
+	}
+
+	// cephes logf, x must be positive and normal
+	template <class V>
+	inline typename V::F vecLog(typename V::F x)
+	{
+		typedef typename V::F F;
+		F e;
+		F m = V::frexp(x, e);  // x = m * 2^e, m in [0.5, 1)
+
+		F small = V::lessThan(m, V::set1(0.707106781186547524f));
+		e = V::sub(e, V::andMask(V::set1(1.f), small));
+		m = V::sub(V::add(m, V::andMask(m, small)), V::set1(1.f));
+
+		F z = V::mul(m, m);
+		F y = V::set1(7.0376836292E-2f);
+		y = V::add(V::mul(y, m), V::set1(-1.1514610310E-1f));
+		y = V::add(V::mul(y, m), V::set1(1.1676998740E-1f));
+		y = V::add(V::mul(y, m), V::set1(-1.2420140846E-1f));
+		y = V::add(V::mul(y, m), V::set1(1.4249322787E-1f));
+		y = V::add(V::mul(y, m), V::set1(-1.6668057665E-1f));
+		y = V::add(V::mul(y, m), V::set1(2.0000714765E-1f));
+		y = V::add(V::mul(y, m), V::set1(-2.4999993993E-1f));
+		y = V::add(V::mul(y, m), V::set1(3.3333331174E-1f));
+		y = V::mul(V::mul(y, m), z);
+
+		y = V::add(y, V::mul(e, V::set1(-2.12194440e-4f)));
+		y = V::sub(y, V::mul(z, V::set1(0.5f)));
+		return V::add(V::add(m, y), V::mul(e, V::set1(0.693359375f)));
+	}
+
+	// 1 / len^e
+	template <class V>
+	inline typename V::F vecInvPow(PowerCase power_case, typename V::F len, typename V::F minus_e)
+	{
+		switch (power_case)
+		{
+		case POWER_0:
+			return V::set1(1.f);
+		case POWER_1:
+			return V::div(V::set1(1.f), len);
+		case POWER_2:
+			return V::div(V::set1(1.f), V::mul(len, len));
+		default:
+			return vecExp<V>(V::mul(minus_e, vecLog<V>(len)));
+		}
+	}
+
+	// indices of the block starting at k, the lanes past the row end
+	// repeat the first neighbor and get masked out by the caller
+	template <class V>
+	inline const int* blockIndices(const int* indices, int k, int count, int* padded)
+	{
+		if (count == V::W)
+		{
+			return indices + k;
+		}
+		for (int l = 0; l < V::W; l++)
+		{
+			padded[l] = indices[k + (l < count ? l : 0)];
+		}
+		return padded;
+	}
+
+	template <class V>
+	void averageRows(const WLOPKernel::Rows& rows, double average_power, bool anisotropic,
+		float* sums, double* average_weight_sum)
+	{
+		typedef typename V::F F;
+
+		// same cases as the scalar code: the isotropic term only divides by len when power < 2
+		bool use_len = anisotropic || average_power < 2;
+		PowerCase power_case = use_len ? powerCase(2 - average_power) : POWER_0;
+
+		F iradius16 = V::set1((float)rows.iradius16);
+		F min_len = V::set1((float)(0.001 * rows.radius));
+		F minus_e = V::set1((float)-(2 - average_power));
+		F lanes = V::laneIndex();
+
+#pragma omp parallel for schedule(dynamic, 64)
+		for (int i = 0; i < rows.row_num; i++)
+		{
+			int begin = rows.offsets[i];
+			int end = rows.offsets[i+1];
+			if (begin == end || (rows.row_skip && rows.row_skip[i]))
+			{
+				continue;
+			}
+
+			const float* p = rows.points + 3 * i;
+			F px = V::set1(p[0]), py = V::set1(p[1]), pz = V::set1(p[2]);
+			F nx = V::zero(), ny = V::zero(), nz = V::zero();
+			if (anisotropic)
+			{
+				const float* n = rows.normals + 3 * i;
+				nx = V::set1(n[0]); ny = V::set1(n[1]); nz = V::set1(n[2]);
+			}
+
+			F sx = V::zero(), sy = V::zero(), sz = V::zero(), sw = V::zero();
+			for (int k = begin; k < end; k += V::W)
+			{
+				int count = end - k < V::W ? end - k : V::W;
+				int padded[V::W];
+				const int* idx = blockIndices<V>(rows.indices, k, count, padded);
+
+				F qx, qy, qz;
+				V::gather3(rows.neighbors, idx, qx, qy, qz);
+				F dx = V::sub(px, qx), dy = V::sub(py, qy), dz = V::sub(pz, qz);
+				F dist2 = V::add(V::add(V::mul(dx, dx), V::mul(dy, dy)), V::mul(dz, dz));
+
+				F w;
+				if (anisotropic)
+				{
+					F hn = V::add(V::add(V::mul(dx, nx), V::mul(dy, ny)), V::mul(dz, nz));
+					w = vecExp<V>(V::mul(V::mul(hn, hn), iradius16));
+				}
+				else
+				{
+					w = vecExp<V>(V::mul(dist2, iradius16));
+				}
+
+				if (power_case != POWER_0)
+				{
+					F len = V::max(V::sqrt(dist2), min_len);
+					w = V::mul(w, vecInvPow<V>(power_case, len, minus_e));
+				}
+				if (rows.neighbor_weight)
+				{
+					w = V::mul(w, V::gather(rows.neighbor_weight, idx));
+				}
+				if (rows.neighbor_factor)
+				{
+					w = V::mul(w, V::gather(rows.neighbor_factor, idx));
+				}
+				if (count < V::W)
+				{
+					w = V::andMask(w, V::lessThan(lanes, V::set1((float)count)));
+				}
+
+				sx = V::add(sx, V::mul(qx, w));
+				sy = V::add(sy, V::mul(qy, w));
+				sz = V::add(sz, V::mul(qz, w));
+				sw = V::add(sw, w);
+			}
+
+			sums[3 * i] = V::hsum(sx);
+			sums[3 * i + 1] = V::hsum(sy);
+			sums[3 * i + 2] = V::hsum(sz);
+			average_weight_sum[i] += V::hsum(sw);
+		}
+		V::finish();
+	}
+
+	template <class V>
+	void repulsionRows(const WLOPKernel::Rows& rows, double repulsion_power,
+		float* sums, double* repulsion_weight_sum)
+	{
+		typedef typename V::F F;
+
+		PowerCase power_case = powerCase(repulsion_power);
+
+		F iradius16 = V::set1((float)rows.iradius16);
+		F min_len = V::set1((float)(0.001 * rows.radius));
+		F minus_e = V::set1((float)-repulsion_power);
+		F lanes = V::laneIndex();
+
+#pragma omp parallel for schedule(dynamic, 64)
+		for (int i = 0; i < rows.row_num; i++)
+		{
+			int begin = rows.offsets[i];
+			int end = rows.offsets[i+1];
+			if (begin == end || (rows.row_skip && rows.row_skip[i]))
+			{
+				continue;
+			}
+
+			const float* p = rows.points + 3 * i;
+			F px = V::set1(p[0]), py = V::set1(p[1]), pz = V::set1(p[2]);
+
+			F sx = V::zero(), sy = V::zero(), sz = V::zero(), sw = V::zero();
+			for (int k = begin; k < end; k += V::W)
+			{
+				int count = end - k < V::W ? end - k : V::W;
+				int padded[V::W];
+				const int* idx = blockIndices<V>(rows.indices, k, count, padded);
+
+				F qx, qy, qz;
+				V::gather3(rows.neighbors, idx, qx, qy, qz);
+				F dx = V::sub(px, qx), dy = V::sub(py, qy), dz = V::sub(pz, qz);
+				F dist2 = V::add(V::add(V::mul(dx, dx), V::mul(dy, dy)), V::mul(dz, dz));
+				F len = V::max(V::sqrt(dist2), min_len);
+
+				F w = vecExp<V>(V::mul(dist2, iradius16));
+				if (power_case != POWER_0)
+				{
+					w = V::mul(w, vecInvPow<V>(power_case, len, minus_e));
+				}
+				if (rows.neighbor_weight)
+				{
+					w = V::mul(w, V::gather(rows.neighbor_weight, idx));
+				}
+				if (rows.neighbor_factor)
+				{
+					w = V::mul(w, V::gather(rows.neighbor_factor, idx));
+				}
+				if (count < V::W)
+				{
+					w = V::andMask(w, V::lessThan(lanes, V::set1((float)count)));
+				}
+
+				sx = V::add(sx, V::mul(dx, w));
+				sy = V::add(sy, V::mul(dy, w));
+				sz = V::add(sz, V::mul(dz, w));
+				sw = V::add(sw, w);
+			}
+
+			sums[3 * i] = V::hsum(sx);
+			sums[3 * i + 1] = V::hsum(sy);
+			sums[3 * i + 2] = V::hsum(sz);
+			repulsion_weight_sum[i] += V::hsum(sw);
+		}
+		V::finish();
+	}
+
+	template <class V>
+	void densityRows(const WLOPKernel::Rows& rows, double* density)
+	{
+		typedef typename V::F F;
+
+		F iradius16 = V::set1((float)rows.iradius16);
+		F lanes = V::laneIndex();
+
+#pragma omp parallel for schedule(dynamic, 64)
+		for (int i = 0; i < rows.row_num; i++)
+		{
+			int begin = rows.offsets[i];
+			int end = rows.offsets[i+1];
+			if (rows.row_skip && rows.row_skip[i])
+			{
+				continue;
+			}
+
+			const float* p = rows.points + 3 * i;
+			F px = V::set1(p[0]), py = V::set1(p[1]), pz = V::set1(p[2]);
+
+			F sum = V::zero();
+			for (int k = begin; k < end; k += V::W)
+			{
+				int count = end - k < V::W ? end - k : V::W;
+				int padded[V::W];
+				const int* idx = blockIndices<V>(rows.indices, k, count, padded);
+
+				F qx, qy, qz;
+				V::gather3(rows.neighbors, idx, qx, qy, qz);
+				F dx = V::sub(px, qx), dy = V::sub(py, qy), dz = V::sub(pz, qz);
+				F dist2 = V::add(V::add(V::mul(dx, dx), V::mul(dy, dy)), V::mul(dz, dz));
+
+				F den = vecExp<V>(V::mul(dist2, iradius16));
+				if (count < V::W)
+				{
+					den = V::andMask(den, V::lessThan(lanes, V::set1((float)count)));
+				}
+				sum = V::add(sum, den);
+			}
+
+			density[i] = 1. + V::hsum(sum);
+		}
+		V::finish();
+	}
+}
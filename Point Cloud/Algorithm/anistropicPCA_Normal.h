@@ -40,7 +40,8 @@
 #include <stdlib.h>
 
 //#include "KnnNeighbor.h"
-#include "cmesh.h"
+#include "CMesh.h"
+#include "GlobalFunction.h"
 
 
 template < class VERTEX_CONTAINER >
@@ -56,6 +57,25 @@ public:
 	typedef typename vcg::Box3< ScalarType >			 BoundingBoxType;
 	typedef typename vcg::Matrix33<ScalarType>  	 MatrixType;
 
+private:
+	// Dummy class: no object marker is needed
+	class DummyObjectMarker {};
+
+	// Object functor: compute the distance between a vertex and a point
+	struct VertPointDistanceFunctor
+	{
+		inline bool operator()(const VertexType &v, const CoordType &p, ScalarType &d, CoordType &q) const
+		{
+			ScalarType distance = vcg::Distance(p, v.P());
+			if (distance>d)
+				return false;
+
+			d = distance;
+			q = v.P();
+			return true;
+		}
+	};
+
 public:
 
 	//static void ConvertCMesh2CMeshO(const CMesh &cmesh, CMeshO &cmeshO)
@@ -95,72 +115,59 @@ public:
 
 	static void ComputeAPcaNormalsByKNN(const VertexIterator& begin, const VertexIterator& end, const unsigned int k, double radius, const float sigma)
 	{
-		vector<vector<int> > neighborMap;
-		neighborMap.assign(end - begin, vector<int>());
-
-		int curr_index = 0;
-		for (VertexIterator iter=begin; iter!=end; iter++, curr_index++)
-		{
-			if(iter->neighbors.empty())
-				continue;
-
-			for(int j = 0; j < iter->neighbors.size(); j++)
-			{
-				neighborMap[curr_index].push_back(iter->neighbors[j]);
-			}
-		}
-
+		int vert_num = end - begin;
+		vector<double> covariances(vert_num * 6, 0.0);
 
 		double radius2 = radius*radius;
 		double iradius16 = -4/radius2; 
+		double sigma_term = pow(max(1e-8,1-cos(sigma /180.0*3.1415926)), 2);
 
-		int currIndex = 0;
-		for (VertexIterator iter=begin; iter!=end; iter++, currIndex++)
+#pragma omp parallel for
+		for (int currIndex = 0; currIndex < vert_num; currIndex++)
 		{
-			MatrixType	covariance_matrix;
-			CoordType diff;
-			covariance_matrix.SetZero();
-			int neighborIndex = -1;
+			VertexIterator iter = begin + currIndex;
+			double* covariance = &covariances[currIndex * 6];
+
 			int neighbor_size = iter->neighbors.size();
-			for (unsigned int n=0; n<neighbor_size; n++)
+			for (int n=0; n<neighbor_size; n++)
 			{
-				neighborIndex = neighborMap[currIndex][n];
+				int neighborIndex = iter->neighbors[n];
 				if(neighborIndex < 0)
 					break;
 				VertexIterator neighborIter = begin + neighborIndex;
 
-				diff = iter->P() - neighborIter->P();
+				CoordType diff = iter->P() - neighborIter->P();
 
 				Point3f vm = iter->N();
 				Point3f tm = neighborIter->N();
-				double psi = exp(-pow(1-vm*tm, 2)/pow(max(1e-8,1-cos(sigma /180.0*3.1415926)), 2));
+				double psi = exp(-pow(1-vm*tm, 2)/sigma_term);
 
 				double dist2 = diff.SquaredNorm();
 				double theta = exp(dist2*iradius16);
-
-				for (int i=0; i<3; i++)
-					for (int j=0; j<3; j++)
-						covariance_matrix[i][j]+= theta * psi * diff[i]*diff[j];
+				double w = theta * psi;
+
+				covariance[0] += w * diff[0] * diff[0];
+				covariance[1] += w * diff[0] * diff[1];
+				covariance[2] += w * diff[0] * diff[2];
+				covariance[3] += w * diff[1] * diff[1];
+				covariance[4] += w * diff[1] * diff[2];
+				covariance[5] += w * diff[2] * diff[2];
 			}
+		}
 
-			/*cout << "tset1: " << currIndex <<endl;*/
-
-			CoordType   eigenvalues;
-			MatrixType	eigenvectors;
-			int required_rotations;
-			vcg::Jacobi< MatrixType, CoordType >(covariance_matrix, eigenvalues, eigenvectors, required_rotations);
-			vcg::SortEigenvaluesAndEigenvectors< MatrixType, CoordType >(eigenvalues, eigenvectors);
-
+		vector<double> eigenvalues;
+		vector<Point3f> eigenvectors;
+		GlobalFun::solveEigenBatch(covariances, eigenvalues, eigenvectors);
 
-			Point3f normal;
-			for (int d=0; d<3; d++)
-				normal[d] = eigenvectors[d][2];
-			normal.Normalize();
+		// every normal is read by the neighbors above, so they are written after the solve
+		for (int currIndex = 0; currIndex < vert_num; currIndex++)
+		{
+			VertexIterator iter = begin + currIndex;
+			Point3f normal = eigenvectors[currIndex * 3 + 2];
 
 			if(iter->N() * normal < 0)
 			{
-				for (int d=0; d<3; d++)
-					normal[d] *= -1;
+				normal *= -1;
 			}
 			iter->N() = normal;
 		}
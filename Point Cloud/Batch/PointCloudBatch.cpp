@@ -0,0 +1,415 @@
+// runs the point cloud algorithms without GLArea/GLDrawer, so scans can be
+// processed in batch jobs and the algorithms profiled without the gui.
+//
+//   PointCloudBatch [-samples file] [-original file] [-para file] step ...
+//
+// input files are .ply or .xyz (x y z nx ny nz per line). the parameter file
+// is described at ParameterMgr::loadParameterFile(). it is applied after
+// loading and again after every step that resets the radius to the initial
+// radius of the data (subsample, downsample). given before the files it is
+// also applied to their loading, e.g. "Use Point Cloud Cache = true" reads
+// and writes file.ply.pcache / file.xyz.pcache next to them.
+// "Density Cache Directory = dir" keeps the densities of the original that
+// wlop and skeleton compute in their first iteration in dir for the next runs.
+//
+// steps, run in the given order:
+//   subsample               the samples become the original, then downsample
+//   downsample              samples are "Down Sample Num" random original points
+//   normalize               scale the data into the unit box
+//   wlop                    "Num Of Iterate Time" WLOP iterations
+//   skeleton                skeletonization until the process stops
+//   smooth                  "Number Of Iterate" normal smoothing passes
+//   upsample                one upsampling run
+//   save=file.ply           write the samples
+//   saveoriginal=file.ply   write the original
+//   saveskel=file.skel      write the skeleton, binary for file.bskel
+//   loadskel=file.skel      read samples, original and skeleton, text or binary
+//   loadcurves=file.bskel   read only the skeleton of a binary file
+//
+// "loadskel=a.skel saveskel=a.bskel" converts between the two skeleton formats.
+//
+// it links QtCore only. on linux, with the Qt 4 development files installed:
+//   cmake -S "Point Cloud/Batch" -B build && cmake --build build -j
+// PointCloudBatch.vcxproj is the windows build.
+#include "Algorithm/WLOP.h"
+#include "Algorithm/Skeletonization.h"
+#include "Algorithm/NormalSmoother.h"
+#include "Algorithm/Upsampler.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <ctime>
+using namespace std;
+
+
+class BatchRunner
+{
+public:
+	BatchRunner()
+		: dataMgr(global_paraMgr.getDataParameterSet()),
+		  wlop(global_paraMgr.getWLopParameterSet()),
+		  norSmoother(global_paraMgr.getNormalSmootherParameterSet()),
+		  skeletonization(global_paraMgr.getSkeletonParameterSet()),
+		  upsampler(global_paraMgr.getUpsamplingParameterSet())
+	{
+	}
+
+	bool load(const string& fileName, bool toOriginal);
+	bool loadParameters();
+	bool runStep(const string& step);
+
+public:
+	string para_file;
+
+private:
+	void runPointCloudAlgorithm(PointCloudAlgorithm& algorithm);
+	void initAfterLoad();
+
+	bool runWlop();
+	bool runSkeletonization();
+	bool runNormalSmoothing();
+	bool runUpsampling();
+
+private:
+	DataMgr dataMgr;
+	WLOP wlop;
+	NormalSmoother norSmoother;
+	Skeletonization skeletonization;
+	Upsampler upsampler;
+};
+
+
+static bool endsWith(const string& str, const string& end)
+{
+	return str.size() >= end.size() && str.compare(str.size() - end.size(), end.size(), end) == 0;
+}
+
+
+bool BatchRunner::load(const string& fileName, bool toOriginal)
+{
+	QString file(fileName.c_str());
+
+	if (endsWith(fileName, ".ply"))
+	{
+		if (toOriginal)
+		{
+			dataMgr.loadPlyToOriginal(file);
+		}
+		else
+		{
+			dataMgr.loadPlyToSample(file);
+		}
+	}
+	else if (endsWith(fileName, ".xyz") || endsWith(fileName, ".xyzn"))
+	{
+		// DataMgr only reads xyz into the samples
+		if (toOriginal)
+		{
+			CMesh kept_samples;
+			kept_samples.vert.swap(dataMgr.samples.vert);
+			kept_samples.bbox = dataMgr.samples.bbox;
+
+			dataMgr.loadXYZN(file);
+			dataMgr.original.vert.swap(dataMgr.samples.vert);
+			dataMgr.original.vn = dataMgr.original.vert.size();
+			dataMgr.original.bbox = dataMgr.samples.bbox;
+			for (int i = 0; i < dataMgr.original.vn; i++)
+			{
+				dataMgr.original.vert[i].bIsOriginal = true;
+			}
+
+			dataMgr.samples.vert.swap(kept_samples.vert);
+			dataMgr.samples.vn = dataMgr.samples.vert.size();
+			dataMgr.samples.bbox = kept_samples.bbox;
+		}
+		else
+		{
+			dataMgr.loadXYZN(file);
+		}
+	}
+	else
+	{
+		cout << "ERROR: unknown file type " << fileName << endl;
+		return false;
+	}
+
+	CMesh& mesh = toOriginal ? dataMgr.original : dataMgr.samples;
+	if (mesh.vert.empty())
+	{
+		cout << "ERROR: no points read from " << fileName << endl;
+		return false;
+	}
+	cout << mesh.vn << " points loaded from " << fileName << endl;
+
+	initAfterLoad();
+	return true;
+}
+
+// what GLArea::initAfterOpenFile() does, without the view
+void BatchRunner::initAfterLoad()
+{
+	dataMgr.getInitRadiuse();
+	dataMgr.recomputeQuad();
+	dataMgr.recomputeBox();
+	wlop.setFirstIterate();
+}
+
+bool BatchRunner::loadParameters()
+{
+	if (para_file.empty())
+	{
+		return true;
+	}
+	return global_paraMgr.loadParameterFile(QString(para_file.c_str()));
+}
+
+
+void BatchRunner::runPointCloudAlgorithm(PointCloudAlgorithm& algorithm)
+{
+	QString name = algorithm.getParameterSet()->getString("Algorithm Name");
+	cout << "*********************************** Start  " << name.toStdString() << "  ***********************************" << endl;
+	clock_t starttime = clock();
+
+	algorithm.setInput(&dataMgr);
+	algorithm.run();
+	algorithm.clear();
+
+	double memory_mb, peak_memory_mb;
+	GlobalFun::getMemoryUsage(memory_mb, peak_memory_mb);
+	cout << "time used:  " << double(clock() - starttime) / CLOCKS_PER_SEC << " seconds, memory: "
+		<< memory_mb << " MB, peak memory: " << peak_memory_mb << " MB" << endl;
+	cout << "*********************************** End  " << name.toStdString() << "  ***********************************" << endl;
+	cout << endl;
+}
+
+bool BatchRunner::runWlop()
+{
+	if (dataMgr.isOriginalEmpty())
+	{
+		dataMgr.subSamples();
+		if (!loadParameters())
+		{
+			return false;
+		}
+	}
+	if (dataMgr.isSamplesEmpty())
+	{
+		cout << "ERROR: wlop: no samples" << endl;
+		return false;
+	}
+
+	for (int i = 0; i < global_paraMgr.wLop.getDouble("Num Of Iterate Time"); i++)
+	{
+		runPointCloudAlgorithm(wlop);
+	}
+	return true;
+}
+
+// the loop of GLArea::runSkeletonization_paralleled()
+bool BatchRunner::runSkeletonization()
+{
+	if (dataMgr.isOriginalEmpty() || dataMgr.isSamplesEmpty())
+	{
+		cout << "ERROR: skeleton: needs samples and original" << endl;
+		return false;
+	}
+
+	RichParameterSet& skeleton = global_paraMgr.skeleton;
+	skeleton.setValue("The Skeletonlization Process Should Stop", BoolValue(false));
+	skeleton.setValue("Initial Radius", DoubleValue(skeleton.getDouble("CGrid Radius")));
+
+	int MAX_SKELETON_ITERATE = 500;
+	for (int i = 0; i < MAX_SKELETON_ITERATE; i++)
+	{
+		skeleton.setValue("Run Auto Wlop One Step", BoolValue(true));
+		runPointCloudAlgorithm(skeletonization);
+
+		if (skeleton.getBool("The Skeletonlization Process Should Stop"))
+		{
+			break;
+		}
+	}
+	return true;
+}
+
+bool BatchRunner::runNormalSmoothing()
+{
+	if (dataMgr.isSamplesEmpty())
+	{
+		cout << "ERROR: smooth: no samples" << endl;
+		return false;
+	}
+
+	int iterate_time = norSmoother.iteratesInRun() ? 1 : global_paraMgr.norSmooth.getInt("Number Of Iterate");
+	for (int i = 0; i < iterate_time; i++)
+	{
+		runPointCloudAlgorithm(norSmoother);
+	}
+	return true;
+}
+
+bool BatchRunner::runUpsampling()
+{
+	if (dataMgr.isSamplesEmpty())
+	{
+		cout << "ERROR: upsample: no samples" << endl;
+		return false;
+	}
+
+	runPointCloudAlgorithm(upsampler);
+	return true;
+}
+
+
+bool BatchRunner::runStep(const string& step)
+{
+	size_t equal = step.find('=');
+	string name = step.substr(0, equal);
+	string file = (equal == string::npos) ? string() : step.substr(equal + 1);
+
+	Timer time;
+	time.start(step);
+	bool ok = true;
+
+	if (name == "subsample" || name == "downsample")
+	{
+		if (name == "subsample")
+		{
+			dataMgr.subSamples();
+		}
+		else
+		{
+			dataMgr.downSamplesByNum();
+		}
+		dataMgr.skeleton.clear();
+		dataMgr.recomputeQuad();
+		dataMgr.recomputeBox();
+		wlop.setFirstIterate();
+		ok = !dataMgr.isSamplesEmpty() && loadParameters();
+	}
+	else if (name == "normalize")
+	{
+		dataMgr.normalizeAllMesh();
+		wlop.setFirstIterate();
+	}
+	else if (name == "wlop")
+	{
+		ok = runWlop();
+	}
+	else if (name == "skeleton")
+	{
+		ok = runSkeletonization();
+	}
+	else if (name == "smooth")
+	{
+		ok = runNormalSmoothing();
+	}
+	else if (name == "upsample")
+	{
+		ok = runUpsampling();
+	}
+	else if (name == "save" && !file.empty())
+	{
+		dataMgr.eraseRemovedSamples();
+		dataMgr.savePly(QString(file.c_str()), *dataMgr.getCurrentSamples());
+	}
+	else if (name == "saveoriginal" && !file.empty())
+	{
+		dataMgr.savePly(QString(file.c_str()), *dataMgr.getCurrentOriginal());
+	}
+	else if (name == "saveskel" && !file.empty())
+	{
+		dataMgr.saveSkeletonAsSkel(QString(file.c_str()));
+	}
+	else if (name == "loadskel" && !file.empty())
+	{
+		dataMgr.loadSkeletonFromSkel(QString(file.c_str()));
+		ok = !dataMgr.isSamplesEmpty();
+		if (ok)
+		{
+			initAfterLoad();
+		}
+	}
+	else if (name == "loadcurves" && !file.empty())
+	{
+		ok = dataMgr.loadCurvesFromSkel(QString(file.c_str()));
+	}
+	else
+	{
+		cout << "ERROR: unknown step " << step << endl;
+		ok = false;
+	}
+
+	time.end();
+	return ok;
+}
+
+
+static void printUsage()
+{
+	cout << "usage: PointCloudBatch [-samples file] [-original file] [-para file] step ..." << endl;
+	cout << "  files: .ply or .xyz" << endl;
+	cout << "  steps: subsample downsample normalize wlop skeleton smooth upsample" << endl;
+	cout << "         save=file.ply saveoriginal=file.ply saveskel=file.skel|file.bskel" << endl;
+	cout << "         loadskel=file.skel|file.bskel loadcurves=file.bskel" << endl;
+}
+
+int main(int argc, char** argv)
+{
+	BatchRunner runner;
+	vector<string> steps;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "-samples" && has_value)
+		{
+			if (!runner.load(argv[++i], false))
+				return 1;
+		}
+		else if (arg == "-original" && has_value)
+		{
+			if (!runner.load(argv[++i], true))
+				return 1;
+		}
+		else if (arg == "-para" && has_value)
+		{
+			runner.para_file = argv[++i];
+			if (!runner.loadParameters())
+				return 1;
+		}
+		else if (!arg.empty() && arg[0] == '-')
+		{
+			printUsage();
+			return 1;
+		}
+		else
+		{
+			steps.push_back(arg);
+		}
+	}
+
+	if (steps.empty())
+	{
+		printUsage();
+		return 1;
+	}
+
+	if (!runner.loadParameters())
+	{
+		return 1;
+	}
+
+	for (int i = 0; i < steps.size(); i++)
+	{
+		if (!runner.runStep(steps[i]))
+		{
+			cout << "ERROR: step " << steps[i] << " failed" << endl;
+			return 1;
+		}
+	}
+	return 0;
+}
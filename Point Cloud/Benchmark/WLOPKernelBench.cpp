@@ -0,0 +1,196 @@
+// micro benchmark of the WLOP pair kernels (Algorithm/WLOPKernel.h).
+// runs every kernel at every level this cpu supports on a synthetic
+// jittered sheet of points, prints pairs per second and the largest
+// relative error of the vector levels against the scalar code.
+//
+//   WLOPKernelBench [points] [neighbors per point]
+//
+// the kernels run on OMP_NUM_THREADS threads, the times are wall clock.
+#include "../Algorithm/WLOPKernel.h"
+#include <vcg/space/point3.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <omp.h>
+using namespace std;
+using vcg::Point3f;
+
+struct Cloud
+{
+	vector<Point3f> points;
+	vector<Point3f> normals;
+	vector<double> weight;
+	vector<int> offsets;
+	vector<int> indices;
+	double radius;
+};
+
+// side x side lattice with a little noise, neighbors are the lattice
+// points inside the radius, found from the lattice coordinates
+static void makeCloud(int point_num, int neighbor_num, Cloud& cloud)
+{
+	int side = (int)sqrt((double)point_num);
+	srand(1);
+
+	cloud.points.resize(side * side);
+	cloud.normals.resize(side * side);
+	cloud.weight.resize(side * side);
+	for (int i = 0; i < side; i++)
+	{
+		for (int j = 0; j < side; j++)
+		{
+			float jx = (rand() % 1000) / 5000.f;
+			float jy = (rand() % 1000) / 5000.f;
+			float jz = (rand() % 1000) / 5000.f;
+			cloud.points[i * side + j] = Point3f(i + jx, j + jy, jz);
+			cloud.normals[i * side + j] = Point3f(0, 0, 1);
+			cloud.weight[i * side + j] = 0.5 + (rand() % 1000) / 1000.0;
+		}
+	}
+
+	// pi r^2 = neighbor_num on a unit lattice
+	cloud.radius = sqrt(neighbor_num / 3.14159265);
+	int reach = (int)ceil(cloud.radius) + 1;
+	double radius2 = cloud.radius * cloud.radius;
+
+	cloud.offsets.assign(1, 0);
+	cloud.indices.clear();
+	for (int i = 0; i < side; i++)
+	{
+		for (int j = 0; j < side; j++)
+		{
+			const Point3f& p = cloud.points[i * side + j];
+			for (int a = max(0, i - reach); a <= min(side - 1, i + reach); a++)
+			{
+				for (int b = max(0, j - reach); b <= min(side - 1, j + reach); b++)
+				{
+					int t = a * side + b;
+					if (t != i * side + j && (p - cloud.points[t]).SquaredNorm() < radius2)
+					{
+						cloud.indices.push_back(t);
+					}
+				}
+			}
+			cloud.offsets.push_back((int)cloud.indices.size());
+		}
+	}
+}
+
+static WLOPKernel::Rows makeRows(const Cloud& cloud)
+{
+	WLOPKernel::Rows rows;
+	rows.points = cloud.points[0].V();
+	rows.normals = cloud.normals[0].V();
+	rows.neighbors = cloud.points[0].V();
+	rows.neighbor_weight = &cloud.weight[0];
+	rows.neighbor_factor = NULL;
+	rows.row_skip = NULL;
+	rows.offsets = &cloud.offsets[0];
+	rows.indices = &cloud.indices[0];
+	rows.row_num = (int)cloud.points.size();
+	rows.radius = cloud.radius;
+	rows.iradius16 = -4 / (cloud.radius * cloud.radius);
+	return rows;
+}
+
+struct Result
+{
+	vector<Point3f> sum;
+	vector<double> weight_sum;
+};
+
+enum Kernel { AVERAGE, AVERAGE_ANISOTROPIC, REPULSION, DENSITY };
+
+static double runKernel(WLOPKernel::Level level, Kernel kernel, double power, const WLOPKernel::Rows& rows, Result& result)
+{
+	result.sum.assign(rows.row_num, Point3f(0, 0, 0));
+	result.weight_sum.assign(rows.row_num, 0);
+
+	double start = omp_get_wtime();
+	switch (kernel)
+	{
+	case AVERAGE:
+		WLOPKernel::averageTerm(level, rows, power, false, &result.sum[0], &result.weight_sum[0]);
+		break;
+	case AVERAGE_ANISOTROPIC:
+		WLOPKernel::averageTerm(level, rows, power, true, &result.sum[0], &result.weight_sum[0]);
+		break;
+	case REPULSION:
+		WLOPKernel::repulsionTerm(level, rows, power, &result.sum[0], &result.weight_sum[0]);
+		break;
+	case DENSITY:
+		WLOPKernel::densityTerm(level, rows, &result.weight_sum[0]);
+		break;
+	}
+	return omp_get_wtime() - start;
+}
+
+// largest relative error of the weight sums and of the summed vectors
+// (measured against the size of the largest summed vector)
+static double maxError(const Result& test, const Result& reference)
+{
+	double max_sum = 0;
+	for (int i = 0; i < reference.sum.size(); i++)
+	{
+		max_sum = max(max_sum, (double)reference.sum[i].Norm());
+	}
+
+	double error = 0;
+	for (int i = 0; i < reference.sum.size(); i++)
+	{
+		double w = fabs(test.weight_sum[i] - reference.weight_sum[i]) / max(fabs(reference.weight_sum[i]), 1e-30);
+		error = max(error, w);
+		if (max_sum > 0)
+		{
+			error = max(error, (double)(test.sum[i] - reference.sum[i]).Norm() / max_sum);
+		}
+	}
+	return error;
+}
+
+int main(int argc, char** argv)
+{
+	int point_num = argc > 1 ? atoi(argv[1]) : 1000000;
+	int neighbor_num = argc > 2 ? atoi(argv[2]) : 40;
+
+	Cloud cloud;
+	makeCloud(point_num, neighbor_num, cloud);
+	WLOPKernel::Rows rows = makeRows(cloud);
+	double pair_num = (double)cloud.indices.size();
+
+	WLOPKernel::Level best = WLOPKernel::bestLevel();
+	printf("%d points, %.0f pairs, best level %s, %d threads\n\n", rows.row_num, pair_num,
+		WLOPKernel::levelName(best), omp_get_max_threads());
+
+	struct Case { const char* name; Kernel kernel; double power; };
+	Case cases[] = {
+		{ "average   power 1  ", AVERAGE, 1.0 },
+		{ "average   power 2  ", AVERAGE, 2.0 },
+		{ "average   power 0.5", AVERAGE, 0.5 },
+		{ "anisotrop power 1  ", AVERAGE_ANISOTROPIC, 1.0 },
+		{ "repulsion power 1  ", REPULSION, 1.0 },
+		{ "repulsion power 2  ", REPULSION, 2.0 },
+		{ "repulsion power 1.5", REPULSION, 1.5 },
+		{ "density            ", DENSITY, 0.0 }
+	};
+
+	for (int c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+	{
+		Result reference;
+		double scalar_time = runKernel(WLOPKernel::SCALAR, cases[c].kernel, cases[c].power, rows, reference);
+		printf("%s  Scalar %8.1f Mpairs/s", cases[c].name, pair_num / max(scalar_time, 1e-9) / 1e6);
+
+		for (int level = WLOPKernel::SSE; level <= best; level++)
+		{
+			Result test;
+			double time = runKernel((WLOPKernel::Level)level, cases[c].kernel, cases[c].power, rows, test);
+			printf("  %s %8.1f Mpairs/s (x%.1f, err %.1e)", WLOPKernel::levelName((WLOPKernel::Level)level),
+				pair_num / max(time, 1e-9) / 1e6, scalar_time / max(time, 1e-9), maxError(test, reference));
+		}
+		printf("\n");
+	}
+	return 0;
+}
@@ -21,12 +21,15 @@
 #include <vcg/complex/trimesh/update/selection.h>
 #include <vcg/complex/trimesh/update/topology.h>
 
-#include <vcg\space\point3.h>
+#include <vcg/space/point3.h>
 
 #include <cstdlib> //for rand()
 #include <ctime> //for time()
 
 #include <vector>
+#include "NeighborGraph.h"
+#include "NeighborCache.h"
+#include "PointArrays.h"
 using std::vector;
 using namespace vcg;
 //using vcg::Point3f;
@@ -185,6 +188,14 @@ public:
 };
 
 class CFace : public vcg::Face<CUsedTypes, vcg::face::VertexRef> {};
-class CMesh : public vcg::tri::TriMesh< std::vector<CVertex>, std::vector<CFace> > {};
+class CMesh : public vcg::tri::TriMesh< std::vector<CVertex>, std::vector<CFace> > 
+{
+public:
+	CNeighborGraph neighbor_graph;          // ball neighbors inside this mesh, row i is vert[i]
+	CNeighborGraph original_neighbor_graph; // ball neighbors of vert[i] in the original mesh
+	CNeighborCache neighbor_cache;          // skin lists behind the two graphs, see GlobalFun::updateBallNeighbors
+	CNeighborCache original_neighbor_cache;
+	CPointArrays arrays;                    // snapshot of the hot fields of vert, refresh with arrays.load(vert)
+};
 
 
@@ -18,6 +18,8 @@ void DataMgr::clearCMesh(CMesh& mesh)
 	mesh.vert.clear();
 	mesh.vn = 0;
 	mesh.bbox = Box3f();
+	mesh.neighbor_cache.clear();
+	mesh.original_neighbor_cache.clear();
 }
 
 bool DataMgr::isSamplesEmpty()
@@ -44,14 +46,23 @@ void DataMgr::loadPlyToOriginal(QString fileName)
 	clearCMesh(original);
 	curr_file_name = fileName;
 
-	int mask= tri::io::Mask::IOM_VERTCOORD + tri::io::Mask::IOM_VERTNORMAL ;
-
-	int err = tri::io::Importer<CMesh>::Open(original, curr_file_name.toAscii().data(), mask);  
-	if(err) 
+	// only positions and normals are read, so the binary cache can stand in for the ply
+	bool use_cache = para->getBool("Use Point Cloud Cache");
+	if (!use_cache || !CPointFile::loadCache(curr_file_name.toAscii().data(), original.vert))
 	{
-		cout << "Failed reading mesh: " << err << "\n";
-		return;
-	}  
+		int mask= tri::io::Mask::IOM_VERTCOORD + tri::io::Mask::IOM_VERTNORMAL ;
+
+		int err = tri::io::Importer<CMesh>::Open(original, curr_file_name.toAscii().data(), mask);  
+		if(err) 
+		{
+			cout << "Failed reading mesh: " << err << "\n";
+			return;
+		}  
+		if (use_cache)
+		{
+			CPointFile::saveCache(curr_file_name.toAscii().data(), original.vert);
+		}
+	}
 	cout << "points loaded\n";
 
 
@@ -97,33 +108,30 @@ void DataMgr::loadPlyToSample(QString fileName)
 void DataMgr::loadXYZN(QString fileName)
 {
   clearCMesh(samples);
-  ifstream infile;
-  infile.open(fileName.toStdString().c_str());
+  std::string file_name = fileName.toStdString();
 
-  int i = 0;
-  while(!infile.eof())
+  bool use_cache = para->getBool("Use Point Cloud Cache");
+  if (!use_cache || !CPointFile::loadCache(file_name.c_str(), samples.vert))
   {
-    CVertex v;
-    float temp = 0.;
-    for (int j=0; j<3; j++)
+    if (!CPointFile::loadXYZN(file_name.c_str(), samples.vert))
     {
-      infile >> temp;
-      v.P()[j] = temp;
+      cout << "Failed reading points: " << file_name << endl;
+      return;
     }
-    for (int j=0; j<3; j++) {
-      infile >> v.N()[j];
+    if (use_cache)
+    {
+      CPointFile::saveCache(file_name.c_str(), samples.vert);
     }
+  }
 
-    v.m_index = i++;
-
-    samples.vert.push_back(v);
+  for (int i = 0; i < samples.vert.size(); i++)
+  {
+    CVertex& v = samples.vert[i];
+    v.m_index = i;
+    v.bIsOriginal = false;
     samples.bbox.Add(v.P());
   }
- // mesh.vert.erase(mesh.vert.end()-1);
-  samples.vert.pop_back();
   samples.vn = samples.vert.size();
-
-  infile.close();
 }
 
  void DataMgr::loadXYZRGB(const vector<SColorPoint3D> & pCloudFKnt)
@@ -136,6 +144,7 @@ void DataMgr::loadXYZN(QString fileName)
  		return;
  	}
     int verIndex = 0;
+	original.vert.reserve(pCloudFKnt.size());
  	for (int i = 0; i < pCloudFKnt.size();i ++/*= 100*/)
  	{
  		CVertex v;
@@ -339,9 +348,11 @@ void DataMgr::downSamplesByNum(bool use_random_downsample)
 	}
 
 	CMesh::VertexIterator vi;
+	int idx = 0;
 	for(vi = samples.vert.begin(); vi != samples.vert.end(); ++vi)
 	{
 		vi->bIsOriginal = false;
+		vi->m_index = idx++;
 	}
 
   getInitRadiuse();
@@ -437,6 +448,9 @@ Box3f DataMgr::normalizeAllMesh()
 
 void DataMgr::eraseRemovedSamples()
 {
+	samples.neighbor_cache.clear();
+	samples.original_neighbor_cache.clear();
+
 	int cnt = 0;
 	vector<CVertex> temp_mesh;
 	for (int i = 0; i < samples.vert.size(); i++)
@@ -487,6 +501,12 @@ void DataMgr::recomputeQuad()
 
 void DataMgr::saveSkeletonAsSkel(QString fileName)
 {
+	if (fileName.endsWith(".bskel"))
+	{
+		saveSkeletonAsBinarySkel(fileName);
+		return;
+	}
+
 	ofstream outfile;
 	outfile.open(fileName.toStdString().c_str());
 
@@ -630,6 +650,12 @@ void DataMgr::saveSkeletonAsSkel(QString fileName)
 
 void DataMgr::loadSkeletonFromSkel(QString fileName)
 {
+	if (CSkelFileReader::isSkelFile(fileName.toStdString().c_str()))
+	{
+		loadSkeletonFromBinarySkel(fileName, false);
+		return;
+	}
+
 	clearCMesh(samples);
 	clearCMesh(original);
 	skeleton.clear();
@@ -707,10 +733,10 @@ void DataMgr::loadSkeletonFromSkel(QString fileName)
 			for(int j = 0; j < num2; j++)
 			{
 				Point3f p;
-				CVertex v;
+				SkeletonNode node;
 				sem >> p[0] >> p[1] >> p[2];
-				v.P() = p;
-				branch.curve.push_back(v);
+				node.P() = p;
+				branch.curve.push_back(node);
 			}
 			skeleton.branches.push_back(branch);
 		}
@@ -918,3 +944,207 @@ void DataMgr::loadSkeletonFromSkel(QString fileName)
 
 	skeleton.generateBranchSampleMap();
 }
+
+
+static void setPointRecord(CVertex& v, SkelFile::PointRecord& record)
+{
+	for (int k = 0; k < 3; k++)
+	{
+		record.p[k] = v.P()[k];
+		record.n[k] = v.N()[k];
+	}
+}
+
+void DataMgr::saveSkeletonAsBinarySkel(QString fileName)
+{
+	CSkelFileWriter writer;
+	if (!writer.open(fileName.toStdString().c_str()))
+	{
+		cout << "can not write " << fileName.toStdString() << endl;
+		return;
+	}
+
+	// every section goes to the file in chunks, the file is never built in memory
+	const int CHUNK_SIZE = 4096;
+
+	vector<SkelFile::PointRecord> points;
+	points.reserve(CHUNK_SIZE);
+	writer.beginSection(SkelFile::ORIGINAL, sizeof(SkelFile::PointRecord), original.vert.size());
+	for (int i = 0; i < original.vert.size(); i++)
+	{
+		points.push_back(SkelFile::PointRecord());
+		setPointRecord(original.vert[i], points.back());
+		if (points.size() == CHUNK_SIZE || i == original.vert.size() - 1)
+		{
+			writer.write(&points[0], points.size());
+			points.clear();
+		}
+	}
+	writer.endSection();
+
+	vector<SkelFile::SampleRecord> sample_records;
+	sample_records.reserve(CHUNK_SIZE);
+	writer.beginSection(SkelFile::SAMPLES, sizeof(SkelFile::SampleRecord), samples.vert.size());
+	for (int i = 0; i < samples.vert.size(); i++)
+	{
+		CVertex& v = samples.vert[i];
+		SkelFile::PointRecord point;
+		setPointRecord(v, point);
+
+		SkelFile::SampleRecord record;
+		memcpy(record.p, point.p, sizeof(record.p));
+		memcpy(record.n, point.n, sizeof(record.n));
+		record.eigen_confidence = v.eigen_confidence;
+		record.flags = (v.is_fixed_sample ? SkelFile::FIXED_SAMPLE : 0)
+			| (v.is_skel_virtual ? SkelFile::SKEL_VIRTUAL : 0)
+			| (v.is_skel_branch ? SkelFile::SKEL_BRANCH : 0);
+		record.reserved = 0;
+		sample_records.push_back(record);
+
+		if (sample_records.size() == CHUNK_SIZE || i == samples.vert.size() - 1)
+		{
+			writer.write(&sample_records[0], sample_records.size());
+			sample_records.clear();
+		}
+	}
+	writer.endSection();
+
+	vector<unsigned int> branch_begins(skeleton.branches.size() + 1, 0);
+	for (int i = 0; i < skeleton.branches.size(); i++)
+	{
+		branch_begins[i + 1] = branch_begins[i] + skeleton.branches[i].curve.size();
+	}
+	writer.beginSection(SkelFile::BRANCHES, sizeof(unsigned int), branch_begins.size());
+	writer.write(&branch_begins[0], branch_begins.size());
+	writer.endSection();
+
+	vector<SkelFile::NodeRecord> nodes;
+	nodes.reserve(CHUNK_SIZE);
+	writer.beginSection(SkelFile::NODES, sizeof(SkelFile::NodeRecord), branch_begins.back());
+	for (int i = 0; i < skeleton.branches.size(); i++)
+	{
+		Curve& curve = skeleton.branches[i].curve;
+		for (int j = 0; j < curve.size(); j++)
+		{
+			SkelFile::NodeRecord record;
+			record.skel_radius = curve[j].skel_radius;
+			for (int k = 0; k < 3; k++)
+			{
+				record.p[k] = curve[j].P()[k];
+			}
+			record.sample_index = curve[j].m_index;
+			record.flags = curve[j].is_skel_virtual ? SkelFile::SKEL_VIRTUAL : 0;
+			record.reserved = 0;
+			nodes.push_back(record);
+
+			if (nodes.size() == CHUNK_SIZE)
+			{
+				writer.write(&nodes[0], nodes.size());
+				nodes.clear();
+			}
+		}
+	}
+	if (!nodes.empty())
+	{
+		writer.write(&nodes[0], nodes.size());
+	}
+	writer.endSection();
+
+	if (!writer.close())
+	{
+		cout << "failed writing " << fileName.toStdString() << endl;
+	}
+}
+
+bool DataMgr::loadSkeletonFromBinarySkel(QString fileName, bool curves_only)
+{
+	CSkelFileReader reader;
+	if (!reader.open(fileName.toStdString().c_str()))
+	{
+		return false;
+	}
+
+	size_t num = 0;
+	if (!curves_only)
+	{
+		clearCMesh(samples);
+		clearCMesh(original);
+
+		const SkelFile::PointRecord* points =
+			(const SkelFile::PointRecord*)reader.section(SkelFile::ORIGINAL, sizeof(SkelFile::PointRecord), num);
+		original.vert.resize(num);
+		for (int i = 0; i < num; i++)
+		{
+			CVertex& v = original.vert[i];
+			v.bIsOriginal = true;
+			v.m_index = i;
+			v.P() = Point3f(points[i].p[0], points[i].p[1], points[i].p[2]);
+			v.N() = Point3f(points[i].n[0], points[i].n[1], points[i].n[2]);
+			original.bbox.Add(v.P());
+		}
+		original.vn = original.vert.size();
+
+		const SkelFile::SampleRecord* sample_records =
+			(const SkelFile::SampleRecord*)reader.section(SkelFile::SAMPLES, sizeof(SkelFile::SampleRecord), num);
+		samples.vert.resize(num);
+		for (int i = 0; i < num; i++)
+		{
+			const SkelFile::SampleRecord& record = sample_records[i];
+			CVertex& v = samples.vert[i];
+			v.bIsOriginal = false;
+			v.m_index = i;
+			v.P() = Point3f(record.p[0], record.p[1], record.p[2]);
+			v.N() = Point3f(record.n[0], record.n[1], record.n[2]);
+			v.eigen_confidence = record.eigen_confidence;
+			v.is_fixed_sample = (record.flags & SkelFile::FIXED_SAMPLE) != 0;
+			v.is_skel_virtual = (record.flags & SkelFile::SKEL_VIRTUAL) != 0;
+			v.is_skel_branch = (record.flags & SkelFile::SKEL_BRANCH) != 0;
+			samples.bbox.Add(v.P());
+		}
+		samples.vn = samples.vert.size();
+	}
+
+	skeleton.clear();
+
+	size_t node_num = 0;
+	const unsigned int* branch_begins =
+		(const unsigned int*)reader.section(SkelFile::BRANCHES, sizeof(unsigned int), num);
+	const SkelFile::NodeRecord* nodes =
+		(const SkelFile::NodeRecord*)reader.section(SkelFile::NODES, sizeof(SkelFile::NodeRecord), node_num);
+
+	int branch_num = num > 0 ? num - 1 : 0;
+	skeleton.branches.resize(branch_num);
+	for (int i = 0; i < branch_num; i++)
+	{
+		if (branch_begins[i] > branch_begins[i + 1] || branch_begins[i + 1] > node_num)
+		{
+			cout << "broken branch " << i << " in " << fileName.toStdString() << endl;
+			skeleton.branches.resize(i);
+			break;
+		}
+
+		Curve& curve = skeleton.branches[i].curve;
+		curve.resize(branch_begins[i + 1] - branch_begins[i]);
+		for (int j = 0; j < curve.size(); j++)
+		{
+			const SkelFile::NodeRecord& record = nodes[branch_begins[i] + j];
+			curve[j].P() = Point3f(record.p[0], record.p[1], record.p[2]);
+			curve[j].skel_radius = record.skel_radius;
+			curve[j].m_index = record.sample_index;
+			curve[j].is_skel_virtual = (record.flags & SkelFile::SKEL_VIRTUAL) != 0;
+		}
+	}
+
+	skeleton.generateBranchSampleMap();
+	return true;
+}
+
+bool DataMgr::loadCurvesFromSkel(QString fileName)
+{
+	if (!CSkelFileReader::isSkelFile(fileName.toStdString().c_str()))
+	{
+		cout << "only binary skeleton files load their curves alone: " << fileName.toStdString() << endl;
+		return false;
+	}
+	return loadSkeletonFromBinarySkel(fileName, true);
+}
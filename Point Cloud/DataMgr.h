@@ -1,8 +1,10 @@
 #pragma once
-#include "cmesh.h"
+#include "CMesh.h"
 #include "Parameter.h"
 #include "GlobalFunction.h"
 #include "Algorithm/Skeleton.h"
+#include "SkelFile.h"
+#include "PointFile.h"
 
 
 
@@ -76,12 +78,18 @@ public:
 	void clearData();
 	void recomputeQuad();
 
+	// binary SkelFile containers are found by their magic and saved for .bskel names,
+	// anything else is the text format
 	void loadSkeletonFromSkel(QString fileName);
 	void saveSkeletonAsSkel(QString fileName);
+	// only the skeleton of a binary file, the samples and the original stay
+	bool loadCurvesFromSkel(QString fileName);
 
 
 private:
 	void clearCMesh(CMesh& mesh);
+	bool loadSkeletonFromBinarySkel(QString fileName, bool curves_only);
+	void saveSkeletonAsBinarySkel(QString fileName);
 
 public:
 	CMesh original;
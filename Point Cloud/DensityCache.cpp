@@ -0,0 +1,107 @@
+#include "DensityCache.h"
+#include "CMesh.h"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace SkelFile;
+
+
+namespace {
+
+  const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+  const unsigned long long FNV_PRIME = 1099511628211ULL;
+
+  // FNV-1a over 32 bit words, the floats are hashed by their bits
+  inline unsigned long long hashWord(unsigned long long hash, unsigned int word) {
+    return (hash ^ word) * FNV_PRIME;
+  }
+
+  unsigned long long hashDouble(unsigned long long hash, double value) {
+    unsigned int words[2];
+    memcpy(words, &value, sizeof(words));
+    return hashWord(hashWord(hash, words[0]), words[1]);
+  }
+}
+
+
+CDensityCache::CDensityCache(const std::string &directory, const char *kind,
+                             const std::vector<CVertex> &vert, double radius, double h_gaussian) {
+  if (directory.empty()) {
+    return;
+  }
+
+  unsigned long long hash = FNV_OFFSET;
+  for (int i = 0; i < (int)vert.size(); i++) {
+    const vcg::Point3f &p = vert[i].cP();
+    for (int k = 0; k < 3; k++) {
+      unsigned int word;
+      memcpy(&word, &p[k], sizeof(word));
+      hash = hashWord(hash, word);
+    }
+  }
+  key.point_hash = hash;
+  key.point_num = vert.size();
+  key.radius = radius;
+  key.h_gaussian = h_gaussian;
+
+  // the file name holds the whole key, the kind in clear
+  unsigned long long name_hash = hashWord(hash, (unsigned int)key.point_num);
+  name_hash = hashDouble(hashDouble(name_hash, radius), h_gaussian);
+  char name[64];
+  sprintf(name, "density_%s_%016llx.bskel", kind, name_hash);
+
+  file_name = directory;
+  if (file_name[file_name.size() - 1] != '/' && file_name[file_name.size() - 1] != '\\') {
+    file_name += '/';
+  }
+  file_name += name;
+}
+
+bool CDensityCache::load(std::vector<double> &density) const {
+  if (!isEnabled() || !CSkelFileReader::isSkelFile(file_name.c_str())) {
+    return false;
+  }
+  CSkelFileReader reader;
+  if (!reader.open(file_name.c_str())) {
+    return false;
+  }
+
+  size_t num = 0;
+  const DensityRecord *record = (const DensityRecord *)reader.section(DENS_KEY, sizeof(DensityRecord), num);
+  if (num != 1 || record->point_hash != key.point_hash || record->point_num != key.point_num
+      || record->radius != key.radius || record->h_gaussian != key.h_gaussian) {
+    printf("density cache does not match the points: %s\n", file_name.c_str());
+    return false;
+  }
+
+  const double *values = (const double *)reader.section(DENSITY, sizeof(double), num);
+  if (values == NULL || num != key.point_num) {
+    return false;
+  }
+  density.assign(values, values + num);
+  return true;
+}
+
+bool CDensityCache::save(const std::vector<double> &density) const {
+  if (!isEnabled()) {
+    return false;
+  }
+  CSkelFileWriter writer;
+  if (!writer.open(file_name.c_str())) {
+    printf("can not write the density cache %s\n", file_name.c_str());
+    return false;
+  }
+
+  writer.beginSection(DENS_KEY, sizeof(DensityRecord), 1);
+  writer.write(&key, 1);
+  writer.endSection();
+
+  writer.beginSection(DENSITY, sizeof(double), density.size());
+  if (!density.empty()) {
+    writer.write(&density[0], density.size());
+  }
+  writer.endSection();
+
+  return writer.close();
+}
@@ -0,0 +1,42 @@
+#ifndef DENSITY_CACHE_H
+#define DENSITY_CACHE_H
+
+#include <string>
+#include <vector>
+
+#include "SkelFile.h"
+
+class CVertex;
+
+
+// the densities of the original points on disk, so the runs after the first
+// on the same scan skip the original-original neighbor search and the density
+// pass of WLOP and Skeletonization.
+//
+// one SkelFile container per key in a directory. the key is a hash of the
+// point positions, the number of points, the radius and h of the gaussian,
+// and the kind of loop that summed them (the kernels add the terms in their
+// own order, so "Scalar", "SSE", "AVX" and "Fused" are kept apart). the
+// record is checked again when the file is read, the densities are copied
+// out of the mapping.
+class CDensityCache {
+  public:
+    // an empty directory turns the cache off, nothing is hashed, load() fails
+    // and save() writes nothing
+    CDensityCache(const std::string &directory, const char *kind,
+                  const std::vector<CVertex> &vert, double radius, double h_gaussian);
+
+    bool isEnabled() const { return !file_name.empty(); }
+
+    bool load(std::vector<double> &density) const;
+    bool save(const std::vector<double> &density) const;
+
+    const std::string &fileName() const { return file_name; }
+
+  private:
+    SkelFile::DensityRecord key;
+    std::string file_name;
+};
+
+
+#endif
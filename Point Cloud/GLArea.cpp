@@ -1102,7 +1102,8 @@ void GLArea::runNormalSmoothing()
 		return;
 	}
 
-	for (int i = 0; i < global_paraMgr.norSmooth.getInt("Number Of Iterate"); i++)
+	int iterate_time = norSmoother.iteratesInRun() ? 1 : global_paraMgr.norSmooth.getInt("Number Of Iterate");
+	for (int i = 0; i < iterate_time; i++)
 	{
 		runPointCloudAlgorithm(norSmoother);
 	}
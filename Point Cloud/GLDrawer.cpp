@@ -18,6 +18,7 @@ void GLDrawer::updateDrawer(vector<int>& pickList)
 	bUseIndividualColor = para->getBool("Show Individual Color");
 	useNormalColor = para->getBool("Use Color From Normal");
     useDifferBranchColor = para->getBool("Use Differ Branch Color");
+	bSkeletonLight = para->getBool("Skeleton Light");
 
 	original_draw_width = para->getDouble("Original Draw Width");
 	sample_draw_width = para->getDouble("Sample Draw Width");
@@ -577,14 +578,14 @@ void GLDrawer::glDrawBranches(vector<Branch>& branches, GLColor gl_color)
 
 void GLDrawer::drawCurveSkeleton(Skeleton& skeleton)
 {
-	if (para->getBool("Skeleton Light"))
+	if (bSkeletonLight)
 	{
 		glEnable(GL_LIGHTING);
 	}
 
 	glDrawBranches(skeleton.branches, skel_bone_color);
 
-	if (para->getBool("Skeleton Light"))
+	if (bSkeletonLight)
 	{
 		glDisable(GL_LIGHTING);
 	}
@@ -96,6 +96,7 @@ private:
 	bool bUseIndividualColor;
 	bool useNormalColor;
     bool useDifferBranchColor;
+	bool bSkeletonLight;
 
 	double original_draw_width;
 	double sample_draw_width;
@@ -14,13 +14,37 @@ using namespace std;
 using namespace tri;
 
 
+// the graph being built by computeBallNeighbors, the context of its grid
+// walks. the row of a vertex is found from its address in mesh0->vert, the
+// stored neighbor is its m_index as before.
+// first pass (indices == NULL): count the neighbors of each row
+// second pass: cursor is the next free slot of each row
+struct BallNeighborPass
+{
+	CVertex* rows_base;
+	vector<int>* cursor;
+	vector<int>* indices;
+
+	inline void add(CVertex* v, CVertex* t)
+	{
+		int row = v - rows_base;
+		if (indices == NULL)
+		{
+			(*cursor)[row]++;
+		}
+		else
+		{
+			(*indices)[(*cursor)[row]++] = t->m_index;
+		}
+	}
+};
+
 void GlobalFun::find_original_neighbors(CGrid::iterator starta, CGrid::iterator enda, 
-	CGrid::iterator startb, CGrid::iterator endb, double radius) 
+	CGrid::iterator startb, CGrid::iterator endb, double radius, void* context) 
 {	
+	BallNeighborPass& pass = *(BallNeighborPass*)context;
 
 	double radius2 = radius*radius;
-	double iradius16 = -4/radius2;
-	const double PI = 3.1415926;
 
 	for(CGrid::iterator dest = starta; dest != enda; dest++) 
 	{
@@ -38,7 +62,7 @@ void GlobalFun::find_original_neighbors(CGrid::iterator starta, CGrid::iterator
 
 			if(dist2 < radius2) 
 			{                          
-				v.original_neighbors.push_back((*origin)->m_index);
+				pass.add(*dest, *origin);
 			}
 		}
 	}
@@ -47,8 +71,9 @@ void GlobalFun::find_original_neighbors(CGrid::iterator starta, CGrid::iterator
 
 
 // get neighbors
-void GlobalFun::self_neighbors(CGrid::iterator start, CGrid::iterator end, double radius)
+void GlobalFun::self_neighbors(CGrid::iterator start, CGrid::iterator end, double radius, void* context)
 {
+	BallNeighborPass& pass = *(BallNeighborPass*)context;
 	double radius2 = radius*radius;
 	for(CGrid::iterator dest = start; dest != end; dest++)
 	{
@@ -64,16 +89,17 @@ void GlobalFun::self_neighbors(CGrid::iterator start, CGrid::iterator end, doubl
 			double dist2 = diff.SquaredNorm();
 			if(dist2 < radius2) 
 			{   
-				v.neighbors.push_back((*origin)->m_index);
-				t.neighbors.push_back((*dest)->m_index);
+				pass.add(*dest, *origin);
+				pass.add(*origin, *dest);
 			}
 		}
 	}
 }
 
 void GlobalFun::other_neighbors(CGrid::iterator starta, CGrid::iterator enda, 
-	CGrid::iterator startb, CGrid::iterator endb, double radius)
+	CGrid::iterator startb, CGrid::iterator endb, double radius, void* context)
 {
+	BallNeighborPass& pass = *(BallNeighborPass*)context;
 	double radius2 = radius*radius;
 	for(CGrid::iterator dest = starta; dest != enda; dest++)
 	{
@@ -88,15 +114,35 @@ void GlobalFun::other_neighbors(CGrid::iterator starta, CGrid::iterator enda,
 			double dist2 = diff.SquaredNorm();
 			if(dist2 < radius2) 
 			{   
-				v.neighbors.push_back((*origin)->m_index);
-				t.neighbors.push_back((*dest)->m_index);
+				pass.add(*dest, *origin);
+				pass.add(*origin, *dest);
 			}
 		}
 	}
 }
 
 
-void GlobalFun::computeBallNeighbors(CMesh* mesh0, CMesh* mesh1, double radius, vcg::Box3f& box)
+// the rows of the graph into CVertex::neighbors/original_neighbors
+static void copyNeighborsToVertices(CMesh* mesh, bool is_original)
+{
+	CNeighborGraph& graph = is_original ? mesh->original_neighbor_graph : mesh->neighbor_graph;
+	int row_num = mesh->vert.size();
+
+#pragma omp parallel for
+	for (int i = 0; i < row_num; i++)
+	{
+		CVertex& v = mesh->vert[i];
+		CNeighborGraph::Row row = graph[i];
+		vector<int>& neighbors = is_original ? v.original_neighbors : v.neighbors;
+		neighbors.assign(row.begin(), row.end());
+	}
+}
+
+// mesh1 == NULL: neighbors inside mesh0, stored in mesh0->neighbor_graph
+// otherwise: neighbors of mesh0 in mesh1 (the original), stored in mesh0->original_neighbor_graph
+// need_vertex_neighbors also copies the rows into CVertex::neighbors/original_neighbors,
+// for the code that still reads the per vertex lists
+void GlobalFun::computeBallNeighbors(CMesh* mesh0, CMesh* mesh1, double radius, vcg::Box3f& box, bool need_vertex_neighbors)
 {
 	if (radius < 0.0001)
 	{
@@ -105,34 +151,87 @@ void GlobalFun::computeBallNeighbors(CMesh* mesh0, CMesh* mesh1, double radius,
 	}
 	//mesh1 should be original
 
-	//cout << "compute_Bll_Neighbors" << endl;
-	//cout << "radius: " << radius << endl;
-
 	CGrid samples_grid;
+	samples_grid.parallel = true;
 	samples_grid.init(mesh0->vert, box, radius);
-	//cout << "finished init" << endl;
 
+	CGrid original_grid;
 	if (mesh1 != NULL)
 	{
-		for (int i = 0; i < mesh0->vn; i++)
-		{
-			mesh0->vert[i].original_neighbors.clear();
-		}
-
-		CGrid original_grid;
 		original_grid.init(mesh1->vert, box, radius); // This can be speed up
-		samples_grid.sample(original_grid, find_original_neighbors);
 	}
-	else
+
+	CNeighborGraph& graph = (mesh1 != NULL) ? mesh0->original_neighbor_graph : mesh0->neighbor_graph;
+	int row_num = mesh0->vert.size();
+	vector<int> cursor(row_num, 0);
+
+	BallNeighborPass ball_pass;
+	ball_pass.rows_base = row_num > 0 ? &mesh0->vert[0] : NULL;
+	ball_pass.cursor = &cursor;
+	ball_pass.indices = NULL;
+
+	// two passes over the grid: count, then fill in place
+	for (int pass = 0; pass < 2; pass++)
 	{
-		for (int i = 0; i < mesh0->vn; i++)
+		if (pass == 1)
 		{
-			mesh0->vert[i].neighbors.clear();
+			graph.offsets.assign(row_num + 1, 0);
+			for (int i = 0; i < row_num; i++)
+			{
+				graph.offsets[i+1] = graph.offsets[i] + cursor[i];
+				cursor[i] = graph.offsets[i];
+			}
+			graph.indices.resize(graph.offsets[row_num]);
+			ball_pass.indices = &graph.indices;
 		}
 
-		samples_grid.iterate(self_neighbors, other_neighbors);
+		if (mesh1 != NULL)
+		{
+			samples_grid.sample(original_grid, find_original_neighbors, &ball_pass);
+		}
+		else
+		{
+			samples_grid.iterate(self_neighbors, other_neighbors, &ball_pass);
+		}
 	}
 
+	if (need_vertex_neighbors)
+	{
+		copyNeighborsToVertices(mesh0, mesh1 != NULL);
+	}
+}
+
+void GlobalFun::updateBallNeighbors(CMesh* mesh0, CMesh* mesh1, double radius, double skin, vcg::Box3f& box, bool need_vertex_neighbors)
+{
+	CNeighborCache& cache = (mesh1 != NULL) ? mesh0->original_neighbor_cache : mesh0->neighbor_cache;
+	if (skin <= 0)
+	{
+		cache.clear();
+		computeBallNeighbors(mesh0, mesh1, radius, box, need_vertex_neighbors);
+		return;
+	}
+	if (radius < 0.0001)
+	{
+		cout << "too small grid!!" << endl; 
+		return;
+	}
+
+	CNeighborGraph& graph = (mesh1 != NULL) ? mesh0->original_neighbor_graph : mesh0->neighbor_graph;
+	vector<CVertex>* neighbors = (mesh1 != NULL) ? &mesh1->vert : NULL;
+
+	cache.update_num++;
+	if (!cache.isValid(mesh0->vert, neighbors, radius, skin))
+	{
+		computeBallNeighbors(mesh0, mesh1, radius + skin, box, false);
+		cache.graph.swap(graph);
+		cache.store(radius, skin);
+	}
+	cache.filter(graph);
+
+	if (need_vertex_neighbors)
+	{
+		copyNeighborsToVertices(mesh0, mesh1 != NULL);
+	}
 }
 
 
@@ -154,78 +253,50 @@ void GlobalFun::computeAnnNeigbhors(vector<CVertex> &datapts, vector<CVertex> &q
 		return;
 	}
 
-	int					nPts;					// actual number of data points
-	ANNpointArray		dataPts;				// data points
-	ANNpoint			queryPt;				// query point
-	ANNidxArray			nnIdx;					// near neighbor indices
-	ANNdistArray		dists;					// near neighbor distances
-	ANNkd_tree*			kdTree;					// search structure
-
-	int				k				= numKnn;			// number of nearest neighbors
-	int				dim				= 3;			// dimension
-	double			eps				= 0;			// error bound
-	int				maxPts			= numKnn + 30000;			// maximum number of data points
-
-	if (datapts.size() >= maxPts)
-	{
-		cout << "Too many data" << endl;
-		return;
-	}
-
+	CKdTree kdTree;
+	kdTree.build(datapts);
 
-	queryPt = annAllocPt(dim);					// allocate query point
-	dataPts = annAllocPts(maxPts, dim);			// allocate data points
-	nnIdx = new ANNidx[k];						// allocate near neigh indices
-	dists = new ANNdist[k];						// allocate near neighbor dists
+	computeAnnNeigbhors(kdTree, querypts, knn, purpose);
+}
 
-	nPts = datapts.size();									// read data points
+// the tree can be kept by the caller and reused as long as the data points don't move
+void GlobalFun::computeAnnNeigbhors(const CKdTree &kdTree, vector<CVertex> &querypts, int knn, QString purpose)
+{
+	int numKnn = knn + 1;
+	int query_num = querypts.size();
+	const int batch_size = 1024;
 
-	vector<CVertex>::iterator vi;
-	int index = 0;
-	for(vi = datapts.begin(); vi != datapts.end(); ++vi)
+	// with fewer data points the queries get all of them, the lists of an
+	// earlier call are never left behind
+	if (kdTree.size() < numKnn)
 	{
-		for(int j = 0; j < 3; j++)
-		{
-			dataPts[index][j] = double(vi->P()[j]); 
-		}
-		index++;
+		cout << "ANN: only " << kdTree.size() << " data points for " << purpose.toStdString() << endl;
+		numKnn = kdTree.size();
 	}
 
-
-	knn++;
-
-	kdTree = new ANNkd_tree(					// build search structure
-		dataPts,					// the data points
-		nPts,						// number of points
-		dim);						// dimension of space
-
-	knn--;
-
-	for (vi = querypts.begin(); vi != querypts.end(); ++vi) 
+#pragma omp parallel
 	{
-		vi->neighbors.clear();
-		for (int j = 0; j < 3; j++) 
-		{
-			queryPt[j] = vi->P()[j];
-		}
-
-		kdTree->annkSearch(						// search
-			queryPt,						// query point
-			k,								// number of near neighbors
-			nnIdx,							// nearest neighbors (returned)
-			dists,							// distance (returned)
-			eps);							// error bound
+		// one result buffer per thread, reused for the whole batch
+		vector<CKdTree::Candidate> result;
+		result.reserve(numKnn);
 
-		for (int k = 1; k < numKnn; k++)
+#pragma omp for schedule(dynamic, 1)
+		for (int begin = 0; begin < query_num; begin += batch_size)
 		{
-			vi->neighbors.push_back(nnIdx[k]);
+			int end = MyMin(begin + batch_size, query_num);
+			for (int i = begin; i < end; i++)
+			{
+				CVertex& v = querypts[i];
+				kdTree.knnSearch(v.P(), numKnn, result);
+
+				v.neighbors.clear();
+				for (int k = 1; k < (int)result.size(); k++)
+				{
+					v.neighbors.push_back(result[k].second);
+				}
+			}
 		}
 	}
-
-	delete [] nnIdx;							// clean things up
-	delete [] dists;
-	delete kdTree;
-	annClose();									// done with ANN
 }
 
 
@@ -256,112 +327,35 @@ void GlobalFun::computeKnnNeigbhors(vector<CVertex> &datapts, vector<CVertex> &q
 	cout << endl;
 	cout << "compute KNN Neighbors for: " << purpose.toStdString() << endl;
 
+	CKdTree tree;
+	tree.build(datapts);
 
-	ofstream outfile1;
-	ofstream outfile2;
-	float val;
-
-	outfile1.open("point_cloud.txt", ofstream::binary);
-	outfile2.open("query.txt", ofstream::binary);
-
-	val = datapts.size();
-	outfile1.write((char *)(&val), sizeof(float));
-	val = querypts.size();
-	outfile2.write((char *)(&val), sizeof(float));
-	val = 3;
-	outfile1.write((char *)(&val), sizeof(float));
-	val = 4;
-	outfile2.write((char *)(&val), sizeof(float));
+	// the first one found is the query point itself
+	int k = numKnn + 1;
+	int first = need_self_included ? 0 : 1;
+	int query_num = querypts.size();
 
-
-	vector<CVertex>::iterator vi;
-	for(vi = datapts.begin(); vi != datapts.end(); ++vi)
+#pragma omp parallel
 	{
-		for(int j = 0; j < 3; j++)
-		{
-			val = vi->P()[j];
-			outfile1.write((char *)(&val), sizeof(float));
-		}
-	}
+		vector<CKdTree::Candidate> result;
+		result.reserve(k);
 
-
-	for (vi = querypts.begin(); vi != querypts.end(); ++vi) 
-	{
-		for (int j = 0; j < 3; j++) 
+#pragma omp for schedule(dynamic, 256)
+		for (int i = 0; i < query_num; i++)
 		{
-			val = vi->P()[j];
-			outfile2.write((char *)(&val), sizeof(float));
-		}
-		val = 0;
-		outfile2.write((char *)(&val), sizeof(float));
-	}
-
-	outfile1.close();
-	outfile2.close();
-
-	char mycmd[100];
-	sprintf(mycmd, "RG_NearestNeighbors.exe point_cloud.txt query.txt result.txt %d", numKnn+1);
-	//sprintf(mycmd, "RG_NearestNeighbors.exe point_cloud.txt query.txt result.txt", numKnn+1);
-
-	//cout << mycmd;
-
-	system(mycmd); 
-
-	//cout << "knn_neighbor file saved\n";
-
-	//clean querypts 
-	for (vi = querypts.begin(); vi != querypts.end(); ++vi)
-	{
-		if (isComputingOriginalNeighbor)
-		{
-			vi->original_neighbors.clear();
-		}
-		else
-		{
-			vi->neighbors.clear();
-		}
-	}
-
-	ifstream infile;
-	float size[2];
-	int row,col;
-	float *data;
-
-	infile.open ("result.txt", ifstream::binary);
-	infile.read((char*)size, 2*sizeof(float));
-	row = (int)size[0];
-	col = (int)size[1];
-	data = new float [row*col];
-	infile.read((char*)data,row*col*sizeof(float));
-	infile.close();
+			CVertex& v = querypts[i];
+			vector<int>& neighbors = isComputingOriginalNeighbor ? v.original_neighbors : v.neighbors;
 
-	for (int idx = 0; idx < row; idx++)
-	{
+			int found = tree.knnSearch(v.P(), k, result);
 
-		CVertex &v = querypts[(int)data[idx*col+1]-1];
-		if (isComputingOriginalNeighbor)
-		{
-			v.original_neighbors.push_back((int)data[idx*col]-1);
-		}
-		else
-		{
-			v.neighbors.push_back((int)data[idx*col]-1);
-		}
-	}
-
-	if (!need_self_included)// slow solution...
-	{
-		for(int i = 0; i < querypts.size(); i++)
-		{
-			CVertex& v = querypts[i];
-			v.neighbors.erase(v.neighbors.begin());
+			neighbors.clear();
+			for (int j = first; j < found; j++)
+			{
+				neighbors.push_back(result[j].second);
+			}
 		}
 	}
 
-
-	delete[] data;
-	//cout << "compute_knn_neighbor end." << endl << endl;
-
 	stoptime = clock();
 	timeused = stoptime - starttime;
 	cout << "KNN time used:  " << timeused/double(CLOCKS_PER_SEC) << " seconds." << endl;
@@ -384,236 +378,341 @@ vector<int> GlobalFun::GetRandomCards(int Max)
 }
 
 
-void GlobalFun::computeEigenIgnoreBranchedPoints(CMesh* _samples)
+// covariance += w * diff diff^T, upper triangle only
+static inline void addCovariance(double* covariance, const Point3f& diff, double w)
 {
-	vector<vector<int> > neighborMap;
+	double x = diff[0], y = diff[1], z = diff[2];
+	covariance[0] += w * x * x;
+	covariance[1] += w * x * y;
+	covariance[2] += w * x * z;
+	covariance[3] += w * y * y;
+	covariance[4] += w * y * z;
+	covariance[5] += w * z * z;
+}
 
-	typedef vector<CVertex>::iterator VertexIterator;
+static void setEigenOfVertex(CVertex& v, const double* eigenvalues, const Point3f* eigenvectors)
+{
+	double sum_eigen_value = (eigenvalues[0] + eigenvalues[1] + eigenvalues[2]);
+	v.eigen_confidence = eigenvalues[0] / sum_eigen_value;
 
-	VertexIterator begin = _samples->vert.begin();
-	VertexIterator end = _samples->vert.end();
+	v.eigen_vector0 = eigenvectors[0];
+	v.eigen_vector1 = eigenvectors[1];
+	v.N() = eigenvectors[2];
+}
 
-	neighborMap.assign(end - begin, vector<int>());
+void GlobalFun::computeEigenIgnoreBranchedPoints(CMesh* _samples)
+{
+	// no pca for points with fewer than 3 neighbors left after removing the branch points
+	int vert_num = _samples->vert.size();
+	vector<char> has_pca(vert_num, 1);
+	vector<double> covariances(vert_num * 6, 0.0);
 
-	int curr_index = 0;
-	for (VertexIterator iter=begin; iter!=end; ++iter, curr_index++)
+#pragma omp parallel for
+	for (int i = 0; i < vert_num; i++)
 	{
-    if(iter->neighbors.size() <= 3)
-    {
-      iter->eigen_confidence = 0.5;
-      continue;
-    }
+		CVertex& v = _samples->vert[i];
+		if (v.neighbors.size() <= 3)
+		{
+			has_pca[i] = 0;
+			continue;
+		}
 
-		//neighborMap[curr_index].push_back(curr_index);
-		for(int j = 0; j < iter->neighbors.size(); j++)
+		int neighbor_size = 0;
+		for (int j = 0; j < v.neighbors.size(); j++)
 		{
-			CVertex& t = _samples->vert[iter->neighbors[j]];
+			CVertex& t = _samples->vert[v.neighbors[j]];
 			if (t.is_skel_branch || t.is_skel_ignore)
 			{
 				continue;
 			}
-			neighborMap[curr_index].push_back(iter->neighbors[j]);
+			addCovariance(&covariances[i * 6], v.P() - t.P(), 1.0);
+			neighbor_size++;
+		}
+
+		if (neighbor_size < 3)
+		{
+			has_pca[i] = 0;
 		}
 	}
 
+	vector<double> eigenvalues;
+	vector<Point3f> eigenvectors;
+	solveEigenBatch(covariances, eigenvalues, eigenvectors);
 
-	int currIndex = 0;
-	for (VertexIterator iter=begin; iter!=end; iter++, currIndex++)
+	for (int i = 0; i < vert_num; i++)
 	{
-		int neighbor_size = neighborMap[currIndex].size();
-
-		if (neighbor_size < 3)
+		CVertex& v = _samples->vert[i];
+		if (!has_pca[i])
 		{
-			iter->eigen_confidence = 0.95;
-			iter->eigen_vector0 = Point3f(0, 0, 0);
-
+			v.eigen_confidence = 0.95;
+			v.eigen_vector0 = Point3f(0, 0, 0);
 			continue;
 		}
+		setEigenOfVertex(v, &eigenvalues[i * 3], &eigenvectors[i * 3]);
+	}
+}
 
-		Matrix33d covariance_matrix;
-		Point3f diff;
-		covariance_matrix.SetZero();
-		int neighborIndex = -1;
+void GlobalFun::computeEigen(CMesh* _samples)
+{
+	int vert_num = _samples->vert.size();
+	vector<double> covariances(vert_num * 6, 0.0);
 
-		for (unsigned int n=0; n<neighbor_size; n++)
+#pragma omp parallel for
+	for (int i = 0; i < vert_num; i++)
+	{
+		CVertex& v = _samples->vert[i];
+		for (int j = 0; j < v.neighbors.size(); j++)
 		{
-			neighborIndex = neighborMap[currIndex][n];
-			if(neighborIndex < 0)
-				break;
-			VertexIterator neighborIter = begin + neighborIndex;
-
-			diff = iter->P() - neighborIter->P();
-
-			for (int i=0; i<3; i++)
-				for (int j=0; j<3; j++)
-					covariance_matrix[i][j] += diff[i]*diff[j];
+			addCovariance(&covariances[i * 6], v.P() - _samples->vert[v.neighbors[j]].P(), 1.0);
 		}
+	}
 
-		Point3f   eigenvalues;
-		Matrix33d	eigenvectors;
-		int required_rotations;
-		vcg::Jacobi< Matrix33d, Point3f >(covariance_matrix, eigenvalues, eigenvectors, required_rotations);
-		vcg::SortEigenvaluesAndEigenvectors< Matrix33d, Point3f >(eigenvalues, eigenvectors);
-
-		double sum_eigen_value = (eigenvalues[0] + eigenvalues[1] + eigenvalues[2]);
-		iter->eigen_confidence = eigenvalues[0] / sum_eigen_value;
-
-		for (int d=0; d<3; d++)
-			iter->eigen_vector0[d] = eigenvectors[d][0];
-		for (int d=0; d<3; d++)
-			iter->eigen_vector1[d] = eigenvectors[d][1];
-		for (int d=0; d<3; d++)
-			iter->N()[d] = eigenvectors[d][2];
+	vector<double> eigenvalues;
+	vector<Point3f> eigenvectors;
+	solveEigenBatch(covariances, eigenvalues, eigenvectors);
 
-		iter->eigen_vector0.Normalize();
-		iter->eigen_vector1.Normalize();
-		iter->N().Normalize();
+	for (int i = 0; i < vert_num; i++)
+	{
+		setEigenOfVertex(_samples->vert[i], &eigenvalues[i * 3], &eigenvectors[i * 3]);
 	}
 }
 
-void GlobalFun::computeEigen(CMesh* _samples)
-{
-	vector<vector<int> > neighborMap;
 
-	typedef vector<CVertex>::iterator VertexIterator;
 
-	VertexIterator begin = _samples->vert.begin();
-	VertexIterator end = _samples->vert.end();
 
-	int curr_index = 0;
+void GlobalFun::computeEigenWithTheta(CMesh* _samples, double radius)
+{
+	int vert_num = _samples->vert.size();
+	vector<char> has_pca(vert_num, 1);
+	vector<double> covariances(vert_num * 6, 0.0);
+
+	double radius2 = radius*radius;
+	double iradius16 = -1/radius2; 
 
-	int currIndex = 0;
-	for (VertexIterator iter=begin; iter!=end; iter++, currIndex++)
+#pragma omp parallel for
+	for (int i = 0; i < vert_num; i++)
 	{
-		Matrix33d covariance_matrix;
-		Point3f diff;
-		covariance_matrix.SetZero();
-		int neighbor_size = iter->neighbors.size();
-		for (unsigned int n=0; n<neighbor_size; n++)
+		CNeighborGraph::Row neighbors = _samples->neighbor_graph[i];
+		if (neighbors.size() <= 3)
 		{
-			Point3f& tP =_samples->vert[iter->neighbors[n]].P();
-			diff = iter->P() - tP;
-
-			for (int i=0; i<3; i++)
-				for (int j=0; j<3; j++)
-					covariance_matrix[i][j] += diff[i]*diff[j];
+			has_pca[i] = 0;
+			continue;
 		}
 
+		CVertex& v = _samples->vert[i];
+		for (int j = 0; j < neighbors.size(); j++)
+		{
+			if (neighbors[j] < 0)
+				break;
 
-		Point3f   eigenvalues;
-		Matrix33d	eigenvectors;
-		int required_rotations;
-		vcg::Jacobi< Matrix33d, Point3f >(covariance_matrix, eigenvalues, eigenvectors, required_rotations);
-		vcg::SortEigenvaluesAndEigenvectors< Matrix33d, Point3f >(eigenvalues, eigenvectors);
-
-
-		double sum_eigen_value = (eigenvalues[0] + eigenvalues[1] + eigenvalues[2]);
+			Point3f diff = v.P() - _samples->vert[neighbors[j]].P();
+			double theta = exp(diff.SquaredNorm() * iradius16);
+			addCovariance(&covariances[i * 6], diff, theta);
+		}
+	}
 
+	vector<double> eigenvalues;
+	vector<Point3f> eigenvectors;
+	solveEigenBatch(covariances, eigenvalues, eigenvectors);
 
-		iter->eigen_confidence = eigenvalues[0] / sum_eigen_value;
+	for (int i = 0; i < vert_num; i++)
+	{
+		CVertex& v = _samples->vert[i];
+		if (!has_pca[i])
+		{
+			v.eigen_confidence = 0.5;
+			continue;
+		}
+		setEigenOfVertex(v, &eigenvalues[i * 3], &eigenvectors[i * 3]);
+	}
+}
 
-		for (int d=0; d<3; d++)
-			iter->eigen_vector0[d] = eigenvectors[d][0];
-		for (int d=0; d<3; d++)
-			iter->eigen_vector1[d] = eigenvectors[d][1];
-		for (int d=0; d<3; d++)
-			iter->N()[d] = eigenvectors[d][2];
 
-		iter->eigen_vector0.Normalize();
-		iter->eigen_vector1.Normalize();
-		iter->N().Normalize();
+void GlobalFun::solveEigenBatch(const vector<double>& covariances, vector<double>& eigenvalues, vector<Point3f>& eigenvectors)
+{
+	int matrix_num = covariances.size() / 6;
+	eigenvalues.resize(matrix_num * 3);
+	eigenvectors.resize(matrix_num * 3);
+	if (matrix_num == 0)
+	{
+		return;
 	}
 
+#pragma omp parallel for schedule(dynamic, 256)
+	for (int i = 0; i < matrix_num; i++)
+	{
+		solveEigen3x3(&covariances[i * 6], &eigenvalues[i * 3], &eigenvectors[i * 3]);
+	}
 }
 
+// unit vector perpendicular to the rows (a - lambda I) of a matrix whose
+// eigenvalue lambda is simple: the longest cross product of two rows
+static Point3d eigenvectorOfSimpleEigenvalue(const double a[6], double lambda)
+{
+	Point3d row0(a[0] - lambda, a[1], a[2]);
+	Point3d row1(a[1], a[3] - lambda, a[4]);
+	Point3d row2(a[2], a[4], a[5] - lambda);
 
+	Point3d r0xr1 = row0 ^ row1;
+	Point3d r0xr2 = row0 ^ row2;
+	Point3d r1xr2 = row1 ^ row2;
+	double d0 = r0xr1.SquaredNorm();
+	double d1 = r0xr2.SquaredNorm();
+	double d2 = r1xr2.SquaredNorm();
 
+	if (d0 >= d1 && d0 >= d2)
+	{
+		return d0 > 0 ? r0xr1 / sqrt(d0) : Point3d(1, 0, 0);
+	}
+	else if (d1 >= d2)
+	{
+		return r0xr2 / sqrt(d1);
+	}
+	return r1xr2 / sqrt(d2);
+}
 
-void GlobalFun::computeEigenWithTheta(CMesh* _samples, double radius)
+// the eigenvector of lambda in the plane perpendicular to the known
+// eigenvector, from the 2x2 restriction of the matrix to that plane
+static Point3d eigenvectorInPlane(const double a[6], const Point3d& known, double lambda)
 {
-	vector<vector<int> > neighborMap;
-
-	typedef vector<CVertex>::iterator VertexIterator;
-
-	VertexIterator begin = _samples->vert.begin();
-	VertexIterator end = _samples->vert.end();
+	Point3d u, v;
+	if (fabs(known[0]) > fabs(known[1]))
+	{
+		u = Point3d(-known[2], 0, known[0]) / sqrt(known[0] * known[0] + known[2] * known[2]);
+	}
+	else
+	{
+		u = Point3d(0, known[2], -known[1]) / sqrt(known[1] * known[1] + known[2] * known[2]);
+	}
+	v = known ^ u;
 
-	neighborMap.assign(end - begin, vector<int>());
+	Point3d au(a[0] * u[0] + a[1] * u[1] + a[2] * u[2],
+		a[1] * u[0] + a[3] * u[1] + a[4] * u[2],
+		a[2] * u[0] + a[4] * u[1] + a[5] * u[2]);
+	Point3d av(a[0] * v[0] + a[1] * v[1] + a[2] * v[2],
+		a[1] * v[0] + a[3] * v[1] + a[4] * v[2],
+		a[2] * v[0] + a[4] * v[1] + a[5] * v[2]);
 
-	int curr_index = 0;
+	double m00 = u * au - lambda;
+	double m01 = u * av;
+	double m11 = v * av - lambda;
+	double abs_m00 = fabs(m00), abs_m01 = fabs(m01), abs_m11 = fabs(m11);
 
-	for (VertexIterator iter=begin; iter!=end; iter++, curr_index++)
+	if (abs_m00 >= abs_m11)
 	{
-		if(iter->neighbors.size() <= 3)
+		if (MyMax(abs_m00, abs_m01) <= 0)
 		{
-			iter->eigen_confidence = 0.5;
-			continue;
+			return u;
 		}
-
-		for(int j = 0; j < iter->neighbors.size(); j++)
+		if (abs_m00 >= abs_m01)
 		{
-			neighborMap[curr_index].push_back(iter->neighbors[j]);
+			m01 /= m00;
+			m00 = 1 / sqrt(1 + m01 * m01);
+			m01 *= m00;
 		}
+		else
+		{
+			m00 /= m01;
+			m01 = 1 / sqrt(1 + m00 * m00);
+			m00 *= m01;
+		}
+		return u * m01 - v * m00;
 	}
-
-	double radius2 = radius*radius;
-	double iradius16 = -1/radius2; 
-
-	int currIndex = 0;
-	for (VertexIterator iter=begin; iter!=end; iter++, currIndex++)
-	{
-    if(iter->neighbors.size() <= 3)
-    {
-      iter->eigen_confidence = 0.5;
-      continue;
-    }
-
-		Matrix33d covariance_matrix;
-		Point3f diff;
-		covariance_matrix.SetZero();
-		int neighborIndex = -1;
-		int neighbor_size = iter->neighbors.size();
-		for (unsigned int n=0; n<neighbor_size; n++)
+	else
+	{
+		if (MyMax(abs_m11, abs_m01) <= 0)
 		{
-			neighborIndex = neighborMap[currIndex][n];
-			if(neighborIndex < 0)
-				break;
-			VertexIterator neighborIter = begin + neighborIndex;
-
-			diff = iter->P() - neighborIter->P();
+			return u;
+		}
+		if (abs_m11 >= abs_m01)
+		{
+			m01 /= m11;
+			m11 = 1 / sqrt(1 + m01 * m01);
+			m01 *= m11;
+		}
+		else
+		{
+			m11 /= m01;
+			m01 = 1 / sqrt(1 + m11 * m11);
+			m11 *= m01;
+		}
+		return u * m11 - v * m01;
+	}
+}
 
-			Point3f vm = iter->N();
-			Point3f tm = neighborIter->N();
-			double dist2 = diff.SquaredNorm();
-			double theta = exp(dist2*iradius16);
+// closed form instead of Jacobi iterations: the eigenvalues from the
+// trigonometric solution of the characteristic cubic, the eigenvector of the
+// eigenvalue farthest from the other two by cross products, the second one
+// inside the plane perpendicular to it, the third by a cross product
+void GlobalFun::solveEigen3x3(const double* covariance, double* eigenvalues, Point3f* eigenvectors)
+{
+	// scaled to the largest entry, keeps the cubic well conditioned
+	double max_entry = 0;
+	for (int i = 0; i < 6; i++)
+	{
+		max_entry = MyMax(max_entry, fabs(covariance[i]));
+	}
 
-			for (int i=0; i<3; i++)
-				for (int j=0; j<3; j++)
-					covariance_matrix[i][j] += diff[i]*diff[j] * theta;
-		}
+	double a[6];
+	for (int i = 0; i < 6; i++)
+	{
+		a[i] = max_entry > 0 ? covariance[i] / max_entry : 0;
+	}
 
-		Point3f   eigenvalues;
-		Matrix33d	eigenvectors;
-		int required_rotations;
-		vcg::Jacobi< Matrix33d, Point3f >(covariance_matrix, eigenvalues, eigenvectors, required_rotations);
-		vcg::SortEigenvaluesAndEigenvectors< Matrix33d, Point3f >(eigenvalues, eigenvectors);
+	double q = (a[0] + a[3] + a[5]) / 3;
+	double b00 = a[0] - q;
+	double b11 = a[3] - q;
+	double b22 = a[5] - q;
+	double off_diagonal = a[1] * a[1] + a[2] * a[2] + a[4] * a[4];
+	double p = sqrt((b00 * b00 + b11 * b11 + b22 * b22 + 2 * off_diagonal) / 6);
 
+	if (p < 1e-12)
+	{
+		// a multiple of the identity, any basis will do
+		eigenvalues[0] = eigenvalues[1] = eigenvalues[2] = q * max_entry;
+		eigenvectors[0] = Point3f(1, 0, 0);
+		eigenvectors[1] = Point3f(0, 1, 0);
+		eigenvectors[2] = Point3f(0, 0, 1);
+		return;
+	}
 
-		double sum_eigen_value = (eigenvalues[0] + eigenvalues[1] + eigenvalues[2]);
+	// det((a - q I) / p) / 2, in [-1, 1] up to rounding
+	double c00 = b11 * b22 - a[4] * a[4];
+	double c01 = a[1] * b22 - a[4] * a[2];
+	double c02 = a[1] * a[4] - b11 * a[2];
+	double half_det = (b00 * c00 - a[1] * c01 + a[2] * c02) / (2 * p * p * p);
+	half_det = MyMin(MyMax(half_det, -1.0), 1.0);
 
-		iter->eigen_confidence = eigenvalues[0] / sum_eigen_value;
+	double angle = acos(half_det) / 3;
+	double beta_max = 2 * cos(angle);
+	double beta_min = 2 * cos(angle + 2.0943951023931953);
+	double beta_mid = -(beta_max + beta_min);
 
-		for (int d=0; d<3; d++)
-			iter->eigen_vector0[d] = eigenvectors[d][0];
-		for (int d=0; d<3; d++)
-			iter->eigen_vector1[d] = eigenvectors[d][1];
-		for (int d=0; d<3; d++)
-			iter->N()[d] = eigenvectors[d][2];
+	double lambda_max = q + p * beta_max;
+	double lambda_mid = q + p * beta_mid;
+	double lambda_min = q + p * beta_min;
 
-		iter->eigen_vector0.Normalize();
-		iter->eigen_vector1.Normalize();
-		iter->N().Normalize();
+	Point3d vector_max, vector_mid, vector_min;
+	if (half_det >= 0)
+	{
+		// the largest eigenvalue is the isolated one
+		vector_max = eigenvectorOfSimpleEigenvalue(a, lambda_max);
+		vector_mid = eigenvectorInPlane(a, vector_max, lambda_mid);
+		vector_min = vector_max ^ vector_mid;
 	}
+	else
+	{
+		vector_min = eigenvectorOfSimpleEigenvalue(a, lambda_min);
+		vector_mid = eigenvectorInPlane(a, vector_min, lambda_mid);
+		vector_max = vector_mid ^ vector_min;
+	}
+
+	eigenvalues[0] = lambda_max * max_entry;
+	eigenvalues[1] = lambda_mid * max_entry;
+	eigenvalues[2] = lambda_min * max_entry;
+	eigenvectors[0] = Point3f(vector_max[0], vector_max[1], vector_max[2]);
+	eigenvectors[1] = Point3f(vector_mid[0], vector_mid[1], vector_mid[2]);
+	eigenvectors[2] = Point3f(vector_min[0], vector_min[1], vector_min[2]);
 }
 
 
@@ -763,3 +862,51 @@ double GlobalFun::computeRealAngleOfTwoVertor(Point3f v0, Point3f v1)
 	return angle;
 }
 
+
+
+// working set of the process and its peak so far, in MB.
+// the system headers come last, their macros stay out of the code above
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+
+void GlobalFun::getMemoryUsage(double& memory_mb, double& peak_memory_mb)
+{
+	PROCESS_MEMORY_COUNTERS counters;
+	memory_mb = peak_memory_mb = 0;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		memory_mb = counters.WorkingSetSize / (1024. * 1024.);
+		peak_memory_mb = counters.PeakWorkingSetSize / (1024. * 1024.);
+	}
+}
+#else
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+void GlobalFun::getMemoryUsage(double& memory_mb, double& peak_memory_mb)
+{
+	memory_mb = peak_memory_mb = 0;
+
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		if (fscanf(statm, "%ld %ld", &pages, &resident) == 2)
+		{
+			memory_mb = resident * (sysconf(_SC_PAGESIZE) / (1024. * 1024.));
+		}
+		fclose(statm);
+	}
+
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+	{
+		peak_memory_mb = usage.ru_maxrss / 1024.;
+	}
+}
+#endif
@@ -4,6 +4,7 @@
 #include <vector>
 #include "CMesh.h"
 #include "grid.h"
+#include "kdtree.h"
 //#include "LAP_Others/eigen.h"
 #include <fstream>
 #include <float.h>
@@ -38,14 +39,25 @@ namespace GlobalFun
 	void computeEigenIgnoreBranchedPoints(CMesh* _samples);
 	void computeEigenWithTheta(CMesh* _samples, double radius);
 
-	void computeAnnNeigbhors(vector<CVertex> &datapts, vector<CVertex> &querypts, int numKnn, bool need_self_included, QString purpose);
-	void computeBallNeighbors(CMesh* mesh0, CMesh* mesh1, double radius, vcg::Box3f& box);
+	// batched pca. covariances holds 6 doubles per symmetric matrix (xx xy xz yy yz zz),
+	// the results are 3 eigenvalues and 3 unit eigenvectors per matrix in the order of
+	// Jacobi + SortEigenvaluesAndEigenvectors: largest first, the normal last
+	void solveEigenBatch(const vector<double>& covariances, vector<double>& eigenvalues, vector<Point3f>& eigenvectors);
+	void solveEigen3x3(const double* covariance, double* eigenvalues, Point3f* eigenvectors);
 
-	void static  __cdecl self_neighbors(CGrid::iterator start, CGrid::iterator end, double radius);
+	void computeAnnNeigbhors(vector<CVertex> &datapts, vector<CVertex> &querypts, int numKnn, bool need_self_included, QString purpose);
+	void computeAnnNeigbhors(const CKdTree &kdTree, vector<CVertex> &querypts, int numKnn, QString purpose);
+	void computeBallNeighbors(CMesh* mesh0, CMesh* mesh1, double radius, vcg::Box3f& box, bool need_vertex_neighbors = true);
+	// computeBallNeighbors through the cache of mesh0: searched with radius + skin, then
+	// reused until the points moved too far. skin <= 0 always searches
+	void updateBallNeighbors(CMesh* mesh0, CMesh* mesh1, double radius, double skin, vcg::Box3f& box, bool need_vertex_neighbors = true);
+
+	// grid callbacks of computeBallNeighbors, context is its pass over the grid
+	void static  __cdecl self_neighbors(CGrid::iterator start, CGrid::iterator end, double radius, void* context);
 	void static  __cdecl other_neighbors(CGrid::iterator starta, CGrid::iterator enda, 
-		CGrid::iterator startb, CGrid::iterator endb, double radius);
+		CGrid::iterator startb, CGrid::iterator endb, double radius, void* context);
 	void static __cdecl find_original_neighbors(CGrid::iterator starta, CGrid::iterator enda, 
-		CGrid::iterator startb, CGrid::iterator endb, double radius); 
+		CGrid::iterator startb, CGrid::iterator endb, double radius, void* context); 
 
 	double computeEulerDist(Point3f& p1, Point3f& p2);
 	double computeEulerDistSquare(Point3f& p1, Point3f& p2);
@@ -60,6 +72,8 @@ namespace GlobalFun
 	double computeRealAngleOfTwoVertor(Point3f v0, Point3f v1);
 	bool isTwoPoint3fTheSame(Point3f& v0, Point3f& v1);
 	bool isTwoPoint3fOpposite(Point3f& v0, Point3f& v1);
+
+	void getMemoryUsage(double& memory_mb, double& peak_memory_mb);
 }
 
 class Timer
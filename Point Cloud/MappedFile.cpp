@@ -0,0 +1,92 @@
+#include "MappedFile.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+
+bool CMappedFile::open(const char *file_name) {
+  close();
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER file_size;
+  HANDLE mapping = NULL;
+  if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  }
+  if (mapping == NULL) {
+    CloseHandle(file);
+    return false;
+  }
+  map_data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (map_data == NULL) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  map_size = (size_t)file_size.QuadPart;
+  file_handle = file;
+  mapping_handle = mapping;
+#else
+  int fd = ::open(file_name, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat file_stat;
+  void *mapped = MAP_FAILED;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+    mapped = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+  map_data = (const char *)mapped;
+  map_size = file_stat.st_size;
+#endif
+  return true;
+}
+
+void CMappedFile::close() {
+  if (map_data != NULL) {
+#ifdef _WIN32
+    UnmapViewOfFile(map_data);
+    CloseHandle((HANDLE)mapping_handle);
+    CloseHandle((HANDLE)file_handle);
+#else
+    munmap((void *)map_data, map_size);
+#endif
+  }
+  map_data = NULL;
+  map_size = 0;
+  file_handle = mapping_handle = NULL;
+}
+
+bool CMappedFile::getFileStamp(const char *file_name, unsigned long long &size, long long &modified_time) {
+#ifdef _WIN32
+  struct _stat64 file_stat;
+  if (_stat64(file_name, &file_stat) != 0) {
+    return false;
+  }
+#else
+  struct stat file_stat;
+  if (stat(file_name, &file_stat) != 0) {
+    return false;
+  }
+#endif
+  size = file_stat.st_size;
+  modified_time = file_stat.st_mtime;
+  return true;
+}
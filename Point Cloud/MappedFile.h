@@ -0,0 +1,36 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+
+
+// a whole file mapped read only, MapViewOfFile on windows and mmap elsewhere.
+// the pages are read from disk when they are first touched
+class CMappedFile {
+  public:
+    CMappedFile() : map_data(NULL), map_size(0), file_handle(NULL), mapping_handle(NULL) {}
+    ~CMappedFile() { close(); }
+
+    // false for missing and empty files
+    bool open(const char *file_name);
+    void close();
+
+    bool isOpen() const { return map_data != NULL; }
+    const char *data() const { return map_data; }
+    size_t size() const { return map_size; }
+
+    // size and modification time, false if the file does not exist
+    static bool getFileStamp(const char *file_name, unsigned long long &size, long long &modified_time);
+
+  private:
+    CMappedFile(const CMappedFile &);
+    CMappedFile &operator=(const CMappedFile &);
+
+    const char *map_data;
+    size_t map_size;
+    void *file_handle;      // windows only, the mapping keeps no handle on posix
+    void *mapping_handle;
+};
+
+
+#endif
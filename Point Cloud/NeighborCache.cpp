@@ -0,0 +1,120 @@
+#include "NeighborCache.h"
+#include "CMesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace {
+
+  const int BLOCK_SIZE = 4096;
+
+  void loadPositions(const std::vector<CVertex> &vert, std::vector<vcg::Point3f> &positions) {
+    int n = (int)vert.size();
+    positions.resize(n);
+#pragma omp parallel for
+    for (int i = 0; i < n; i++) {
+      positions[i] = vert[i].cP();
+    }
+  }
+
+  // the largest distance a point moved between the two snapshots
+  double maxDisplacement(const std::vector<vcg::Point3f> &from, const std::vector<vcg::Point3f> &to) {
+    int n = (int)to.size();
+    int block_num = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    std::vector<double> block_max(block_num, 0.0);
+
+#pragma omp parallel for
+    for (int b = 0; b < block_num; b++) {
+      int end = std::min(n, (b + 1) * BLOCK_SIZE);
+      double max_dist2 = 0;
+      for (int i = b * BLOCK_SIZE; i < end; i++) {
+        double dist2 = (to[i] - from[i]).SquaredNorm();
+        if (dist2 > max_dist2) {
+          max_dist2 = dist2;
+        }
+      }
+      block_max[b] = max_dist2;
+    }
+
+    double max_dist2 = 0;
+    for (int b = 0; b < block_num; b++) {
+      max_dist2 = std::max(max_dist2, block_max[b]);
+    }
+    return sqrt(max_dist2);
+  }
+}
+
+
+void CNeighborCache::clear() {
+  graph.clear();
+  row_positions.clear();
+  neighbor_positions.clear();
+  row_now.clear();
+  neighbor_now.clear();
+  kept.clear();
+  radius = 0;
+  skin = 0;
+}
+
+bool CNeighborCache::isValid(const std::vector<CVertex> &rows, const std::vector<CVertex> *neighbors,
+                             double _radius, double _skin) {
+  loadPositions(rows, row_now);
+  if (neighbors) {
+    loadPositions(*neighbors, neighbor_now);
+  } else {
+    neighbor_now.clear();
+  }
+
+  if (graph.isEmpty() || radius != _radius || skin != _skin
+      || row_positions.size() != row_now.size()
+      || neighbor_positions.size() != neighbor_now.size()) {
+    return false;
+  }
+
+  double row_move = maxDisplacement(row_positions, row_now);
+  double neighbor_move = neighbors ? maxDisplacement(neighbor_positions, neighbor_now) : row_move;
+  return row_move + neighbor_move <= skin;
+}
+
+void CNeighborCache::store(double _radius, double _skin) {
+  radius = _radius;
+  skin = _skin;
+  row_positions = row_now;
+  neighbor_positions = neighbor_now;
+  build_num++;
+}
+
+void CNeighborCache::filter(CNeighborGraph &out) {
+  const std::vector<vcg::Point3f> &targets = neighbor_now.empty() ? row_now : neighbor_now;
+  int row_num = graph.rowNum();
+  double radius2 = radius * radius;
+
+  // the kept pairs of each row to the front of its slot in kept, then packed
+  kept.resize(graph.pairNum());
+  out.offsets.assign(row_num + 1, 0);
+#pragma omp parallel for schedule(dynamic, 256)
+  for (int i = 0; i < row_num; i++) {
+    const vcg::Point3f &p = row_now[i];
+    int k = graph.offsets[i];
+    for (int j = graph.offsets[i]; j < graph.offsets[i+1]; j++) {
+      int t = graph.indices[j];
+      double dist2 = (p - targets[t]).SquaredNorm();
+      if (dist2 < radius2) {
+        kept[k++] = t;
+      }
+    }
+    out.offsets[i+1] = k - graph.offsets[i];
+  }
+
+  for (int i = 0; i < row_num; i++) {
+    out.offsets[i+1] += out.offsets[i];
+  }
+  out.indices.resize(out.offsets[row_num]);
+
+#pragma omp parallel for schedule(dynamic, 256)
+  for (int i = 0; i < row_num; i++) {
+    std::copy(kept.begin() + graph.offsets[i], kept.begin() + graph.offsets[i] + (out.offsets[i+1] - out.offsets[i]),
+              out.indices.begin() + out.offsets[i]);
+  }
+}
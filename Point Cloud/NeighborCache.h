@@ -0,0 +1,56 @@
+#ifndef NEIGHBOR_CACHE_H
+#define NEIGHBOR_CACHE_H
+
+#include <vector>
+#include <vcg/space/point3.h>
+#include "NeighborGraph.h"
+
+class CVertex;
+
+
+// ball neighbor lists kept between iterations (Verlet lists): the pairs
+// closer than radius + skin are searched once, then every iteration takes
+// the pairs closer than radius out of them. a pair gets closer by at most
+// the sum of what its two points moved since the search, so the lists hold
+// every pair as long as the rows and the neighbors together moved less than
+// the skin, which is half the skin per point when both are the same mesh.
+// GlobalFun::updateBallNeighbors() decides when to search again.
+class CNeighborCache {
+  public:
+    CNeighborGraph graph;   // pairs closer than radius + skin at the last build
+    double radius;
+    double skin;
+    int build_num;          // builds and updates, counted from the start, clear() keeps them
+    int update_num;
+
+    CNeighborCache() : radius(0), skin(0), build_num(0), update_num(0) {}
+
+    // drop the lists, the next update searches again. for changes the
+    // positions do not show, e.g. points erased or a new radius
+    void clear();
+    bool isEmpty() const { return graph.isEmpty(); }
+
+    // takes the positions of now. true if graph still holds every pair closer
+    // than radius: same radius and skin, same points and not moved too far.
+    // neighbors == NULL: rows and neighbors are the same points
+    bool isValid(const std::vector<CVertex> &rows, const std::vector<CVertex> *neighbors,
+                 double radius, double skin);
+
+    // graph was just searched for the positions isValid() took
+    void store(double radius, double skin);
+
+    // the pairs of graph closer than radius at the positions isValid() took,
+    // in the order of graph
+    void filter(CNeighborGraph &out);
+
+  private:
+    // positions at the last build and now, compact so filter() runs in cache
+    std::vector<vcg::Point3f> row_positions;
+    std::vector<vcg::Point3f> neighbor_positions;
+    std::vector<vcg::Point3f> row_now;
+    std::vector<vcg::Point3f> neighbor_now;
+    std::vector<int> kept;
+};
+
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef NEIGHBOR_GRAPH_H
+#define NEIGHBOR_GRAPH_H
+
+#include <vector>
+#include <assert.h>
+
+
+// neighbor lists of a whole mesh stored as compressed sparse rows:
+// the neighbors of vertex i are indices[offsets[i]] ... indices[offsets[i+1]-1].
+// two arrays for the whole mesh instead of one std::vector<int> per vertex.
+class CNeighborGraph {
+  public:
+    // read-only view of one row, it looks like the old vector<int> so loops
+    // written for v.neighbors[j] only need the source of the list changed:
+    //   CNeighborGraph::Row neighbors = samples->neighbor_graph[i];
+    //   for (int j = 0; j < neighbors.size(); j++) ... neighbors[j] ...
+    class Row {
+      public:
+        Row(const int *_begin, const int *_end) : first(_begin), last(_end) {}
+
+        int size() const { return (int)(last - first); }
+        bool empty() const { return first == last; }
+        int operator[](int j) const { return first[j]; }
+
+        const int *begin() const { return first; }
+        const int *end() const { return last; }
+
+      private:
+        const int *first;
+        const int *last;
+    };
+
+    std::vector<int> offsets;  // size rows+1
+    std::vector<int> indices;  // m_index of the neighbor vertices
+
+    CNeighborGraph() {}
+
+    void clear() { offsets.clear(); indices.clear(); }
+    void swap(CNeighborGraph &other) { offsets.swap(other.offsets); indices.swap(other.indices); }
+    bool isEmpty() const { return offsets.empty(); }
+    int rowNum() const { return offsets.empty() ? 0 : (int)offsets.size() - 1; }
+    int pairNum() const { return (int)indices.size(); }
+
+    Row operator[](int i) const {
+      assert(i >= 0 && i < rowNum());
+      const int *base = indices.empty() ? 0 : &indices[0];
+      return Row(base + offsets[i], base + offsets[i+1]);
+    }
+};
+
+
+#endif
@@ -24,7 +24,6 @@
 #include <QtCore>
 #include <QMap>
 #include <QPair>
-#include <QAction>
 #include <vcg/math/matrix44.h>
 #include <iostream>
 using std::cout;
@@ -38,24 +37,16 @@ using namespace vcg;
 // Very similar to the findParameter but this one does not print out debugstuff. 
 bool RichParameterSet::hasParameter(QString name) const 
 {
-	QList<RichParameter*>::const_iterator fpli;
-	for(fpli=paramList.begin();fpli!=paramList.end();++fpli)
-	{
-		if((*fpli != NULL) && (*fpli)->name==name)
-			return true;
-	}	
-	return false; 
+	return paramIndex.contains(name);
 }
 // You should never use this one to know if a given parameter is present. 
 RichParameter* RichParameterSet::findParameter(QString name) const
 {
-	QList<RichParameter*>::const_iterator fpli;
-	for(fpli=paramList.begin();fpli!=paramList.end();++fpli)
-	{
-		if((*fpli != NULL) && (*fpli)->name==name)
-			return *fpli;
-	}
-	cout << "wrong name: " << name.toStdString() << endl;
+	RichParameter* found = paramIndex.value(name, NULL);
+	if (found != NULL)
+		return found;
+
+	cout << "wrong name: " << name.toStdString() << std::endl;
 	system("Pause");
 
 	qDebug("FilterParameter Warning: Unable to find a parameter with name '%s',\n"
@@ -66,18 +57,34 @@ RichParameter* RichParameterSet::findParameter(QString name) const
 
 RichParameterSet& RichParameterSet::removeParameter(QString name){
 	paramList.removeAll(findParameter(name));
+	rebuildIndex();
 	return (*this);
 }
 
+// the first parameter of a name wins, like the old linear search did
+void RichParameterSet::indexParameter(RichParameter* pd)
+{
+	if (pd != NULL && !paramIndex.contains(pd->name))
+		paramIndex.insert(pd->name, pd);
+}
+
+void RichParameterSet::rebuildIndex()
+{
+	paramIndex.clear();
+	for(int ii = 0;ii < paramList.size();++ii)
+		indexParameter(paramList.at(ii));
+}
+
 RichParameterSet& RichParameterSet::addParam(RichParameter* pd )
 {
 	assert(!hasParameter(pd->name));
 	if (hasParameter(pd->name))
 	{
-		std::cout << pd->name.toStdString() << endl;
+		std::cout << pd->name.toStdString() << std::endl;
 	}
 	
 	paramList.push_back(pd);
+	indexParameter(pd);
 	return (*this);
 }
 
@@ -131,6 +138,7 @@ RichParameterSet::~RichParameterSet()
 	for(int ii = 0;ii < paramList.size();++ii)
 		delete paramList.at(ii);
 	paramList.clear();
+	paramIndex.clear();
 
 }
 
@@ -143,6 +151,7 @@ RichParameterSet& RichParameterSet::copy( const RichParameterSet& rps )
 	{
 		rps.paramList.at(ii)->accept(copyvisitor);
 		paramList.push_back(copyvisitor.lastCreated);
+		indexParameter(copyvisitor.lastCreated);
 	}
 	return (*this);
 }
@@ -157,6 +166,7 @@ RichParameterSet::RichParameterSet( const RichParameterSet& rps )
 	{
 		rps.paramList.at(ii)->accept(copyvisitor);
 		paramList.push_back(copyvisitor.lastCreated);
+		indexParameter(copyvisitor.lastCreated);
 	}
 }
 
@@ -173,6 +183,7 @@ bool RichParameterSet::isEmpty() const
 void RichParameterSet::clear()
 {
 	paramList.clear();
+	paramIndex.clear();
 }
 
 RichParameterSet& RichParameterSet::join( const RichParameterSet& rps )
@@ -182,6 +193,7 @@ RichParameterSet& RichParameterSet::join( const RichParameterSet& rps )
 	{
 		rps.paramList.at(ii)->accept(copyvisitor);
 		paramList.push_back(copyvisitor.lastCreated);
+		indexParameter(copyvisitor.lastCreated);
 	}
 	return (*this);
 }
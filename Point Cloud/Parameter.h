@@ -27,9 +27,30 @@
 //#include <QtXml>
 
 #include <QMap>
+#include <QHash>
 #include<QString>
 #include <QPair>
+#ifdef QT_GUI_LIB
 #include <QAction>
+#include <QColor>
+#else
+// builds without QtGui (Batch/CMakeLists.txt) keep the color parameters
+// of the drawer as plain rgba, nothing reads them there
+class QColor
+{
+public:
+	QColor() : r(0), g(0), b(0), a(255) {}
+	QColor(int red, int green, int blue, int alpha = 255) : r(red), g(green), b(blue), a(alpha) {}
+	int red() const { return r; }
+	int green() const { return g; }
+	int blue() const { return b; }
+	int alpha() const { return a; }
+	bool operator==(const QColor& c) const { return r == c.r && g == c.g && b == c.b && a == c.a; }
+	bool operator!=(const QColor& c) const { return !(*this == c); }
+private:
+	int r, g, b, a;
+};
+#endif
 #include "CMesh.h"
 
 //enum TypeId {BOOL,INT,FLOAT,STRING,MATRIX44F,POINT3F,COLOR,ENUM,MESH,GROUP,FILENAME};
@@ -661,6 +682,8 @@ public:
 	// The data is just a list of Parameters
 	//QMap<QString, FilterParameter *> paramMap;  
 	QList<RichParameter*> paramList;  
+	// name -> parameter, kept in step with paramList so a lookup is a hash probe instead of a walk over the list
+	QHash<QString, RichParameter*> paramIndex;
 	bool isEmpty() const; 
 	//RichParameter* findParameter(QString name);
 	RichParameter* findParameter(QString name) const;
@@ -698,6 +721,10 @@ public:
 
 
 	~RichParameterSet();
+
+private:
+	void indexParameter(RichParameter* pd);
+	void rebuildIndex();
 };
 
 /****************************/
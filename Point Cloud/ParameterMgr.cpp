@@ -1,5 +1,9 @@
 #include "ParameterMgr.h"
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <stdlib.h>
+using namespace std;
 
 int ParameterMgr::init_time = 0;
 ParameterMgr global_paraMgr;
@@ -37,7 +41,7 @@ ParameterMgr::~ParameterMgr(void)
 
 
 
-void ParameterMgr::setGlobalParameter(QString paraName,Value& val)
+void ParameterMgr::setGlobalParameter(QString paraName,const Value& val)
 {
 	if(glarea.hasParameter(paraName))
 		glarea.setValue(paraName, val);
@@ -55,11 +59,176 @@ void ParameterMgr::setGlobalParameter(QString paraName,Value& val)
 		upsampling.setValue(paraName, val);
 }
 
+// the set names used in parameter files, same as the members
+RichParameterSet* ParameterMgr::getParameterSet(QString setName)
+{
+	if (setName == "glarea")     return &glarea;
+	if (setName == "data")       return &data;
+	if (setName == "drawer")     return &drawer;
+	if (setName == "wLop")       return &wLop;
+	if (setName == "norSmooth")  return &norSmooth;
+	if (setName == "skeleton")   return &skeleton;
+	if (setName == "upsampling") return &upsampling;
+	if (setName == "kinect")     return &m_kinect;
+	if (setName == "rigister")   return &m_rigister;
+	return NULL;
+}
+
+static string trimmed(const string& str)
+{
+	size_t begin = str.find_first_not_of(" \t\r\n");
+	if (begin == string::npos)
+	{
+		return string();
+	}
+	size_t end = str.find_last_not_of(" \t\r\n");
+	return str.substr(begin, end - begin + 1);
+}
+
+// parse text as the type of the existing parameter
+static bool setParameterFromText(RichParameterSet* set, QString name, const string& text)
+{
+	Value* val = set->findParameter(name)->val;
+	const char* begin = text.c_str();
+	char* end = NULL;
+
+	if (val->isBool())
+	{
+		if (text == "true" || text == "1")
+			set->setValue(name, BoolValue(true));
+		else if (text == "false" || text == "0")
+			set->setValue(name, BoolValue(false));
+		else
+			return false;
+	}
+	else if (val->isDouble())
+	{
+		double d = strtod(begin, &end);
+		if (end == begin || *end != 0)
+			return false;
+		set->setValue(name, DoubleValue(d));
+	}
+	else if (val->isInt())
+	{
+		long i = strtol(begin, &end, 10);
+		if (end == begin || *end != 0)
+			return false;
+		set->setValue(name, IntValue((int)i));
+	}
+	else if (val->isString())
+	{
+		set->setValue(name, StringValue(QString(begin)));
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+// a parameter file sets parameters by name, grouped under the set they belong to:
+//
+//   # comment
+//   [wLop]
+//   Num Of Iterate Time = 20
+//   Run Fused WLOP = true
+//
+//   [global]
+//   CGrid Radius = 0.05
+//
+// [global] sets the parameter in every set that has it, like setGlobalParameter().
+// only bool, int, double and string parameters can be set.
+bool ParameterMgr::loadParameterFile(QString fileName)
+{
+	ifstream infile(fileName.toStdString().c_str());
+	if (!infile.is_open())
+	{
+		cout << "ERROR: can not open parameter file " << fileName.toStdString() << endl;
+		return false;
+	}
+
+	RichParameterSet* all_sets[] = { &glarea, &data, &drawer, &wLop, &norSmooth, &skeleton, &upsampling };
+	int all_set_num = sizeof(all_sets) / sizeof(all_sets[0]);
+
+	string set_name;
+	string line;
+	int line_num = 0;
+	bool ok = true;
+	while (getline(infile, line))
+	{
+		line_num++;
+		line = trimmed(line);
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+
+		if (line[0] == '[' && line[line.size() - 1] == ']')
+		{
+			set_name = trimmed(line.substr(1, line.size() - 2));
+			if (set_name != "global" && getParameterSet(QString(set_name.c_str())) == NULL)
+			{
+				cout << "ERROR: line " << line_num << ": unknown parameter set " << set_name << endl;
+				ok = false;
+			}
+			continue;
+		}
+
+		size_t equal = line.find('=');
+		if (equal == string::npos || set_name.empty())
+		{
+			cout << "ERROR: line " << line_num << ": expected [set] or name = value" << endl;
+			ok = false;
+			continue;
+		}
+
+		QString name(trimmed(line.substr(0, equal)).c_str());
+		string text = trimmed(line.substr(equal + 1));
+
+		bool found = false;
+		bool parsed = true;
+		if (set_name == "global")
+		{
+			for (int i = 0; i < all_set_num; i++)
+			{
+				if (all_sets[i]->hasParameter(name))
+				{
+					found = true;
+					parsed = setParameterFromText(all_sets[i], name, text) && parsed;
+				}
+			}
+		}
+		else
+		{
+			RichParameterSet* set = getParameterSet(QString(set_name.c_str()));
+			if (set != NULL && set->hasParameter(name))
+			{
+				found = true;
+				parsed = setParameterFromText(set, name, text);
+			}
+		}
+
+		if (!found)
+		{
+			cout << "ERROR: line " << line_num << ": no parameter " << name.toStdString() << " in " << set_name << endl;
+			ok = false;
+		}
+		else if (!parsed)
+		{
+			cout << "ERROR: line " << line_num << ": bad value " << text << " for " << name.toStdString() << endl;
+			ok = false;
+		}
+	}
+	return ok;
+}
+
 void ParameterMgr::initDataMgrParameter()
 {
 	data.addParam(new RichDouble("Init Radius Para", 1.0));
 	data.addParam(new RichDouble("Down Sample Num", 1000));
 	data.addParam(new RichDouble("CGrid Radius", grid_r));
+	data.addParam(new RichBool("Use Point Cloud Cache", false));
+	data.addParam(new RichString("Density Cache Directory", ""));
 }
 
 
@@ -167,6 +336,9 @@ void ParameterMgr::initWLopParameter()
 	wLop.addParam(new RichDouble("Repulsion Mu", 0.5));
 	wLop.addParam(new RichDouble("Repulsion Mu2", 0.0));
 	wLop.addParam(new RichBool("Run Anisotropic LOP", false));
+	wLop.addParam(new RichBool("Use SIMD Kernels", true));
+	wLop.addParam(new RichBool("Run Fused WLOP", false));
+	wLop.addParam(new RichDouble("Neighbor Skin Ratio", 0.0));
 	wLop.addParam(new RichDouble("Current Movement Error", 0.0));
 }
 
@@ -185,6 +357,7 @@ void ParameterMgr::initSkeletonParameter()
 	skeleton.addParam(new RichDouble("CGrid Radius", grid_r));
 	skeleton.addParam(new RichDouble("H Gaussian Para", 4));
 	skeleton.addParam(new RichBool("Need Compute Density", true));
+	skeleton.addParam(new RichDouble("Neighbor Skin Ratio", 0.0));
 	
 	
 	skeleton.addParam(new RichDouble("Current Movement Error", 0.0));
@@ -276,6 +449,8 @@ void ParameterMgr::initNormalSmootherParameter()
 	norSmooth.addParam(new RichBool("Run Init Samples Using Normal", false));
 
 	norSmooth.addParam(new RichInt("Number Of Iterate", 1));
+	norSmooth.addParam(new RichBool("Run Double Buffered Smoothing", false));
+	norSmooth.addParam(new RichDouble("Smooth Converge Threshold", 0.0));
 	norSmooth.addParam(new RichInt("Number of KNN", 400));
 
 	norSmooth.addParam(new RichDouble("PCA Threshold", 0.8));
@@ -286,6 +461,11 @@ void ParameterMgr::initRigisterParameter()
 	m_rigister.addParam(new RichString("Algorithm Name","SparseICP"));
 	m_rigister.addParam(new RichDouble("test ui",10));
 	m_rigister.addParam(new RichDouble("input",100));
+	m_rigister.addParam(new RichInt("ICP Levels", 3)); // 0 runs the sparse icp on all the points
+	m_rigister.addParam(new RichDouble("ICP Voxel Ratio", 0.005));
+	m_rigister.addParam(new RichInt("ICP Mode", 0)); // Rigister::Mode, the levels only
+	m_rigister.addParam(new RichInt("ICP Robust Function", 0)); // SparseICP::ICP::Function, 0 for the p norm
+	m_rigister.addParam(new RichDouble("ICP Robust Parameter", 0.1));
 }
 
 void ParameterMgr::initUpsamplingParameter()
@@ -298,6 +478,8 @@ void ParameterMgr::initUpsamplingParameter()
 
 	upsampling.addParam(new RichBool("Using Threshold Process", true) );
 	upsampling.addParam(new RichDouble("Dist Threshold", 0.02));
+	upsampling.addParam(new RichBool("Use Priority Queue", false));
+	upsampling.addParam(new RichBool("Use Parallel Insertion", false));
 	upsampling.addParam(new RichDouble("Edge Parameter", 0.0));
 	upsampling.addParam(new RichDouble("Z Parameter", 0.1));
 
@@ -19,7 +19,9 @@ public:
 	RichParameterSet* getRigisterParameterSet(){return & m_rigister;}
 	//
 
-	void setGlobalParameter(QString paraName,Value& val);
+	void setGlobalParameter(QString paraName,const Value& val);
+	RichParameterSet* getParameterSet(QString setName);
+	bool loadParameterFile(QString fileName);
 	typedef enum {GLAREA, DATA, DRAWER, WLOP, NOR_SMOOTH, SKELETON, UPSAMPLING,KINECT}ParaType;
 
 private:
@@ -0,0 +1,42 @@
+#include "PointArrays.h"
+#include "CMesh.h"
+
+
+void CPointArrays::clear() {
+  positions.clear();
+  normals.clear();
+  flags.clear();
+  eigen_confidence.clear();
+  eigen_vector0.clear();
+  eigen_vector1.clear();
+}
+
+void CPointArrays::load(const std::vector<CVertex> &vert) {
+  int n = (int)vert.size();
+  positions.resize(n);
+  normals.resize(n);
+  flags.resize(n);
+  eigen_confidence.resize(n);
+  eigen_vector0.resize(n);
+  eigen_vector1.resize(n);
+
+#pragma omp parallel for
+  for(int i = 0; i < n; i++) {
+    const CVertex &v = vert[i];
+    positions[i] = v.cP();
+    normals[i] = v.cN();
+
+    unsigned char f = 0;
+    if(v.bIsOriginal)       f |= ORIGINAL;
+    if(v.is_fixed_sample)   f |= FIXED_SAMPLE;
+    if(v.is_skel_ignore)    f |= SKEL_IGNORE;
+    if(v.is_skel_virtual)   f |= SKEL_VIRTUAL;
+    if(v.is_skel_branch)    f |= SKEL_BRANCH;
+    if(v.is_fixed_original) f |= FIXED_ORIGINAL;
+    flags[i] = f;
+
+    eigen_confidence[i] = v.eigen_confidence;
+    eigen_vector0[i] = v.eigen_vector0;
+    eigen_vector1[i] = v.eigen_vector1;
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef POINT_ARRAYS_H
+#define POINT_ARRAYS_H
+
+#include <vector>
+#include <vcg/space/point3.h>
+
+class CVertex;
+
+
+// the hot fields of a mesh, one contiguous array per field.
+// a CVertex is well over a hundred bytes (color, two neighbor vectors,
+// eigen frame, flags...) while the WLOP loops only read the position,
+// so they run over these arrays instead of the vertices.
+// the vertices stay the master copy, load() takes a snapshot of them.
+class CPointArrays {
+  public:
+    enum Flag {
+      ORIGINAL       = 1 << 0,
+      FIXED_SAMPLE   = 1 << 1,
+      SKEL_IGNORE    = 1 << 2,
+      SKEL_VIRTUAL   = 1 << 3,
+      SKEL_BRANCH    = 1 << 4,
+      FIXED_ORIGINAL = 1 << 5
+    };
+
+    std::vector<vcg::Point3f> positions;
+    std::vector<vcg::Point3f> normals;
+    std::vector<unsigned char> flags;       // Flag bits
+    std::vector<double> eigen_confidence;
+    std::vector<vcg::Point3f> eigen_vector0;
+    std::vector<vcg::Point3f> eigen_vector1;
+
+    CPointArrays() {}
+
+    void load(const std::vector<CVertex> &vert);
+    void clear();
+
+    int size() const { return (int)positions.size(); }
+    bool isEmpty() const { return positions.empty(); }
+    bool hasFlag(int i, Flag f) const { return (flags[i] & f) != 0; }
+
+    // bytes per point of the arrays above
+    static int bytesPerPoint() {
+      return 4 * sizeof(vcg::Point3f) + sizeof(unsigned char) + sizeof(double);
+    }
+};
+
+
+#endif
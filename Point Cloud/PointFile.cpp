@@ -0,0 +1,265 @@
+#include "PointFile.h"
+#include "MappedFile.h"
+#include "SkelFile.h"
+#include "CMesh.h"
+
+#include <cmath>
+#include <cstdio>
+#include <omp.h>
+
+using namespace SkelFile;
+
+
+namespace {
+
+  inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+  }
+
+  inline const char *skipSpaces(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == ',')) {
+      p++;
+    }
+    return p;
+  }
+
+  double power10(int exponent) {
+    static const double table[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    if (exponent >= 0 && exponent <= 22) {
+      return table[exponent];
+    }
+    return pow(10.0, exponent);
+  }
+
+  // [+-]digits[.digits][(e|E)[+-]digits], up to 19 significant digits are
+  // kept exactly and scaled once by a power of ten. p moves past the number
+  bool parseFloat(const char *&p, const char *end, float &value) {
+    const char *s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) {
+      negative = (*s == '-');
+      s++;
+    }
+
+    unsigned long long mantissa = 0;
+    int digit_num = 0;
+    int exponent = 0;
+    bool has_digits = false;
+    for (; s < end && isDigit(*s); s++) {
+      has_digits = true;
+      if (digit_num < 19) {
+        mantissa = mantissa * 10 + (*s - '0');
+        digit_num += (mantissa != 0);
+      } else {
+        exponent++;
+      }
+    }
+    if (s < end && *s == '.') {
+      for (s++; s < end && isDigit(*s); s++) {
+        has_digits = true;
+        if (digit_num < 19) {
+          mantissa = mantissa * 10 + (*s - '0');
+          digit_num += (mantissa != 0);
+          exponent--;
+        }
+      }
+    }
+    if (!has_digits) {
+      return false;
+    }
+
+    if (s < end && (*s == 'e' || *s == 'E')) {
+      const char *e = s + 1;
+      bool negative_exponent = false;
+      if (e < end && (*e == '-' || *e == '+')) {
+        negative_exponent = (*e == '-');
+        e++;
+      }
+      if (e < end && isDigit(*e)) {
+        int written_exponent = 0;
+        for (; e < end && isDigit(*e); e++) {
+          if (written_exponent < 10000) {
+            written_exponent = written_exponent * 10 + (*e - '0');
+          }
+        }
+        exponent += negative_exponent ? -written_exponent : written_exponent;
+        s = e;
+      }
+    }
+
+    double result = (double)mantissa;
+    if (mantissa != 0) {
+      result = exponent < 0 ? result / power10(-exponent) : result * power10(exponent);
+    }
+    value = (float)(negative ? -result : result);
+    p = s;
+    return true;
+  }
+
+  // the first six numbers of the line at p, p moves to the next line
+  int parseLine(const char *&p, const char *end, float *values) {
+    int value_num = 0;
+    while (p < end && *p != '\n') {
+      p = skipSpaces(p, end);
+      if (p >= end || *p == '\n') {
+        break;
+      }
+      if (value_num < 6 && parseFloat(p, end, values[value_num])) {
+        value_num++;
+        continue;
+      }
+      // words, comments and numbers after the sixth end the line
+      while (p < end && *p != '\n') {
+        p++;
+      }
+    }
+    if (p < end) {
+      p++;
+    }
+    return value_num;
+  }
+}
+
+
+bool CPointFile::loadXYZN(const char *file_name, std::vector<CVertex> &vert) {
+  vert.clear();
+
+  CMappedFile file;
+  if (!file.open(file_name)) {
+    return false;
+  }
+  const char *data = file.data();
+  size_t size = file.size();
+
+  // every chunk begins at the start of a line
+  int chunk_num = omp_get_max_threads() * 4;
+  std::vector<size_t> chunk_begins(chunk_num + 1, size);
+  chunk_begins[0] = 0;
+  for (int c = 1; c < chunk_num; c++) {
+    size_t begin = std::max(std::max(size / chunk_num * c, chunk_begins[c - 1]), (size_t)1);
+    while (begin < size && data[begin - 1] != '\n') {
+      begin++;
+    }
+    chunk_begins[c] = begin;
+  }
+
+  std::vector<std::vector<PointRecord> > chunk_points(chunk_num);
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int c = 0; c < chunk_num; c++) {
+    const char *p = data + chunk_begins[c];
+    const char *end = data + chunk_begins[c + 1];
+    std::vector<PointRecord> &points = chunk_points[c];
+    points.reserve((end - p) / 24);
+
+    while (p < end) {
+      float values[6] = {0, 0, 0, 0, 0, 0};
+      if (parseLine(p, end, values) >= 3) {
+        PointRecord point;
+        for (int k = 0; k < 3; k++) {
+          point.p[k] = values[k];
+          point.n[k] = values[k + 3];
+        }
+        points.push_back(point);
+      }
+    }
+  }
+
+  std::vector<int> chunk_offsets(chunk_num + 1, 0);
+  for (int c = 0; c < chunk_num; c++) {
+    chunk_offsets[c + 1] = chunk_offsets[c] + (int)chunk_points[c].size();
+  }
+  vert.resize(chunk_offsets[chunk_num]);
+
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int c = 0; c < chunk_num; c++) {
+    std::vector<PointRecord> &points = chunk_points[c];
+    for (int i = 0; i < (int)points.size(); i++) {
+      CVertex &v = vert[chunk_offsets[c] + i];
+      v.P() = vcg::Point3f(points[i].p[0], points[i].p[1], points[i].p[2]);
+      v.N() = vcg::Point3f(points[i].n[0], points[i].n[1], points[i].n[2]);
+    }
+    std::vector<PointRecord>().swap(points);
+  }
+  return true;
+}
+
+
+std::string CPointFile::cacheName(const char *file_name) {
+  return std::string(file_name) + ".pcache";
+}
+
+bool CPointFile::loadCache(const char *file_name, std::vector<CVertex> &vert) {
+  SourceRecord stamp;
+  if (!CMappedFile::getFileStamp(file_name, stamp.size, stamp.modified_time)) {
+    return false;
+  }
+
+  std::string cache_name = cacheName(file_name);
+  if (!CSkelFileReader::isSkelFile(cache_name.c_str())) {
+    return false;
+  }
+  CSkelFileReader reader;
+  if (!reader.open(cache_name.c_str())) {
+    return false;
+  }
+
+  size_t num = 0;
+  const SourceRecord *source = (const SourceRecord *)reader.section(SOURCE, sizeof(SourceRecord), num);
+  if (num != 1 || source->size != stamp.size || source->modified_time != stamp.modified_time) {
+    printf("point cache is out of date: %s\n", cache_name.c_str());
+    return false;
+  }
+
+  const PointRecord *points = (const PointRecord *)reader.section(ORIGINAL, sizeof(PointRecord), num);
+  if (points == NULL) {
+    return false;
+  }
+  vert.resize(num);
+#pragma omp parallel for schedule(dynamic, 4096)
+  for (int i = 0; i < (int)num; i++) {
+    vert[i].P() = vcg::Point3f(points[i].p[0], points[i].p[1], points[i].p[2]);
+    vert[i].N() = vcg::Point3f(points[i].n[0], points[i].n[1], points[i].n[2]);
+  }
+  return true;
+}
+
+bool CPointFile::saveCache(const char *file_name, const std::vector<CVertex> &vert) {
+  SourceRecord stamp;
+  if (!CMappedFile::getFileStamp(file_name, stamp.size, stamp.modified_time)) {
+    return false;
+  }
+
+  std::string cache_name = cacheName(file_name);
+  CSkelFileWriter writer;
+  if (!writer.open(cache_name.c_str())) {
+    printf("can not write the point cache %s\n", cache_name.c_str());
+    return false;
+  }
+
+  writer.beginSection(SOURCE, sizeof(SourceRecord), 1);
+  writer.write(&stamp, 1);
+  writer.endSection();
+
+  const int CHUNK_SIZE = 4096;
+  std::vector<PointRecord> points;
+  points.reserve(CHUNK_SIZE);
+  writer.beginSection(ORIGINAL, sizeof(PointRecord), vert.size());
+  for (int i = 0; i < (int)vert.size(); i++) {
+    PointRecord point;
+    for (int k = 0; k < 3; k++) {
+      point.p[k] = vert[i].cP()[k];
+      point.n[k] = vert[i].cN()[k];
+    }
+    points.push_back(point);
+    if ((int)points.size() == CHUNK_SIZE || i == (int)vert.size() - 1) {
+      writer.write(&points[0], points.size());
+      points.clear();
+    }
+  }
+  writer.endSection();
+
+  return writer.close();
+}
@@ -0,0 +1,30 @@
+#ifndef POINT_FILE_H
+#define POINT_FILE_H
+
+#include <string>
+#include <vector>
+
+class CVertex;
+
+
+// ascii point files, one "x y z [nx ny nz]" per line, and their binary cache.
+//
+// the file is mapped and cut into line aligned chunks that are parsed in
+// parallel, then the vertices are made in one go. the cache is a SkelFile
+// container next to the file (file_name + ".pcache") with the points and the
+// size and time of the file, a file that changed since is parsed again.
+class CPointFile {
+  public:
+    // lines with less than three numbers are skipped, missing normals are zero.
+    // only P() and N() of the vertices are set
+    static bool loadXYZN(const char *file_name, std::vector<CVertex> &vert);
+
+    static bool loadCache(const char *file_name, std::vector<CVertex> &vert);
+    static bool saveCache(const char *file_name, const std::vector<CVertex> &vert);
+
+  private:
+    static std::string cacheName(const char *file_name);
+};
+
+
+#endif
@@ -0,0 +1,158 @@
+#include "SkelFile.h"
+
+#include <cstring>
+#include <cstdio>
+
+using namespace SkelFile;
+
+
+namespace {
+
+  const char MAGIC[8] = {'P', 'C', 'S', 'K', 'E', 'L', 'B', '\0'};
+
+  // the table is written last, the header points at it
+  struct Header {
+    char magic[8];
+    unsigned int version;
+    unsigned int section_num;
+    unsigned long long table_offset;
+  };
+}
+
+
+bool CSkelFileWriter::open(const char *file_name) {
+  sections.clear();
+  written = 0;
+  in_section = false;
+
+  file.open(file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    return false;
+  }
+  writeHeader(0);
+  written = sizeof(Header);
+  return file.good();
+}
+
+void CSkelFileWriter::writeHeader(unsigned long long table_offset) {
+  Header header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.section_num = (unsigned int)sections.size();
+  header.table_offset = table_offset;
+  file.write((const char *)&header, sizeof(header));
+}
+
+void CSkelFileWriter::pad() {
+  static const char zeros[8] = {0};
+  int padding = (int)((8 - written % 8) % 8);
+  file.write(zeros, padding);
+  written += padding;
+}
+
+void CSkelFileWriter::beginSection(unsigned int id, unsigned int record_size, size_t count) {
+  if (in_section) {
+    endSection();
+  }
+  pad();
+
+  SectionEntry entry;
+  entry.id = id;
+  entry.record_size = record_size;
+  entry.count = count;
+  entry.offset = written;
+  sections.push_back(entry);
+  in_section = true;
+}
+
+void CSkelFileWriter::write(const void *records, size_t count) {
+  size_t bytes = count * sections.back().record_size;
+  file.write((const char *)records, bytes);
+  written += bytes;
+}
+
+void CSkelFileWriter::endSection() {
+  in_section = false;
+}
+
+bool CSkelFileWriter::close() {
+  if (!file.is_open()) {
+    return false;
+  }
+  if (in_section) {
+    endSection();
+  }
+  pad();
+
+  // the table, then the header again now that it knows where the table is
+  unsigned long long table_offset = written;
+  if (!sections.empty()) {
+    file.write((const char *)&sections[0], sections.size() * sizeof(SectionEntry));
+  }
+  file.seekp(0);
+  writeHeader(table_offset);
+
+  bool ok = file.good();
+  file.close();
+  return ok;
+}
+
+
+CSkelFileReader::CSkelFileReader() : table(NULL), section_num(0) {
+}
+
+bool CSkelFileReader::isSkelFile(const char *file_name) {
+  char magic[sizeof(MAGIC)];
+  std::ifstream file(file_name, std::ios::in | std::ios::binary);
+  return file.read(magic, sizeof(magic)) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+bool CSkelFileReader::open(const char *file_name) {
+  close();
+  if (!file.open(file_name)) {
+    return false;
+  }
+
+  // header and table must be inside the file
+  const char *data = file.data();
+  size_t size = file.size();
+  const Header *header = (const Header *)data;
+  bool valid = size >= sizeof(Header)
+               && memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0
+               && header->version == VERSION
+               && header->table_offset <= size
+               && header->section_num <= (size - header->table_offset) / sizeof(SectionEntry);
+  if (!valid) {
+    printf("not a version %d binary skeleton: %s\n", (int)VERSION, file_name);
+    close();
+    return false;
+  }
+  table = (const SectionEntry *)(data + header->table_offset);
+  section_num = header->section_num;
+  return true;
+}
+
+void CSkelFileReader::close() {
+  file.close();
+  table = NULL;
+  section_num = 0;
+}
+
+const void *CSkelFileReader::section(unsigned int id, unsigned int record_size, size_t &count) const {
+  count = 0;
+  for (unsigned int i = 0; i < section_num; i++) {
+    const SectionEntry &entry = table[i];
+    if (entry.id != id) {
+      continue;
+    }
+    size_t size = file.size();
+    if (entry.record_size != record_size || entry.offset > size
+        || entry.count > (size - entry.offset) / record_size) {
+      printf("broken skeleton section %x\n", id);
+      return NULL;
+    }
+    count = (size_t)entry.count;
+    return file.data() + entry.offset;
+  }
+  return NULL;
+}
@@ -0,0 +1,137 @@
+#ifndef SKEL_FILE_H
+#define SKEL_FILE_H
+
+#include <cstddef>
+#include <fstream>
+#include <vector>
+
+#include "MappedFile.h"
+
+
+// binary skeleton container (.bskel), the content of the text .skel as
+// fixed width sections:
+//
+//   header    magic "PCSKELB", version, number of sections
+//   table     per section: id, bytes per record, record count, byte offset
+//   sections  arrays of little endian records, each at an 8 byte aligned offset
+//
+// the writer streams every section to the file in chunks of any size and
+// writes the table last. the reader maps the file and hands out pointers into
+// the mapping, so the sections nobody asks for are never read from disk.
+// DataMgr::saveSkeletonAsSkel and loadSkeletonFromSkel convert to and from
+// the text format.
+namespace SkelFile {
+
+  enum { VERSION = 1 };
+
+  // section ids
+  enum Section {
+    ORIGINAL = 0x4749524f,  // "ORIG", PointRecord per original point
+    SAMPLES  = 0x504d4153,  // "SAMP", SampleRecord per sample
+    BRANCHES = 0x48435242,  // "BRCH", unsigned int per branch + 1, first node of every branch
+    NODES    = 0x45444f4e,  // "NODE", NodeRecord per skeleton node, branch after branch
+    SOURCE   = 0x45435253,  // "SRCE", one SourceRecord, the file a point cache was made from
+    DENS_KEY = 0x59454b44,  // "DKEY", one DensityRecord, what a density cache was computed for
+    DENSITY  = 0x534e4544   // "DENS", double per original point
+  };
+
+  enum Flag {
+    FIXED_SAMPLE = 1 << 0,
+    SKEL_VIRTUAL = 1 << 1,
+    SKEL_BRANCH  = 1 << 2
+  };
+
+  struct PointRecord {
+    float p[3];
+    float n[3];
+  };
+
+  struct SampleRecord {
+    float p[3];
+    float n[3];
+    double eigen_confidence;
+    unsigned int flags;      // Flag bits
+    unsigned int reserved;
+  };
+
+  struct NodeRecord {
+    double skel_radius;
+    float p[3];
+    int sample_index;
+    unsigned int flags;      // Flag bits
+    unsigned int reserved;
+  };
+
+  struct SourceRecord {
+    unsigned long long size;
+    long long modified_time;
+  };
+
+  struct DensityRecord {
+    unsigned long long point_hash;
+    unsigned long long point_num;
+    double radius;
+    double h_gaussian;
+  };
+
+  struct SectionEntry {
+    unsigned int id;
+    unsigned int record_size;
+    unsigned long long count;
+    unsigned long long offset;
+  };
+}
+
+
+class CSkelFileWriter {
+  public:
+    CSkelFileWriter() : written(0), in_section(false) {}
+
+    bool open(const char *file_name);
+
+    // a section of count records, then write() them in as many chunks as wanted
+    void beginSection(unsigned int id, unsigned int record_size, size_t count);
+    void write(const void *records, size_t count);
+    void endSection();
+
+    // writes the section table, false if anything failed
+    bool close();
+
+  private:
+    void writeHeader(unsigned long long table_offset);
+    void pad();
+
+    std::ofstream file;
+    std::vector<SkelFile::SectionEntry> sections;
+    unsigned long long written;
+    bool in_section;
+};
+
+
+class CSkelFileReader {
+  public:
+    CSkelFileReader();
+    ~CSkelFileReader() { close(); }
+
+    // true if the file starts with the magic of the binary format
+    static bool isSkelFile(const char *file_name);
+
+    bool open(const char *file_name);
+    void close();
+    bool isOpen() const { return file.isOpen(); }
+
+    // the records of a section in the mapping, NULL if the file has no such
+    // section or its records are not record_size bytes
+    const void *section(unsigned int id, unsigned int record_size, size_t &count) const;
+
+  private:
+    CSkelFileReader(const CSkelFileReader &);
+    CSkelFileReader &operator=(const CSkelFileReader &);
+
+    CMappedFile file;
+    const SkelFile::SectionEntry *table;
+    unsigned int section_num;
+};
+
+
+#endif
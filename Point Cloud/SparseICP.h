@@ -65,6 +65,56 @@ namespace SparseICP
 		};
 	}
 
+	/////////////////////////////////////////////////////////////////
+	/// Closest points of a moving source in a fixed target (two points at least).
+	/// Every search keeps the distances d1 <= d2 of the two nearest target points.
+	/// While the source point moves less than (d2 - d1)/2 from where it was searched
+	/// the first one is still the nearest, so it is kept and the point is not searched.
+	class ClosestPoints
+	{
+	public:
+		typedef Mynanoflann::KDTreeAdaptor<Eigen::Matrix3Xd, 3, nanoflann::metric_L2_Simple> KDTree;
+
+		ClosestPoints(const Eigen::Matrix3Xd& Y) : kdtree(Y), search_num(0), query_num(0) {}
+
+		/// index[i] becomes the closest point of Y to X.col(i)
+		void update(const Eigen::Matrix3Xd& X)
+		{
+			if(int(index.size()) != X.cols())
+			{
+				index.assign(X.cols(), 0);
+				margin = Eigen::VectorXd::Constant(X.cols(), -1.0);
+				searched = X;
+			}
+			int searches = 0;
+#pragma omp parallel for reduction(+:searches)
+			for(int i=0; i<X.cols(); ++i)
+			{
+				if((X.col(i) - searched.col(i)).norm() < margin(i)) continue;
+				/// the columns are not contiguous with EIGEN_DEFAULT_TO_ROW_MAJOR
+				Eigen::Vector3d query = X.col(i);
+				int ids[2];
+				double dist2[2];
+				kdtree.query(query.data(), 2, ids, dist2);
+				index[i] = ids[0];
+				margin(i) = 0.5*(std::sqrt(dist2[1]) - std::sqrt(dist2[0]));
+				searched.col(i) = query;
+				searches++;
+			}
+			search_num += searches;
+			query_num += X.cols();
+		}
+
+		KDTree kdtree;
+		std::vector<int> index;
+		long long search_num;   /// points searched in the kd-tree
+		long long query_num;    /// points asked for over all the updates
+
+	private:
+		Eigen::VectorXd margin;
+		Eigen::Matrix3Xd searched;
+	};
+
 	/////////////////////////////////////////////////////////////////
 	//Compute the rigid motion for point-to-point and point-to-plane distances
 	namespace RigidMotionEstimator 
@@ -144,6 +194,40 @@ namespace SparseICP
 		{
 			return point_to_point(X, Y, Eigen::VectorXd::Ones(X.cols()));
 		}
+		/// The rigid motion that moves X closest to Y, X and Y are left as they are
+		/// @param Source (one 3D point per column)
+		/// @param Target (one 3D point per column)
+		/// @param Confidence weights
+		template <typename Derived1, typename Derived2, typename Derived3>
+		Eigen::Affine3d rigid_motion(const Eigen::MatrixBase<Derived1>& X,
+			const Eigen::MatrixBase<Derived2>& Y,
+			const Eigen::MatrixBase<Derived3>& w)
+		{
+			Eigen::VectorXd w_normalized = w/w.sum();
+			Eigen::Vector3d X_mean = X * w_normalized;
+			Eigen::Vector3d Y_mean = Y * w_normalized;
+			Eigen::Matrix3d sigma = (X.colwise() - X_mean) * w_normalized.asDiagonal() * (Y.colwise() - Y_mean).transpose();
+			Eigen::JacobiSVD<Eigen::Matrix3d> svd(sigma, Eigen::ComputeFullU | Eigen::ComputeFullV);
+			Eigen::Affine3d transformation;
+			if(svd.matrixU().determinant()*svd.matrixV().determinant() < 0.0)//contains reflection
+			{
+				Eigen::Vector3d S = Eigen::Vector3d::Ones(); S(2) = -1.0;
+				transformation.linear().noalias() = svd.matrixV()*S.asDiagonal()*svd.matrixU().transpose();
+			} else 
+			{
+				transformation.linear().noalias() = svd.matrixV()*svd.matrixU().transpose();
+			}
+			transformation.translation().noalias() = Y_mean - transformation.linear()*X_mean;
+			return transformation;
+		}
+		/// @param Source (one 3D point per column)
+		/// @param Target (one 3D point per column)
+		template <typename Derived1, typename Derived2>
+		inline Eigen::Affine3d rigid_motion(const Eigen::MatrixBase<Derived1>& X,
+			const Eigen::MatrixBase<Derived2>& Y)
+		{
+			return rigid_motion(X, Y, Eigen::VectorXd::Ones(X.cols()));
+		}
 		/// @param Source (one 3D point per column)
 		/// @param Target (one 3D point per column)
 		/// @param Target normals (one 3D normal per column)
@@ -212,8 +296,8 @@ namespace SparseICP
 			/// Re-apply mean
 			X.colwise() += X_mean;
 			Y.colwise() += X_mean;
-			/// Return transformation
-			return transformation;
+			/// Return the motion X went through
+			return Eigen::Translation3d(X_mean) * transformation * Eigen::Translation3d(-X_mean);
 		}
 		/// @param Source (one 3D point per column)
 		/// @param Target (one 3D point per column)
@@ -318,7 +402,8 @@ namespace SparseICP
 #pragma omp parallel for
 				for(int i=0; i<X.cols(); ++i) //Step One
 				{
-					unsigned int mp = kdtree.closest(X.col(i).data());
+					Eigen::Vector3d query = X.col(i);
+					unsigned int mp = kdtree.closest(query.data());
 					Q.col(i) = Y.col(mp/*kdtree.closest(X.col(i).data())*/);//Yҳصĵiĵ㣬QҶӦ
 					verMap(i) = mp;
 				}
@@ -357,6 +442,74 @@ namespace SparseICP
 				if(stop < par.stop) break;
 			}
 		}
+		/// Sparse ICP with point to point that returns the motion instead of moving the source.
+		/// X0 is moved by init once, then only this working copy is moved by the ADMM steps
+		/// and every step is composed onto the motion.
+		/// @param Source (one 3D point per column)
+		/// @param Target (one 3D point per column)
+		/// @param Closest points in the target
+		/// @param Motion of the source to start from
+		/// @param Parameters
+		/// @return init followed by the motion found
+		inline Eigen::Affine3d point_to_point_motion(const Eigen::Matrix3Xd& X0,
+			const Eigen::Matrix3Xd& Y,
+			ClosestPoints& closest,
+			const Eigen::Affine3d& init,
+			Parameters par = Parameters()) 
+		{
+			/// Buffers
+			Eigen::Affine3d motion = init;
+			Eigen::Matrix3Xd X = motion * X0;
+			Eigen::Matrix3Xd Q = Eigen::Matrix3Xd::Zero(3, X.cols());
+			Eigen::Matrix3Xd Z = Eigen::Matrix3Xd::Zero(3, X.cols());
+			Eigen::Matrix3Xd C = Eigen::Matrix3Xd::Zero(3, X.cols());
+			Eigen::Matrix3Xd Xo1 = X;
+			Eigen::Matrix3Xd Xo2 = X;
+			/// ICP
+			for(int icp=0; icp<par.max_icp; ++icp)
+			{
+				/// Find closest point
+				closest.update(X);
+				for(int i=0; i<X.cols(); ++i)
+				{
+					Q.col(i) = Y.col(closest.index[i]);
+				}
+				/// Computer rotation and translation
+				double mu = par.mu;
+				for(int outer=0; outer<par.max_outer; ++outer)
+				{
+					double dual = 0.0;
+					for(int inner=0; inner<par.max_inner; ++inner) 
+					{
+						/// Z update (shrinkage)
+						Z = X-Q+C/mu;
+						shrink<3>(Z, mu, par.p);
+						/// Rotation and translation update
+						Eigen::Matrix3Xd U = Q+Z-C/mu;
+						Eigen::Affine3d step = RigidMotionEstimator::rigid_motion(X, U);
+						X = step * X;
+						motion = step * motion;
+						/// Stopping criteria
+						dual = (X-Xo1).colwise().norm().maxCoeff();
+						Xo1 = X;
+						if(dual < par.stop) break;
+					}
+					/// C update (lagrange multipliers)
+					Eigen::Matrix3Xd P = X-Q-Z;
+					if(!par.use_penalty) C.noalias() += mu*P;
+					/// mu update (penalty)
+					if(mu < par.max_mu) mu *= par.alpha;
+					/// Stopping criteria
+					double primal = P.colwise().norm().maxCoeff();
+					if(primal < par.stop && dual < par.stop) break;
+				}
+				/// Stopping criteria
+				double stop = (X-Xo2).colwise().norm().maxCoeff();
+				Xo2 = X;
+				if(stop < par.stop) break;
+			}
+			return motion;
+		}
 		/// Sparse ICP with point to plane
 		/// @param Source (one 3D point per column)
 		/// @param Target (one 3D point per column)
@@ -421,6 +574,76 @@ namespace SparseICP
 				if(stop < par.stop) break;
 			}
 		}
+		/// Sparse ICP with point to plane that returns the motion instead of moving the source,
+		/// like point_to_point_motion
+		/// @param Source (one 3D point per column)
+		/// @param Target (one 3D point per column)
+		/// @param Target normals (one 3D normal per column)
+		/// @param Closest points in the target
+		/// @param Motion of the source to start from
+		/// @param Parameters
+		/// @return init followed by the motion found
+		inline Eigen::Affine3d point_to_plane_motion(const Eigen::Matrix3Xd& X0,
+			const Eigen::Matrix3Xd& Y,
+			const Eigen::Matrix3Xd& N,
+			ClosestPoints& closest,
+			const Eigen::Affine3d& init,
+			Parameters par = Parameters()) 
+		{
+			/// Buffers
+			Eigen::Affine3d motion = init;
+			Eigen::Matrix3Xd X = motion * X0;
+			Eigen::Matrix3Xd Qp = Eigen::Matrix3Xd::Zero(3, X.cols());
+			Eigen::Matrix3Xd Qn = Eigen::Matrix3Xd::Zero(3, X.cols());
+			Eigen::VectorXd Z = Eigen::VectorXd::Zero(X.cols());
+			Eigen::VectorXd C = Eigen::VectorXd::Zero(X.cols());
+			Eigen::VectorXd W = Eigen::VectorXd::Ones(X.cols());
+			Eigen::Matrix3Xd Xo1 = X;
+			Eigen::Matrix3Xd Xo2 = X;
+			/// ICP
+			for(int icp=0; icp<par.max_icp; ++icp)
+			{
+				/// Find closest point
+				closest.update(X);
+				for(int i=0; i<X.cols(); ++i)
+				{
+					Qp.col(i) = Y.col(closest.index[i]);
+					Qn.col(i) = N.col(closest.index[i]);
+				}
+				/// Computer rotation and translation
+				double mu = par.mu;
+				for(int outer=0; outer<par.max_outer; ++outer)
+				{
+					double dual = 0.0;
+					for(int inner=0; inner<par.max_inner; ++inner) 
+					{
+						/// Z update (shrinkage)
+						Z = (Qn.array()*(X-Qp).array()).colwise().sum().transpose()+C.array()/mu;
+						shrink<3>(Z, mu, par.p);
+						/// Rotation and translation update
+						Eigen::VectorXd U = Z-C/mu;
+						motion = RigidMotionEstimator::point_to_plane(X, Qp, Qn, W, U) * motion;
+						/// Stopping criteria
+						dual = (X-Xo1).colwise().norm().maxCoeff();
+						Xo1 = X;
+						if(dual < par.stop) break;
+					}
+					/// C update (lagrange multipliers)
+					Eigen::VectorXd P = (Qn.array()*(X-Qp).array()).colwise().sum().transpose()-Z.array();
+					if(!par.use_penalty) C.noalias() += mu*P;
+					/// mu update (penalty)
+					if(mu < par.max_mu) mu *= par.alpha;
+					/// Stopping criteria
+					double primal = P.array().abs().maxCoeff();
+					if(primal < par.stop && dual < par.stop) break;
+				}
+				/// Stopping criteria
+				double stop = (X-Xo2).colwise().norm().maxCoeff();
+				Xo2 = X;
+				if(stop < par.stop) break;
+			}
+			return motion;
+		}
 	}
 
 	///////////////////////////////////////////////////////////////////////////////
@@ -628,6 +851,110 @@ namespace SparseICP
 				if(stop2 < par.stop) break;
 			}
 		}
+		/// Reweighted ICP with point to point that returns the motion instead of moving the source
+		/// @param Source (one 3D point per column)
+		/// @param Target (one 3D point per column)
+		/// @param Closest points in the target
+		/// @param Motion of the source to start from
+		/// @param Parameters
+		/// @return init followed by the motion found
+		inline Eigen::Affine3d point_to_point_motion(const Eigen::Matrix3Xd& X0,
+			const Eigen::Matrix3Xd& Y,
+			ClosestPoints& closest,
+			const Eigen::Affine3d& init,
+			Parameters par = Parameters()) 
+		{
+			/// Buffers
+			Eigen::Affine3d motion = init;
+			Eigen::Matrix3Xd X = motion * X0;
+			Eigen::Matrix3Xd Q = Eigen::Matrix3Xd::Zero(3, X.cols());
+			Eigen::VectorXd W = Eigen::VectorXd::Zero(X.cols());
+			Eigen::Matrix3Xd Xo1 = X;
+			Eigen::Matrix3Xd Xo2 = X;
+			/// ICP
+			for(int icp=0; icp<par.max_icp; ++icp) 
+			{
+				/// Find closest point
+				closest.update(X);
+				for(int i=0; i<X.cols(); ++i)
+				{
+					Q.col(i) = Y.col(closest.index[i]);
+				}
+				/// Computer rotation and translation
+				for(int outer=0; outer<par.max_outer; ++outer) 
+				{
+					/// Compute weights
+					W = (X-Q).colwise().norm();
+					robust_weight(par.f, W, par.p);
+					/// Rotation and translation update
+					Eigen::Affine3d step = RigidMotionEstimator::rigid_motion(X, Q, W);
+					X = step * X;
+					motion = step * motion;
+					/// Stopping criteria
+					double stop1 = (X-Xo1).colwise().norm().maxCoeff();
+					Xo1 = X;
+					if(stop1 < par.stop) break;
+				}
+				/// Stopping criteria
+				double stop2 = (X-Xo2).colwise().norm().maxCoeff();
+				Xo2 = X;
+				if(stop2 < par.stop) break;
+			}
+			return motion;
+		}
+		/// Reweighted ICP with point to plane that returns the motion instead of moving the source
+		/// @param Source (one 3D point per column)
+		/// @param Target (one 3D point per column)
+		/// @param Target normals (one 3D normal per column)
+		/// @param Closest points in the target
+		/// @param Motion of the source to start from
+		/// @param Parameters
+		/// @return init followed by the motion found
+		inline Eigen::Affine3d point_to_plane_motion(const Eigen::Matrix3Xd& X0,
+			const Eigen::Matrix3Xd& Y,
+			const Eigen::Matrix3Xd& N,
+			ClosestPoints& closest,
+			const Eigen::Affine3d& init,
+			Parameters par = Parameters()) 
+		{
+			/// Buffers
+			Eigen::Affine3d motion = init;
+			Eigen::Matrix3Xd X = motion * X0;
+			Eigen::Matrix3Xd Qp = Eigen::Matrix3Xd::Zero(3, X.cols());
+			Eigen::Matrix3Xd Qn = Eigen::Matrix3Xd::Zero(3, X.cols());
+			Eigen::VectorXd W = Eigen::VectorXd::Zero(X.cols());
+			Eigen::Matrix3Xd Xo1 = X;
+			Eigen::Matrix3Xd Xo2 = X;
+			/// ICP
+			for(int icp=0; icp<par.max_icp; ++icp)
+			{
+				/// Find closest point
+				closest.update(X);
+				for(int i=0; i<X.cols(); ++i)
+				{
+					Qp.col(i) = Y.col(closest.index[i]);
+					Qn.col(i) = N.col(closest.index[i]);
+				}
+				/// Computer rotation and translation
+				for(int outer=0; outer<par.max_outer; ++outer) 
+				{
+					/// Compute weights
+					W = (Qn.array()*(X-Qp).array()).colwise().sum().abs().transpose();
+					robust_weight(par.f, W, par.p);
+					/// Rotation and translation update
+					motion = RigidMotionEstimator::point_to_plane(X, Qp, Qn, W) * motion;
+					/// Stopping criteria
+					double stop1 = (X-Xo1).colwise().norm().maxCoeff();
+					Xo1 = X;
+					if(stop1 < par.stop) break;
+				}
+				/// Stopping criteria
+				double stop2 = (X-Xo2).colwise().norm().maxCoeff() ;
+				Xo2 = X;
+				if(stop2 < par.stop) break;
+			}
+			return motion;
+		}
 	}
 
 }
\ No newline at end of file
@@ -98,8 +98,6 @@ void NormalParaDlg::applyNormalSmoothing()
 
 void NormalParaDlg::applyPCANormal()
 {
-	vcg::NormalExtrapolation<vector<CVertex> >::NormalOrientation orientation ;
-
 	if (m_paras->norSmooth.getBool("Run Anistropic PCA"))
 	{
 		area->runNormalSmoothing();
@@ -108,7 +106,7 @@ void NormalParaDlg::applyPCANormal()
 	{
 		int knn = global_paraMgr.norSmooth.getInt("PCA KNN");
 		CMesh* samples = area->dataMgr.getCurrentSamples();
-		vcg::NormalExtrapolation<vector<CVertex> >::ExtrapolateNormals(samples->vert.begin(), samples->vert.end(), knn, -1,orientation,NULL);
+		NormalOrientation::extrapolateNormals(samples->vert, knn);
 	}
 	area->dataMgr.recomputeQuad();
 	area->updateGL();
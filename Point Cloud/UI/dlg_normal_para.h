@@ -5,7 +5,7 @@
 #include <QtGui/QWidget>
 #include <iostream>
 
-#include "Algorithm/normal_extrapolation.h"
+#include "Algorithm/NormalOrientation.h"
 #include "..//GeneratedFiles//ui_normal_para.h"
 #include "ParameterMgr.h"
 #include "glarea.h"
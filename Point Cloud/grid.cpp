@@ -2,45 +2,41 @@
 
 #include <algorithm>
 #include <iostream>
+#include <omp.h>
 using namespace std;
 using namespace vcg;
 
-class XSort {
-  public:
-  bool operator()(const CVertex *a, const CVertex *b) {
-    return a->P()[0] < b->P()[0];
-  }
-};
+// find the cell of coordinate p along one axis, with the same rule the
+// old nested sort used: the first slab whose upper bound is above p.
+// points below the box go to slab 0, points above it return side.
+static inline int axisCell(float p, float min, double radius, int side) {
+  if(!(p < min + side*radius))
+    return side;
+  if(p < min + radius)
+    return 0;
 
-class YSort {
-  public:
-  bool operator()(const CVertex *a, const CVertex *b) {
-    return a->P()[1] < b->P()[1];
-  }
-};
+  int c = (int)((p - min)/radius);
+  if(c > side - 1) c = side - 1;
+  while(c > 0 && p < min + c*radius)
+    --c;
+  while(!(p < min + (c+1)*radius))
+    ++c;
+  return c;
+}
 
-class ZSort {
-  public:
-  bool operator()(const CVertex *a, const CVertex *b) {
-    return a->P()[2] < b->P()[2];
-  }
-};
 // divid sample into some grids
 // and each grid has their points index in the index vector of sample.
+//
+// every point gets a cell key, then a stable counting sort over the keys
+// fills samples/index. the cell ranges are the same as the ones the old
+// Z/Y/X nested sort produced:
+//  - points beyond the last x cell of a row stay in the last cell of that row
+//  - points beyond the last y row of a slab stay in the last cell of that slab
+//  - points beyond the last z slab are kept after index[xside*yside*zside]
 void CGrid::init(std::vector<CVertex> &vert, Box3f &box, double _radius) {
      
-//     cout << "enter grid::init"<<endl;
-     
   radius = _radius;
 
-  samples.resize(vert.size());
-  for(int i = 0; i < samples.size(); i++) {
-    samples[i] = &vert[i];
-	//// new
-	//samples[i]->m_index = i;
-  }
-
-
   Point3f min = box.min;
   Point3f max = box.max; 
 
@@ -48,144 +44,260 @@ void CGrid::init(std::vector<CVertex> &vert, Box3f &box, double _radius) {
   yside = (int)ceil((max[1] - min[1])/radius);
   zside = (int)ceil((max[2] - min[2])/radius);
   
-//  cout << "radius = "<<radius<<endl;
-//  cout << "xside, yside, zside "<<xside<<" "<<yside<<" "<<zside<<endl;
   xside = (xside > 0) ? xside : 1;
   yside = (yside > 0) ? yside : 1;
   zside = (zside > 0) ? zside : 1;
 
   assert(xside > 0 && yside > 0 && zside > 0);
-  
-  index.resize(xside*yside*zside+1, -1);  //x + xside*x + xside*yside*z
-
-  sort(samples.begin(), samples.end(), ZSort()); //this would be very slow 
-
-  int startz = 0;
-  for(int z = 0; z < zside; z++) {
-    int endz = startz;
-    double maxz = min[2] + (z+1)*radius;
-    while(endz < samples.size() && samples[endz]->P()[2] < maxz)
-      ++endz; 
-    
-    sort(samples.begin()+startz, samples.begin()+endz, YSort());
-    
-    int starty = startz;
-    for(int y = 0; y < yside; y++) {
-      int endy = starty;        
-      double maxy = min[1] + (y+1)*radius;
-      while(endy < endz && samples[endy]->P()[1] < maxy)
-        ++endy;
-         
-      sort(samples.begin()+starty, samples.begin()+endy, XSort());
-      
-      int startx = starty;
-      for(int x = 0; x < xside; x++) {
-        int endx = startx;
-        index[x + xside*y + xside*yside*z] = endx;          
-        double maxx = min[0] + (x+1)*radius;
-        while(endx < endy && samples[endx]->P()[0] < maxx)
-          ++endx;
-        
-        startx = endx;
-      }
-      starty = endy;
-      
+
+  int ncell = xside*yside*zside;
+  int n = (int)vert.size();
+
+  std::vector<int> key(n);
+#pragma omp parallel for
+  for(int i = 0; i < n; i++) {
+    const Point3f &p = vert[i].P();
+    int z = axisCell(p[2], min[2], radius, zside);
+    if(z == zside) {
+      key[i] = ncell;   // out of the grid
+      continue;
+    }
+    int y = axisCell(p[1], min[1], radius, yside);
+    if(y == yside) {
+      key[i] = cell(xside-1, yside-1, z);
+      continue;
     }
-    startz = endz;
+    int x = axisCell(p[0], min[0], radius, xside);
+    if(x == xside)
+      x = xside-1;
+    key[i] = cell(x, y, z);
   }
-  index[xside*yside*zside] = startz;  // in order to compute the last grid's range
 
-// for debug..
-//   for (int i = 0; i < samples.size(); i++)
-//   {
-// 	  samples[i]->m_index = i;
-//   }
-  
+  // one histogram per thread, each thread owns a fixed chunk of points
+  // so the order inside a cell is the input order whatever the thread number
+  int nthreads = omp_get_max_threads();
+  if((double)nthreads * (ncell+1) > 64e6 || n < 10000)
+    nthreads = 1;
+
+  std::vector<std::vector<int> > count(nthreads);
+  int chunk = (n + nthreads - 1) / nthreads;
 
+#pragma omp parallel for num_threads(nthreads)
+  for(int t = 0; t < nthreads; t++) {
+    std::vector<int> &c = count[t];
+    c.assign(ncell+1, 0);
+    int end = std::min(n, (t+1)*chunk);
+    for(int i = t*chunk; i < end; i++)
+      ++c[key[i]];
+  }
+
+  index.assign(ncell+1, 0);
+  int offset = 0;
+  for(int k = 0; k <= ncell; k++) {
+    index[k] = offset;
+    for(int t = 0; t < nthreads; t++) {
+      int c = count[t][k];
+      count[t][k] = offset;
+      offset += c;
+    }
+  }
+
+  samples.resize(n);
+#pragma omp parallel for num_threads(nthreads)
+  for(int t = 0; t < nthreads; t++) {
+    std::vector<int> &c = count[t];
+    int end = std::min(n, (t+1)*chunk);
+    for(int i = t*chunk; i < end; i++)
+      samples[c[key[i]]++] = &vert[i];
+  }
 }
 
-void CGrid::iterate(void (*self)(iterator starta, iterator enda, double radius),
-                 void (*other)(iterator starta, iterator enda, 
-                              iterator startb, iterator endb, double radius)) {
+static int corner[8*3] = { 0, 0, 0,  1, 0, 0,  0, 1, 0,  0, 0, 1,
+                           0, 1, 1,  1, 0, 1,  1, 1, 0,  1, 1, 1 };
 
-  static int corner[8*3] = { 0, 0, 0,  1, 0, 0,  0, 1, 0,  0, 0, 1,
-                             0, 1, 1,  1, 0, 1,  1, 1, 0,  1, 1, 1 };
-  
-  // 
-  static int diagonals[14*2] = { 0, 0, //remove this line to avoid self intesextion
-                                 0, 1, 0, 2, 0, 3, 0, 4, 0, 5, 0, 6, 0, 7,
-                                 2, 3, 1, 3, 1, 2,                       
-                                 1, 4, 2, 5, 3, 6 };
-
-  for(int z = 0; z < zside; z++) {
-    for(int y = 0; y < yside; y++) {
-      for(int x = 0; x < xside; x++) {
-        int origin = cell(x, y, z);
-        self(startV(origin), endV(origin), radius);  // 
-        // compute between other girds
-        for(int d = 2; d < 28; d += 2) { // skipping self
-          int *cs = corner + 3*diagonals[d];
-          int *ce = corner + 3*diagonals[d+1];
-          if((x + cs[0] < xside) && (y + cs[1] < yside) && (z + cs[2] < zside) &&
-             (x + ce[0] < xside) && (y + ce[1] < yside) && (z + ce[2] < zside)) {
-			 
-             origin = cell(x+cs[0], y+cs[1], z+cs[2]);
-             int dest = cell(x+ce[0], y+ce[1], z+ce[2]);
-             other(startV(origin), endV(origin), 
-                   startV(dest),   endV(dest), radius);        
-          }
-        } // for( int d...)      
-      }
+// 
+static int diagonals[14*2] = { 0, 0, //remove this line to avoid self intesextion
+                               0, 1, 0, 2, 0, 3, 0, 4, 0, 5, 0, 6, 0, 7,
+                               2, 3, 1, 3, 1, 2,                       
+                               1, 4, 2, 5, 3, 6 };
+
+// the cell (x, y, z) only touches the 2x2x2 block of cells starting at it.
+// two cells with the same parity in x, y and z are at least 2 cells apart
+// along one axis, so their blocks never overlap: the 8 parity classes are
+// run one after the other and the cells inside a class in parallel.
+// every vertex is written by one cell per class, in a fixed class order,
+// so the result does not depend on the number of threads.
+template <class CellVisitor>
+static void visitCells(int xside, int yside, int zside, bool parallel, CellVisitor &visit) {
+  if(!parallel) {
+    for(int z = 0; z < zside; z++)
+      for(int y = 0; y < yside; y++)
+        for(int x = 0; x < xside; x++)
+          visit(x, y, z);
+    return;
+  }
+
+  for(int color = 0; color < 8; color++) {
+    int cx = color & 1, cy = (color >> 1) & 1, cz = (color >> 2) & 1;
+    int nx = (xside - cx + 1) / 2;
+    int ny = (yside - cy + 1) / 2;
+    int nz = (zside - cz + 1) / 2;
+    int total = nx * ny * nz;
+
+#pragma omp parallel for schedule(dynamic, 16)
+    for(int i = 0; i < total; i++) {
+      int x = cx + 2 * (i % nx);
+      int y = cy + 2 * ((i / nx) % ny);
+      int z = cz + 2 * (i / (nx * ny));
+      visit(x, y, z);
     }
   }
 }
 
+// the callbacks of iterate/sample, without and with a context
+class PlainCalls {
+  public:
+  typedef CGrid::iterator iterator;
+  PlainCalls(void (*_self)(iterator starta, iterator enda, double radius),
+             void (*_other)(iterator starta, iterator enda, 
+                            iterator startb, iterator endb, double radius))
+    : self(_self), other(_other) {}
 
-void CGrid::sample(CGrid &points, 
-                void (*sample)(iterator starta, iterator enda, 
-                               iterator startb, iterator endb, double radius)) {
+  void callSelf(iterator starta, iterator enda, double radius) {
+    self(starta, enda, radius);
+  }
+  void callOther(iterator starta, iterator enda, iterator startb, iterator endb, double radius) {
+    other(starta, enda, startb, endb, radius);
+  }
 
-   static int corner[8*3] = { 0, 0, 0,  1, 0, 0,  0, 1, 0,  0, 0, 1,
-                              0, 1, 1,  1, 0, 1,  1, 1, 0,  1, 1, 1 };
+  void (*self)(iterator starta, iterator enda, double radius);
+  void (*other)(iterator starta, iterator enda, 
+                iterator startb, iterator endb, double radius);
+};
 
-   static int diagonals[14*2] = { 0, 0, //remove this line to avoid self intesextion
-                                  0, 1, 0, 2, 0, 3, 0, 4, 0, 5, 0, 6, 0, 7,
-                                  2, 3, 1, 3, 1, 2,                       
-                                  1, 4, 2, 5, 3, 6 };
+class ContextCalls {
+  public:
+  typedef CGrid::iterator iterator;
+  ContextCalls(void (*_self)(iterator starta, iterator enda, double radius, void *context),
+               void (*_other)(iterator starta, iterator enda, 
+                              iterator startb, iterator endb, double radius, void *context),
+               void *_context)
+    : self(_self), other(_other), context(_context) {}
 
-  for(int z = 0; z < zside; z++) {
-    for(int y = 0; y < yside; y++) {
-      for(int x = 0; x < xside; x++) {     
-        int origin = cell(x, y, z);  
+  void callSelf(iterator starta, iterator enda, double radius) {
+    self(starta, enda, radius, context);
+  }
+  void callOther(iterator starta, iterator enda, iterator startb, iterator endb, double radius) {
+    other(starta, enda, startb, endb, radius, context);
+  }
 
-         
-        if(!isEmpty(origin) && !points.isEmpty(origin)) 
-          sample(startV(origin), endV(origin), 
-                 points.startV(origin),   points.endV(origin), radius);  
-                        
+  void (*self)(iterator starta, iterator enda, double radius, void *context);
+  void (*other)(iterator starta, iterator enda, 
+                iterator startb, iterator endb, double radius, void *context);
+  void *context;
+};
 
-        for(int d = 2; d < 28; d += 2) { //skipping self
-          int *cs = corner + 3*diagonals[d];
-          int *ce = corner + 3*diagonals[d+1];
-          if((x+cs[0] < xside) && (y+cs[1] < yside) && (z+cs[2] < zside) &&
-             (x+ce[0] < xside) && (y+ce[1] < yside) && (z+ce[2] < zside)) {
+template <class Calls>
+class IterateVisitor {
+  public:
+  IterateVisitor(CGrid &_grid, Calls _calls)
+    : grid(_grid), calls(_calls) {}
 
-             origin   = cell(x+cs[0], y+cs[1], z+cs[2]);
+  void operator()(int x, int y, int z) {
+    int origin = grid.cell(x, y, z);
+    calls.callSelf(grid.startV(origin), grid.endV(origin), grid.radius);  // 
+    // compute between other girds
+    for(int d = 2; d < 28; d += 2) { // skipping self
+      int *cs = corner + 3*diagonals[d];
+      int *ce = corner + 3*diagonals[d+1];
+      if((x + cs[0] < grid.xside) && (y + cs[1] < grid.yside) && (z + cs[2] < grid.zside) &&
+         (x + ce[0] < grid.xside) && (y + ce[1] < grid.yside) && (z + ce[2] < grid.zside)) {
 
-             int dest = cell(x+ce[0], y+ce[1], z+ce[2]);
+         origin = grid.cell(x+cs[0], y+cs[1], z+cs[2]);
+         int dest = grid.cell(x+ce[0], y+ce[1], z+ce[2]);
+         calls.callOther(grid.startV(origin), grid.endV(origin), 
+                         grid.startV(dest),   grid.endV(dest), grid.radius);        
+      }
+    } // for( int d...)      
+  }
 
-             if(!isEmpty(origin) && !points.isEmpty(dest))           // Locally 
-               sample(startV(origin), endV(origin), 
-                      points.startV(dest),   points.endV(dest), radius); 
+  CGrid &grid;
+  Calls calls;
+};
+
+// calls.other is the pair function, calls.self is not used
+template <class Calls>
+class SampleVisitor {
+  public:
+  SampleVisitor(CGrid &_grid, CGrid &_points, Calls _calls)
+    : grid(_grid), points(_points), calls(_calls) {}
 
-             if(!isEmpty(dest) && !points.isEmpty(origin))  
-               sample(startV(dest), endV(dest), 
-                      points.startV(origin),   points.endV(origin), radius);        
-          }
-        }      
+  void operator()(int x, int y, int z) {
+    int origin = grid.cell(x, y, z);  
+
+    if(!grid.isEmpty(origin) && !points.isEmpty(origin)) 
+      calls.callOther(grid.startV(origin), grid.endV(origin), 
+                      points.startV(origin),   points.endV(origin), grid.radius);  
+
+    for(int d = 2; d < 28; d += 2) { //skipping self
+      int *cs = corner + 3*diagonals[d];
+      int *ce = corner + 3*diagonals[d+1];
+      if((x+cs[0] < grid.xside) && (y+cs[1] < grid.yside) && (z+cs[2] < grid.zside) &&
+         (x+ce[0] < grid.xside) && (y+ce[1] < grid.yside) && (z+ce[2] < grid.zside)) {
+
+         origin   = grid.cell(x+cs[0], y+cs[1], z+cs[2]);
+
+         int dest = grid.cell(x+ce[0], y+ce[1], z+ce[2]);
+
+         if(!grid.isEmpty(origin) && !points.isEmpty(dest))           // Locally 
+           calls.callOther(grid.startV(origin), grid.endV(origin), 
+                           points.startV(dest),   points.endV(dest), grid.radius); 
+
+         if(!grid.isEmpty(dest) && !points.isEmpty(origin))  
+           calls.callOther(grid.startV(dest), grid.endV(dest), 
+                           points.startV(origin),   points.endV(origin), grid.radius);        
       }
-    }
+    }      
   }
+
+  CGrid &grid;
+  CGrid &points;
+  Calls calls;
+};
+
+void CGrid::iterate(void (*self)(iterator starta, iterator enda, double radius),
+                 void (*other)(iterator starta, iterator enda, 
+                              iterator startb, iterator endb, double radius)) {
+
+  IterateVisitor<PlainCalls> visitor(*this, PlainCalls(self, other));
+  visitCells(xside, yside, zside, parallel, visitor);
+}
+
+
+void CGrid::sample(CGrid &points, 
+                void (*sample)(iterator starta, iterator enda, 
+                               iterator startb, iterator endb, double radius)) {
+
+  SampleVisitor<PlainCalls> visitor(*this, points, PlainCalls(NULL, sample));
+  visitCells(xside, yside, zside, parallel, visitor);
+}
+
+
+void CGrid::iterate(void (*self)(iterator starta, iterator enda, double radius, void *context),
+                 void (*other)(iterator starta, iterator enda, 
+                              iterator startb, iterator endb, double radius, void *context),
+                 void *context) {
+
+  IterateVisitor<ContextCalls> visitor(*this, ContextCalls(self, other, context));
+  visitCells(xside, yside, zside, parallel, visitor);
 }
 
 
+void CGrid::sample(CGrid &points, 
+                void (*sample)(iterator starta, iterator enda, 
+                               iterator startb, iterator endb, double radius, void *context),
+                void *context) {
+
+  SampleVisitor<ContextCalls> visitor(*this, points, ContextCalls(NULL, sample, context));
+  visitCells(xside, yside, zside, parallel, visitor);
+}
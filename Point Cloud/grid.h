@@ -2,7 +2,7 @@
 #define FIXED_GRID_H
 
 #include <vector>
-#include "cmesh.h"
+#include "CMesh.h"
 #include <fstream>
 using namespace std;
 
@@ -13,10 +13,11 @@ class CGrid {
     std::vector<int> index;    // the start index of each grid in the sample points which is order by Zsort
     int xside, yside, zside;
     double radius;
+    bool parallel;   // run iterate/sample on all cores, the callbacks may only write data of the vertices they are given
 
     typedef std::vector<CVertex *>::iterator iterator;
     
-    CGrid() {}
+    CGrid() : parallel(false) {}
     void init(std::vector<CVertex> &vert, vcg::Box3f &box, double radius);
 
     // compute the repulsion terms, update vertex.p & vertex.wp
@@ -28,6 +29,19 @@ class CGrid {
     void sample(CGrid &points, 
                 void (*sample)(iterator starta, iterator enda, 
                                iterator startb, iterator endb, double radius));
+
+    // the same walks, context is handed to every call. the state of a walk
+    // lives with its caller, so two walks (two threads, two instances) can
+    // not overwrite each other
+    void iterate(void (*self)(iterator starta, iterator enda, double radius, void *context),
+                 void (*other)(iterator starta, iterator enda, 
+                              iterator startb, iterator endb, double radius, void *context),
+                 void *context);
+
+    void sample(CGrid &points, 
+                void (*sample)(iterator starta, iterator enda, 
+                               iterator startb, iterator endb, double radius, void *context),
+                void *context);
                      
     int cell(int x, int y, int z) { return x + xside*(y + yside*z); }
     bool isEmpty(int cell) { return index[cell+1] == index[cell]; }
@@ -0,0 +1,140 @@
+#include "kdtree.h"
+
+#include <algorithm>
+#include <iostream>
+#include <assert.h>
+using namespace std;
+using namespace vcg;
+
+class AxisSort {
+  public:
+  AxisSort(const std::vector<Point3f> &_pts, int _axis) : pts(_pts), axis(_axis) {}
+  bool operator()(int a, int b) const {
+    return pts[a][axis] < pts[b][axis];
+  }
+  const std::vector<Point3f> &pts;
+  int axis;
+};
+
+void CKdTree::clear() {
+  points.clear();
+  index.clear();
+  nodes.clear();
+}
+
+// the positions are copied once, so the search never touches a CVertex
+void CKdTree::build(std::vector<CVertex> &vert) {
+  clear();
+  if(vert.empty())
+    return;
+
+  points.resize(vert.size());
+  index.resize(vert.size());
+  for(int i = 0; i < vert.size(); i++) {
+    points[i] = vert[i].P();
+    index[i] = i;
+  }
+
+  nodes.reserve(2 * (vert.size() / leaf_size + 1));
+  buildNode(0, (int)index.size());
+
+  // reorder the positions so every leaf is one contiguous block
+  std::vector<Point3f> sorted(points.size());
+  for(int i = 0; i < index.size(); i++)
+    sorted[i] = points[index[i]];
+  points.swap(sorted);
+}
+
+int CKdTree::buildNode(int begin, int end) {
+  int id = (int)nodes.size();
+  nodes.push_back(Node());
+  nodes[id].begin = begin;
+  nodes[id].end = end;
+  nodes[id].left = -1;
+  nodes[id].right = -1;
+  nodes[id].axis = 0;
+  nodes[id].split = 0;
+
+  if(end - begin <= leaf_size)
+    return id;
+
+  Box3f box;
+  for(int i = begin; i < end; i++)
+    box.Add(points[index[i]]);
+
+  Point3f dim = box.Dim();
+  int axis = 0;
+  if(dim[1] > dim[axis]) axis = 1;
+  if(dim[2] > dim[axis]) axis = 2;
+
+  // all the points are the same, no way to split them
+  if(dim[axis] <= 0)
+    return id;
+
+  int mid = begin + (end - begin) / 2;
+  nth_element(index.begin() + begin, index.begin() + mid, index.begin() + end, AxisSort(points, axis));
+
+  float split = points[index[mid]][axis];
+
+  int left = buildNode(begin, mid);
+  int right = buildNode(mid, end);
+
+  nodes[id].axis = axis;
+  nodes[id].split = split;
+  nodes[id].left = left;
+  nodes[id].right = right;
+  return id;
+}
+
+int CKdTree::knnSearch(const Point3f &q, int k, std::vector<Candidate> &heap) const {
+  heap.clear();
+  if(nodes.empty() || k <= 0)
+    return 0;
+
+  if(k > points.size())
+    k = (int)points.size();
+
+  // (node, lower bound of the squared distance to anything inside it)
+  std::pair<int, float> stack[128];
+  int top = 0;
+  stack[top++] = std::make_pair(0, 0.f);
+
+  while(top > 0) {
+    std::pair<int, float> item = stack[--top];
+    if(heap.size() == k && item.second >= heap.front().first)
+      continue;
+
+    const Node &node = nodes[item.first];
+    if(node.left < 0) {
+      for(int i = node.begin; i < node.end; i++) {
+        const Point3f &p = points[i];
+        float dx = p[0] - q[0];
+        float dy = p[1] - q[1];
+        float dz = p[2] - q[2];
+        float dist2 = dx*dx + dy*dy + dz*dz;
+
+        if(heap.size() < k) {
+          heap.push_back(Candidate(dist2, index[i]));
+          push_heap(heap.begin(), heap.end());
+        }
+        else if(dist2 < heap.front().first) {
+          pop_heap(heap.begin(), heap.end());
+          heap.back() = Candidate(dist2, index[i]);
+          push_heap(heap.begin(), heap.end());
+        }
+      }
+      continue;
+    }
+
+    float diff = q[node.axis] - node.split;
+    int near_child = (diff < 0) ? node.left : node.right;
+    int far_child  = (diff < 0) ? node.right : node.left;
+
+    assert(top + 2 <= 128);
+    stack[top++] = std::make_pair(far_child, max(item.second, diff * diff));
+    stack[top++] = std::make_pair(near_child, item.second);
+  }
+
+  sort_heap(heap.begin(), heap.end());
+  return (int)heap.size();
+}
@@ -0,0 +1,47 @@
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+#include <vector>
+#include <utility>
+#include "CMesh.h"
+using namespace std;
+
+
+// static kd-tree over a copy of the vertex positions.
+// build once, then query from as many threads as you like:
+// the search keeps all its state in the caller's buffer.
+class CKdTree {
+  public:
+    typedef std::pair<float, int> Candidate;  // (squared distance, vertex index)
+
+    CKdTree() : leaf_size(8) {}
+    void build(std::vector<CVertex> &vert);
+    void clear();
+
+    int size() const { return (int)points.size(); }
+    bool isEmpty() const { return points.empty(); }
+
+    // k nearest points of q, sorted by increasing distance.
+    // heap is the per-thread work buffer, on return it holds the result.
+    // returns the number of neighbors found (min(k, size())).
+    int knnSearch(const vcg::Point3f &q, int k, std::vector<Candidate> &heap) const;
+
+  private:
+    struct Node {
+      int begin, end;      // range in points/index
+      int left, right;     // children, -1 for a leaf
+      int axis;
+      float split;
+    };
+
+    int buildNode(int begin, int end);
+
+  private:
+    std::vector<vcg::Point3f> points;  // reordered copy, contiguous for the leaves
+    std::vector<int> index;            // position in the input vector
+    std::vector<Node> nodes;
+    int leaf_size;
+};
+
+
+#endif
@@ -473,6 +473,7 @@ void MainWindow::subSample()
 void MainWindow::normalizeData()
 {
 	area->dataMgr.normalizeAllMesh();
+	area->wlop.setFirstIterate();
 	area->initView();
 	area->updateGL();
 }
@@ -499,10 +500,11 @@ void MainWindow::saveView()
 
 void MainWindow::saveSkel()
 {
-	QString file = QFileDialog::getSaveFileName(this, "Save samples as", "", "*.skel");
+	QString file = QFileDialog::getSaveFileName(this, "Save samples as", "", "*.skel;;*.bskel");
 	if(!file.size()) return;
 
 	area->dataMgr.saveSkeletonAsSkel(file);
+	file.replace(".bskel", ".View");
 	file.replace(".skel", ".View");
 	area->saveView(file);
 
@@ -684,7 +686,7 @@ void MainWindow::runPCA_Normal()
 {
 	int knn = global_paraMgr.norSmooth.getInt("PCA KNN");
 	CMesh* samples = area->dataMgr.getCurrentSamples();
-	vcg::NormalExtrapolation<vector<CVertex> >::ExtrapolateNormals(samples->vert.begin(), samples->vert.end(), knn, -1);
+	NormalOrientation::extrapolateNormals(samples->vert, knn);
 }
 
 void MainWindow::reorientateNormal()
@@ -2,7 +2,7 @@
 #define MAINWINDOW_H
 
 #include <QtGui/QMainWindow>
-#include "Algorithm/normal_extrapolation.h"
+#include "Algorithm/NormalOrientation.h"
 #include "ui_mainwindow.h"
 #include "GLArea.h"
 #include "UI/std_para_dlg.h"